@@ -13,6 +13,18 @@ ECHO Compiling cli_term.c...
 gcc cli_term.c %CFLAGS% -I ./include -c
 IF ERRORLEVEL 1 GOTO ERROR
 
+ECHO Compiling cli_draw.c...
+gcc cli_draw.c %CFLAGS% -I ./include -c
+IF ERRORLEVEL 1 GOTO ERROR
+
+ECHO Compiling cli_hud.c...
+gcc cli_hud.c %CFLAGS% -I ./include -c
+IF ERRORLEVEL 1 GOTO ERROR
+
+ECHO Compiling cli_decode.c...
+gcc cli_decode.c %CFLAGS% -I ./include -I ./include/ffmpeg -c
+IF ERRORLEVEL 1 GOTO ERROR
+
 ECHO Compiling oswrap.c...
 gcc oswrap.c %CFLAGS% -I ./include -c
 IF ERRORLEVEL 1 GOTO ERROR
@@ -28,8 +40,8 @@ ECHO Resources...
 windres cli-w32.rc -O coff -o cli.res
 
 ECHO Linking...
-g++ oswrap.o cli_term.o cli.o speech.o utils.o cli.res %LFLAGS% -I ./include -L ./lib-w32 -mwindows -lmingw32 -lsdlmain -lsdl -lavcodec -lavutil -lwsock32 -lmsvcrt -lswscale -lsam -lrcplug_cli -o bin/cli.exe
-g++ oswrap.o cli_term.o cli.o speech.o utils.o cli.res %LFLAGS% -I ./include -L ./lib-w32                               -lsdl -lavcodec -lavutil -lwsock32 -lmsvcrt -lswscale -lsam -lrcplug_cli -o bin/cli_nosdl.exe
+g++ oswrap.o cli_term.o cli_decode.o cli_draw.o cli_hud.o cli.o speech.o utils.o cli.res %LFLAGS% -I ./include -L ./lib-w32 -mwindows -lmingw32 -lsdlmain -lsdl -lavcodec -lavutil -lws2_32 -lwsock32 -lmsvcrt -lswscale -lsam -lrcplug_cli -o bin/cli.exe
+g++ oswrap.o cli_term.o cli_decode.o cli_draw.o cli_hud.o cli.o speech.o utils.o cli.res %LFLAGS% -I ./include -L ./lib-w32                               -lsdl -lavcodec -lavutil -lws2_32 -lwsock32 -lmsvcrt -lswscale -lsam -lrcplug_cli -o bin/cli_nosdl.exe
 IF ERRORLEVEL 1 GOTO ERROR
 
 ECHO Cleaning up...
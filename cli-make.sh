@@ -6,6 +6,15 @@ gcc cli.c -c -I./include -o cli.o
 echo Compiling cli_term.c...
 gcc cli_term.c -c -I./include -o cli_term.o
 
+echo Compiling cli_draw.c...
+gcc cli_draw.c -c -I./include -o cli_draw.o
+
+echo Compiling cli_hud.c...
+gcc cli_hud.c -c -I./include -o cli_hud.o
+
+echo Compiling cli_decode.c...
+gcc cli_decode.c -c -I./include -o cli_decode.o
+
 echo Compiling oswrap.c...
 gcc oswrap.c -c -I./include -o oswrap.o
 
@@ -16,7 +25,7 @@ echo Compiling utils.c...
 gcc utils.c -c $CFLAGS -I./include -o utils.o
 
 echo Linking...
-gcc cli.o oswrap.o cli_term.o speech.o utils.o -L./lib-linux -lsam -l SDL -l avcodec -l avutil -l swscale -lz -lrcplug_cli -o bin/cli
+gcc cli.o oswrap.o cli_term.o cli_decode.o cli_draw.o cli_hud.o speech.o utils.o -L./lib-linux -lsam -l SDL -l avcodec -l avutil -l swscale -lz -lrcplug_cli -lrt -o bin/cli
 
 echo Cleaning up...
 rm *.o
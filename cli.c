@@ -1,12 +1,13 @@
 #include <stdio.h>
 #include <SDL/SDL.h>
-#include <libswscale/swscale.h>
-#include <libavcodec/avcodec.h>
 #include "oswrap.h"
 #include "robocortex.h"
 #include "speech.h"
 #include "cli_term.h"
+#include "cli_decode.h"
 #include "plugins/cli.h"
+#include "cli_draw.h"
+#include "cli_hud.h"
 #include "sdl_console.h"
 
 // Plugins
@@ -14,6 +15,9 @@
 extern pluginclient_t *kiwiray_open( pluginhost_t* );
 extern pluginclient_t *monitor_open( pluginhost_t* );
 extern pluginclient_t *ipv4udp_open( pluginhost_t* );
+extern pluginclient_t *shm0_open( pluginhost_t* );
+extern pluginclient_t *udpm_open( pluginhost_t* );
+extern pluginclient_t *multipath_open( pluginhost_t* );
 
 // Protocol
 #define MAX_RETRY              5 // Maximum number of retransmissions of lost packets
@@ -21,9 +25,35 @@ extern pluginclient_t *ipv4udp_open( pluginhost_t* );
 // Configuration
 #define CLIENT_RPS            50 // Client refreshes per second
 
-// Timeouts (in refreshes, see CLIENT_RPS)
-#define TIMEOUT_TRUST         16 // Before retransmitting trusted packets
-#define TIMEOUT_STREAM       125 // Before considering connection lost
+// Timeouts (in ms)
+#define TIMEOUT_TRUST        320 // Before retransmitting trusted packets
+#define TIMEOUT_STREAM      2500 // Before considering connection lost
+
+// Control
+#define CTRL_RATE            100 // Max CTRL packets per second while input changes
+#define CTRL_KEEPALIVE        40 // Interval (ms) between CTRL packets while input is idle
+#define CTRL_HELD             20 // Same while a key is held, a loss stays within the server's glitch timeout (2 frames)
+
+// Intervals (in ms)
+#define INTERVAL_RETRY      2000 // Between HELO/TIME retransmissions
+#define INTERVAL_MESSAGE    2500 // Before temporary messages are cleared
+#define INTERVAL_MEASURE    5000 // Between receive-to-present reports
+#define INTERVAL_HUD         250 // Between HUD samples
+#define WAIT_SLICE             2 // Max sleep (ms) before checking for input again
+
+// Screen updates
+#define MAX_DIRTY             64 // Changed regions per update before updating the whole screen
+#define VIS_SPAN             170 // Height of speech visualization band at bottom of screen
+#define VIS_POINTS           160 // Samples in speech visualization
+
+// Decoding
+#define LATENCY              100 // Video backlog (ms) before skipping to newest recovery point
+#define STREAMS_MAX           16 // Capture source streams composed by the client
+
+// Reprojection
+#define REPROJECT_X          1.0 // Horizontal shift (pixels) per unacknowledged mouse count
+#define REPROJECT_Y          0.3 // Vertical shift (pixels) per unacknowledged mouse count
+#define CTRL_HISTORY         256 // Sent control data kept for reconciling with acknowledgements
 
 // Screen defaults
 #define SCREEN_WIDTH         640 // Width
@@ -68,10 +98,19 @@ enum exitcode_e {
   EXIT_COMMS
 };
 
+// Capture source stream, decoded at its size on screen
+typedef struct {
+  decoder_t         *dec;
+  int                broken;           // Decoder could not be opened
+  strm_data_t        hdr;              // Latest placement
+  SDL_Surface       *front;            // Latest decoded frame
+} strm_t;
+
 // Texts
 static           char  text_contact[] =  "ESTABLISHING CORTEX...";
 static           char  text_error[]   =  "   CONNECTION ERROR   ";
 static           char  text_queued[] =   "  QUEUED FOR CONTROL  ";
+static           char  text_spectate[] = "      SPECTATING      ";
 static           char  text_full[] =     " QUEUE IS FULL, SORRY ";
 static           char  text_lost[] =     "  CONNECTION IS LOST  ";
 static           char  text_quit[] =     "   PRESS H FOR HELP   ";
@@ -83,6 +122,8 @@ static           char  text_timeout[] =  "TIME LEFT: 00:00";
 
 // Packet types
 static           char  pkt_h264[ 4 ] = { 0x00, 0x00, 0x00, 0x01 };
+static           char  pkt_jpeg[ 4 ] = "JPEG";
+static           char  pkt_strm[ 4 ] = "STRM";
 static           char  pkt_data[ 4 ] = "DATA";
 static           char  pkt_helo[ 4 ] = "HELO";
 static           char  pkt_time[ 4 ] = "TIME";
@@ -90,19 +131,47 @@ static           char  pkt_ctrl[ 4 ] = "CTRL";
 static           char  pkt_lost[ 4 ] = "LOST";
 static           char  pkt_full[ 4 ] = "FULL";
 static           char  pkt_quit[ 4 ] = "QUIT";
+static           char  pkt_cook[ 4 ] = "COOK";
 
 // Locals
 static    disp_data_t  disp_data;                       // Data from latest DISP packet
 static    SDL_Surface *spr_logo;                        // Sprites
 static    SDL_Surface *spr_box;
+static    SDL_Surface *spr_help;                        // Help box, rendered once
+static       SDL_Rect  dirty[ MAX_DIRTY ];              // Screen regions changed since last update
+static            int  dirty_count;
+static            int  dirty_full;                      // Whole screen changed
 static    SDL_Surface *screen;                          // Screen surface
 static            int  screen_w = SCREEN_WIDTH;         // Resolution
 static            int  screen_h = SCREEN_HEIGHT;
 static            int  screen_bpp = SCREEN_BPP;
 static            int  fullscreen = SCREEN_FS;          // Fullscreen mode active
-static   linked_buf_t *p_buffer_last;                   // Decoding buffer
-static   linked_buf_t *p_buffer_first;
+static      decoder_t *decoder;                         // Decode thread and frame buffers
+static            int  latency = LATENCY;               // Video backlog budget (ms)
+static        SDL_sem *wake;                            // Posted by decoder when a frame is ready
+static          strm_t  strms[ STREAMS_MAX ];           // Capture source streams, when composed here
+static            int  strm_count;                      // Streams opened
+static      SDL_mutex *strm_mx;                         // Stream placement access mutex
+static    SDL_Surface *strm_comp;                       // Composition of all streams
+static         Uint32  strm_arrival;                    // Arrival of the newest composed frame
+static            int  immediate = 1;                   // Present frames as soon as they are decoded
+static            int  interpolate;                     // Synthesise frames between decoded ones
+static            int  measure;                         // Report latency and composite statistics
+static       uint64_t  measure_sum;                     // Receive-to-present statistics (ms)
+static   unsigned int  measure_max, measure_count;
+static       uint64_t  input_sum;                       // Input-to-send statistics (ms)
+static   unsigned int  input_max, input_count;
+static       uint64_t  g2g_sum;                         // Control-to-present statistics (ms)
+static   unsigned int  g2g_max, g2g_count;
+static  volatile  int  measure_bytes;                   // Video received since last report
+static  unsigned char  stream_enc = ENC_H264;           // Stream encoding chosen by server, encoder_e
+static       uint64_t  composite_sum, composite_max;    // Composite statistics (us)
+static   unsigned int  composite_count;
+static       uint64_t  composite_area;                  // Pixels pushed to display
+static         Uint32  measure_time;
 static  volatile  int  state = STATE_CONNECTING;        // Client state
+static            int  spectate;                        // Watch only, never take control
+static            int  reduced;                         // Ask for the reduced simulcast layer
 static  volatile  int  retry = 0;                       // Used for retransmissions and timeouts
 static            int  queue_time;                      // Time left before FUN
 static   linked_buf_t *trust_first = NULL;              // Non-lossy packet buffer
@@ -110,28 +179,53 @@ static   linked_buf_t *trust_last = NULL;
 static  unsigned char  trust_srv = 0xFF;                // Non-lossy transmission counters
 static  unsigned char  trust_cli = 0x00;
 static      SDL_mutex *trust_mx;                        // Non-lossy buffer access mutex
-static            int  trust_timeout = 0;               // Non-lossy retransmission timeout
+static         Uint32  trust_timeout = 0;               // Non-lossy retransmission time, 0 if none pending
 static            int  cursor_grabbed;                  // Cursor is grabbed
-static          Uint8  draw_red, draw_green, draw_blue; // Drawing color
 static  unsigned char  layout = KL_QWERTY;
 static         SDLKey  keymap[ KM_SIZE ];               // Keyboard remapping
 static   unsigned int  message_timeout = 0;
 static    ctrl_data_t  ctrl;                            // Part of CTRL packet
+static         ctrl_t  ctrl_sent;                       // Control data in last CTRL packet
+static         Uint32  ctrl_time;                       // Time of last CTRL packet
+static            int  ctrl_rate = CTRL_RATE;           // Max CTRL packets per second
+static         ctrl_t  ctrl_history[ CTRL_HISTORY ];    // Control data sent, by sequence
+static         Uint32  ctrl_sent_tick[ CTRL_HISTORY ];  // Send time, by sequence
+static unsigned short  ack_pending;                     // Sequence acknowledged by latest DATA packet
+static unsigned short  ack_shown;                       // Sequence acknowledged for frame on screen
+static            int  ack_new;                         // Frame on screen acknowledges newer control data
+static            int  reproject;                       // Shift frame by input not yet acknowledged
+static         double  reproject_x = REPROJECT_X;       // Reprojection gains
+static         double  reproject_y = REPROJECT_Y;
+static            int  shift_x, shift_y;                // Current reprojection (pixels)
+static         Uint32  input_time;                      // Time of oldest input not yet sent, 0 if none
+static         Uint32  stream_time;                     // Time of last H.264 or JPEG packet
 static            int  help_shown;                      // Help is displayed
+static            int  hud_shown;                       // Performance HUD is displayed
+static         Uint32  hud_time;                        // Time of last HUD sample
+static  volatile  int  hud_bytes, hud_frames;           // Video received since last sample
+static  volatile  int  hud_data, hud_lost;              // DATA packets received and missing
+static  volatile  int  hud_rtt_sum, hud_rtt_count;      // Round-trip time (ms)
+static            int  hud_lat_sum, hud_lat_count;      // Receive-to-present delay (ms)
+static       uint32_t  hud_frame_last;                  // Last frame number received in DATA
+static   unsigned int  hud_decoded, hud_dropped;        // Decoder counters at last sample
 static           void  ( *comm_send )( char*, int );    // Communications handler
+static           char  p_helo[ 4 + 8 + 2 ] = "HELO";    // HELO packet, with cookie, encodings and flags once received
+static            int  i_helo = HELO_MIN;               // Tracks size of p_helo
+static           char  p_time[ 4 + sizeof( session_t ) ] = "TIME"; // TIME packet, with session
 
 // Help texts
 static           char  help[ 16 ][ 33 ] = {
   { "CONTROLS: WASD + MOUSE" },
   { "L: TOGGLE QWERTY, DVORAK, AZERTY" },
   { "H: SHOW/HIDE HELP" },
+  { "P: SHOW/HIDE PERFORMANCE" },
   { "F: TOGGLE FULL-SCREEN" },
   { "   WHEN IN WINDOWED MODE, USED" },
   { "   MOUSE-LEFT TO GRAB/UNGRAB" },
   { "ESCAPE: QUIT" },
   { "" },
 };
-static  unsigned char help_count = 8;
+static  unsigned char help_count = 9;
 
 // Plugins
 static   pluginhost_t  host;
@@ -141,6 +235,11 @@ static            int  plugs_count;
 static pluginclient_t *cursor_hook;
 static pluginclient_t *keyboard_hook;
 static pluginclient_t *keyboard_binds[ SDLK_LAST ];
+static       uint32_t  comm_prio[ MAX_PLUGINS ];       // Transport priority list (from configuration)
+static            int  comm_prio_count;
+static pluginclient_t *comms[ MAX_PLUGINS ];           // Initialized transports, in priority order
+static            int  comms_count;
+static            int  comms_index;                    // Transport currently in use
 
 // Configuration
 static           char config_default[] = "cli.rc"; // Default configuration file
@@ -195,103 +294,6 @@ static void trust_handler( char* data, int size ) {
 
 /* == GRAPHICS HELPERS ========================================================================== */
 
-// Sets drawing color
-static void draw_color( Uint8 red, Uint8 green, Uint8 blue ) {
-  draw_red = red;
-  draw_green = green;
-  draw_blue = blue;
-}
-
-// Draws an alpha-blended pixel, used by draw_wu
-static void draw_pixel( short x, short y, Uint8 a ) {
-  Uint8 cr, cg, cb;
-  Uint32 cv;
-  if( y >= screen_h || x < 0 || x >= screen_w ) return;
-
-  cv = ( *( Uint32* )( ( ( uint8_t* )screen->pixels ) + ( y * screen->pitch + x * 4 ) ) );
-
-  SDL_GetRGB( cv, screen->format, &cr, &cg, &cb );
-  cr = ( ( ( int )cr * a ) + ( ( int )draw_red   * ( 255 - a ) ) ) >> 8;
-  cg = ( ( ( int )cg * a ) + ( ( int )draw_green * ( 255 - a ) ) ) >> 8;
-  cb = ( ( ( int )cb * a ) + ( ( int )draw_blue  * ( 255 - a ) ) ) >> 8;
-  cv = SDL_MapRGB( screen->format, cr, cg, cb );
-
-  ( *( Uint32* )( ( ( uint8_t* )screen->pixels ) + ( y * screen->pitch + x * 4 ) ) ) = cv;
-}
-
-// Draws a wu-line. Implementation, courtesy of http://www.codeproject.com/KB/GDI/antialias.aspx
-static void draw_wu( short X0, short Y0, short X1, short Y1 ) {
-   unsigned short IntensityShift, ErrorAdj, ErrorAcc;
-   unsigned short ErrorAccTemp, Weighting, WeightingComplementMask;
-   short DeltaX, DeltaY, Temp, XDir;
-   SDL_LockSurface( screen );
-   // Locked parameters
-   #define BaseColor 0
-   #define NumLevels 256
-   #define IntensityBits 8
-   // Precomputing
-   if( Y0 > Y1 ) {
-      Temp = Y0; Y0 = Y1; Y1 = Temp;
-      Temp = X0; X0 = X1; X1 = Temp;
-   }
-   if( ( DeltaX = X1 - X0 ) >= 0 ) {
-      XDir = 1;
-   } else {
-      XDir = -1;
-      DeltaX = -DeltaX;
-   }
-   // Draw initial pixel
-   draw_pixel( X0, Y0, BaseColor );
-   // Draw horizontal, vertical, diagonal
-   if( ( DeltaY = Y1 - Y0 ) == 0 ) {
-      while( DeltaX-- != 0 ) {
-         X0 += XDir;
-         draw_pixel( X0, Y0, BaseColor );
-      }
-   } else if( DeltaX == 0 ) {
-      do {
-         Y0++;
-         draw_pixel( X0, Y0, BaseColor );
-      } while ( --DeltaY != 0 );
-   } else if( DeltaX == DeltaY ) {
-      do {
-         X0 += XDir;
-         Y0++;
-         draw_pixel( X0, Y0, BaseColor );
-      } while ( --DeltaY != 0 );
-   } else {
-     // Draw X/Y major
-     ErrorAcc = 0;
-     IntensityShift = 16 - IntensityBits;
-     WeightingComplementMask = NumLevels - 1;
-     if( DeltaY > DeltaX ) {
-        ErrorAdj = ( ( unsigned long ) DeltaX << 16 ) / ( unsigned long ) DeltaY;
-        while( --DeltaY ) {
-           ErrorAccTemp = ErrorAcc;
-           ErrorAcc += ErrorAdj;
-           if( ErrorAcc <= ErrorAccTemp ) X0 += XDir;
-           Y0++;
-           Weighting = ErrorAcc >> IntensityShift;
-           draw_pixel( X0, Y0, BaseColor + Weighting );
-           draw_pixel( X0 + XDir, Y0, BaseColor + ( Weighting ^ WeightingComplementMask ) );
-        }
-     } else {
-       ErrorAdj = ( ( unsigned long) DeltaY << 16) / (unsigned long) DeltaX;
-       while( --DeltaX ) {
-          ErrorAccTemp = ErrorAcc;
-          ErrorAcc += ErrorAdj;
-          if ( ErrorAcc <= ErrorAccTemp ) Y0++;
-          X0 += XDir;
-          Weighting = ErrorAcc >> IntensityShift;
-          draw_pixel( X0, Y0, BaseColor + Weighting );
-          draw_pixel( X0, Y0 + 1, BaseColor + ( Weighting ^ WeightingComplementMask ) );
-       }
-     }
-     draw_pixel( X1, Y1, BaseColor );
-   }
-   SDL_UnlockSurface( screen );
-}
-
 // Draws a popup-box
 static void draw_box( unsigned char x, unsigned char y, unsigned char w, unsigned char h, SDL_Surface *s ) {
   SDL_Rect src, dst;
@@ -313,10 +315,88 @@ static void draw_box( unsigned char x, unsigned char y, unsigned char w, unsigne
   }
 }
 
+// Moves speech visualization polyline
+static void vis_offset( point_t *points, int dx, int dy ) {
+  int n;
+  for( n = 0; n <= VIS_POINTS; n++ ) {
+    points[ n ].x += dx;
+    points[ n ].y += dy;
+  }
+}
+
+// Marks screen region as changed
+static void dirty_add( int x, int y, int w, int h ) {
+  if( dirty_full ) return;
+  if( dirty_count == MAX_DIRTY ) {
+    dirty_full = 1;
+    return;
+  }
+  rect( &dirty[ dirty_count++ ], x, y, w, h );
+}
+
+// Samples statistics into the HUD
+static void hud_sample( Uint32 now ) {
+  char s[ 32 ];
+  linked_buf_t *p_trust;
+  unsigned int decoded, dropped;
+  int time_avg, n, ms = MAX( now - hud_time, 1 );
+  SDL_Rect r;
+
+  // Video
+  sprintf( s, "KBPS %6i", hud_bytes * 8 / ms );
+  hud_set( HUD_RATE, hud_bytes * 8.0 / ms, s );
+  // Composed streams are counted by the first one
+  decoder_counters( strms[ 0 ].dec ? strms[ 0 ].dec : decoder, &decoded, &dropped, &time_avg );
+  if( disp_data.still ) {
+    sprintf( s, "FPS %2i STILL", hud_frames * 1000 / ms );
+  } else {
+    sprintf( s, "FPS %2i/%2i/%2i", hud_frames * 1000 / ms, ( decoded - hud_decoded ) * 1000 / ms, ( dropped - hud_dropped ) * 1000 / ms );
+  }
+  hud_set( HUD_FRAMES, ( decoded - hud_decoded ) * 1000.0 / ms, s );
+  sprintf( s, "DEC %5.1f MS", time_avg / 1000.0 );
+  hud_set( HUD_DECODE, time_avg / 1000.0, s );
+  sprintf( s, "LAT %5i MS", hud_lat_count ? hud_lat_sum / hud_lat_count : 0 );
+  hud_set( HUD_LATENCY, hud_lat_count ? hud_lat_sum / hud_lat_count : 0, s );
+
+  // Communications
+  SDL_mutexP( trust_mx );
+  for( n = 0, p_trust = trust_first; p_trust; p_trust = p_trust->next ) n++;
+  SDL_mutexV( trust_mx );
+  sprintf( s, "TRUST %6i", n );
+  hud_set( HUD_TRUST, n, s );
+  sprintf( s, "RTT %5i MS", hud_rtt_count ? hud_rtt_sum / hud_rtt_count : 0 );
+  hud_set( HUD_RTT, hud_rtt_count ? hud_rtt_sum / hud_rtt_count : 0, s );
+  sprintf( s, "LOSS %6.1f%%", hud_data + hud_lost ? 100.0 * hud_lost / ( hud_data + hud_lost ) : 0.0 );
+  hud_set( HUD_LOSS, hud_data + hud_lost ? 100.0 * hud_lost / ( hud_data + hud_lost ) : 0.0, s );
+
+  // Encoder, from latest DATA packet
+  sprintf( s, "QP %2i %c %5iB", disp_data.qp, disp_data.type ? disp_data.type : '-', disp_data.size );
+  hud_set( HUD_ENCODER, disp_data.size, s );
+  sprintf( s, "%4iK %3ix%3i", disp_data.rate, disp_data.stream_w, disp_data.stream_h );
+  hud_set( HUD_TARGET, disp_data.rate, s );
+  hud_next();
+
+  hud_time = now;
+  hud_bytes = 0;
+  hud_frames = 0;
+  hud_data = 0;
+  hud_lost = 0;
+  hud_rtt_sum = 0;
+  hud_rtt_count = 0;
+  hud_lat_sum = 0;
+  hud_lat_count = 0;
+  hud_decoded = decoded;
+  hud_dropped = dropped;
+  if( hud_shown ) {
+    hud_rect( &r );
+    dirty_add( r.x, r.y, r.w, r.h );
+  }
+}
+
 // Draws temproray message
 static void draw_message( char* text ) {
   term_write( 1, term_h - 3, text, FONT_RED );
-  message_timeout = 125;
+  message_timeout = SDL_GetTicks() + INTERVAL_MESSAGE;
 }
 
 // Load sprites
@@ -339,12 +419,27 @@ static void sprites_init() {
 // Free sprites
 static void sprites_free() {
     SDL_FreeSurface( spr_logo );
+    if( spr_help ) SDL_FreeSurface( spr_help );
 }
 
 // Draws out the help screen
 static void draw_help( int draw ) {
+  static unsigned char cached;
   unsigned char n;
   unsigned char y = ( term_h - help_count ) >> 1;
+  Uint32 key;
+  // Render box once, plugins may add help lines until then
+  if( draw && ( spr_help == NULL || cached != help_count ) ) {
+    if( spr_help ) SDL_FreeSurface( spr_help );
+    spr_help = SDL_CreateRGBSurface( SDL_SWSURFACE, 34 << 4, ( help_count + 2 ) << 4, screen->format->BitsPerPixel,
+      screen->format->Rmask, screen->format->Gmask, screen->format->Bmask, 0 );
+    key = SDL_MapRGB( spr_help->format, 0xFF, 0x00, 0xFF );
+    SDL_FillRect( spr_help, NULL, key );
+    draw_box( 0, 0, 34, help_count + 2, spr_help );
+    SDL_SetColorKey( spr_help, SDL_SRCCOLORKEY | SDL_RLEACCEL, key );
+    cached = help_count;
+  }
+  if( spr_help ) dirty_add( ( ( term_w - 34 ) >> 1 ) << 4, ( ( term_h - 2 - help_count ) >> 1 ) << 4, spr_help->w, spr_help->h );
   for( n = 0; n < help_count; n++ ) {
     if( draw ) {
      term_write( ( term_w - 32 ) >> 1, y + n, help[ n ], FONT_GREEN );
@@ -364,35 +459,6 @@ static void cursor_grab( int b_grab ) {
   SDL_ShowCursor( cursor_grabbed ? SDL_DISABLE : SDL_ENABLE );
 }
 
-// Poll cursor with warping support and grabbing detection
-// Adds any movement to incremental variables ix and iy
-static void cursor_poll( long *ix, long *iy ) {
-  static int ready = 0;
-  static int lx = 0, ly = 0;
-  int cx = 0, cy = 0;
-  int warp = 0;
-
-  if( cursor_hook != NULL || !cursor_grabbed ) ready = 0;
-  SDL_GetMouseState( &cx, &cy );
-  if( ready ) {
-    *ix += cx - lx;
-    *iy += cy - ly;
-    if( cx > ( ( screen_w >> 1 ) + ( screen_w >> 2 ) )
-     || cx < ( ( screen_w >> 1 ) - ( screen_w >> 2 ) ) ) {
-      cx = screen_w >> 1;
-      warp = 1;
-    }
-    if( cy > ( ( screen_h >> 1 ) + ( screen_h >> 2 ) )
-     || cy < ( ( screen_h >> 1 ) - ( screen_h >> 2 ) ) ) {
-      cy = screen_h >> 1;
-      warp = 1;
-    }
-    if( warp ) SDL_WarpMouse( cx, cy );
-  }
-  if( cursor_grabbed ) ready = 1;
-  lx = cx; ly = cy;
-}
-
 /* == KEYBOARD HELPERS ========================================================================== */
 
 // Switches keyboard layout
@@ -430,31 +496,162 @@ static void set_layout( unsigned char new_layout ) {
   ctrl.ctrl.kb = 0;
 }
 
+/* == CAPTURE SOURCE STREAMS ==================================================================== */
+
+// Return 1 if a H.264 or JPEG packet ends a frame
+static int frame_end( char *buffer, int size ) {
+  if( memcmp( buffer, pkt_h264, 4 ) == 0 ) return( 1 );
+  return( size >= 4 + sizeof( jpeg_slice_t ) && ( ( jpeg_slice_t* )( buffer + 4 ) )->slice + 1 == ( ( jpeg_slice_t* )( buffer + 4 ) )->slices );
+}
+
+// Queues a STRM packet for its stream, decoder opened on the first one at the stream's size on screen
+static void strm_recv( char *buffer, int size ) {
+  strm_data_t hdr;
+  strm_t *st;
+  int w, h;
+  if( size < 4 + sizeof( strm_data_t ) + 4 ) return;
+  memcpy( &hdr, buffer + 4, sizeof( strm_data_t ) );
+  if( hdr.id >= STREAMS_MAX || hdr.canvas_w == 0 || hdr.canvas_h == 0 ) return;
+  st = &strms[ hdr.id ];
+  if( st->broken ) return;
+  SDL_mutexP( strm_mx );
+  memcpy( &st->hdr, &hdr, sizeof( strm_data_t ) );
+  SDL_mutexV( strm_mx );
+  if( st->dec == NULL ) {
+    w = hdr.w * screen_w / hdr.canvas_w;
+    h = hdr.h * screen_h / hdr.canvas_h;
+    st->dec = decoder_open( MAX( w, 2 ), MAX( h, 2 ), screen->format, latency, immediate ? wake : NULL, 0 );
+    if( st->dec == NULL ) {
+      printf( "RoboCortex [error]: Unable to initialize decoder for stream %i\n", hdr.id );
+      st->broken = 1;
+      return;
+    }
+    strm_count++;
+  }
+  buffer += 4 + sizeof( strm_data_t );
+  size -= 4 + sizeof( strm_data_t );
+  decoder_push( st->dec, buffer, size );
+  if( hdr.id == 0 && frame_end( buffer, size ) ) hud_frames++;
+}
+
+// Takes the newest frame of each stream, composes them in z order when any is new
+// Return NULL until a frame has been decoded
+static SDL_Surface *strm_latest( int *fresh ) {
+  strm_t *order[ STREAMS_MAX ], *st;
+  SDL_Rect r;
+  Uint32 arrival;
+  int n, m, f, count = 0;
+  *fresh = 0;
+  for( n = 0; n < STREAMS_MAX; n++ ) {
+    st = &strms[ n ];
+    if( st->dec == NULL ) continue;
+    st->front = decoder_latest( st->dec, &f );
+    if( st->front == NULL ) continue;
+    if( f ) {
+      if( f > *fresh ) *fresh = f;
+      arrival = decoder_arrival( st->dec );
+      if( ( Sint32 )( arrival - strm_arrival ) > 0 ) strm_arrival = arrival;
+    }
+    // Sort by composition order
+    for( m = count++; m > 0 && order[ m - 1 ]->hdr.z > st->hdr.z; m-- ) order[ m ] = order[ m - 1 ];
+    order[ m ] = st;
+  }
+  if( count == 0 ) return( NULL );
+  if( !*fresh ) return( strm_comp );
+
+  SDL_FillRect( strm_comp, NULL, 0 );
+  SDL_mutexP( strm_mx );
+  for( n = 0; n < count; n++ ) {
+    st = order[ n ];
+    r.x = st->hdr.x * screen_w / st->hdr.canvas_w;
+    r.y = st->hdr.y * screen_h / st->hdr.canvas_h;
+    r.w = st->hdr.w * screen_w / st->hdr.canvas_w;
+    r.h = st->hdr.h * screen_h / st->hdr.canvas_h;
+    draw_scaled( strm_comp, st->front, &r );
+  }
+  SDL_mutexV( strm_mx );
+  return( strm_comp );
+}
+
+// Return arrival time of the packet the newest frame on screen was decoded from
+static Uint32 frame_arrival() {
+  return( strm_count ? strm_arrival : decoder_arrival( decoder ) );
+}
+
 /* == COMMUNICATIONS ============================================================================ */
 
 // Processes a data packet
 static void comm_recv( char *buffer, int size ) {
-  linked_buf_t *p_buffer_temp;
   if( size >= 4 ) {
-    memcpy( p_buffer_last->data, buffer, size );
 
     // H264
-    if( memcmp( p_buffer_last->data, pkt_h264, 4 ) == 0 ) {
-      // h264 packet
+    if( memcmp( buffer, pkt_h264, 4 ) == 0 ) {
+      // h264 packet, watched while queued
+      stream_time = SDL_GetTicks();
+      if( state != STATE_QUEUED ) {
+        state = STATE_STREAMING;
+        retry = 0;
+      }
+
+      // Queue for decode thread
+      decoder_push( decoder, buffer, size );
+      hud_bytes += size;
+      hud_frames++;
+      measure_bytes += size;
+
+    // JPEG slice
+    } else if( memcmp( buffer, pkt_jpeg, 4 ) == 0 ) {
+      stream_time = SDL_GetTicks();
+      if( state != STATE_QUEUED ) {
+        state = STATE_STREAMING;
+        retry = 0;
+      }
+
+      // Queue for decode thread, a frame is complete with its last slice
+      decoder_push( decoder, buffer, size );
+      hud_bytes += size;
+      measure_bytes += size;
+      if( frame_end( buffer, size ) ) hud_frames++;
+
+    // Capture source stream, composed here
+    } else if( memcmp( buffer, pkt_strm, 4 ) == 0 ) {
+      stream_time = SDL_GetTicks();
       state = STATE_STREAMING;
       retry = 0;
 
-      // Push decoder buffer to queue
-      p_buffer_last->next = malloc( sizeof( linked_buf_t ) );
-      linked_buf_t *p_buf = p_buffer_last;
-      p_buffer_last = p_buffer_last->next;
-      p_buffer_last->size = 0;
-      p_buf->size = size;
+      // Queue for the stream's decode thread
+      strm_recv( buffer, size );
+      hud_bytes += size;
+      measure_bytes += size;
 
     // DATA
-    } else if( memcmp( p_buffer_last->data, pkt_data, 4 ) == 0 ) {
+    } else if( memcmp( buffer, pkt_data, 4 ) == 0 ) {
       if( size >= 4 + sizeof( disp_data_t ) ) {
-        memcpy( &disp_data, p_buffer_last->data + 4, sizeof( disp_data_t ) );
+        // Only the controller gets DATA, video before it was watched from the queue
+        if( state == STATE_QUEUED ) {
+          stream_time = SDL_GetTicks();
+          state = STATE_STREAMING;
+          retry = 0;
+        }
+        memcpy( &disp_data, buffer + 4, sizeof( disp_data_t ) );
+        ack_pending = disp_data.ack;
+
+        // Loss from gaps in frame numbers, round-trip from echoed CTRL sequence
+        hud_data++;
+        if( hud_frame_last && disp_data.frame - hud_frame_last - 1 < 1000 ) hud_lost += disp_data.frame - hud_frame_last - 1;
+        hud_frame_last = disp_data.frame;
+
+        // Receive feedback for the server's rate control, sent with the next CTRL packet
+        if( ( int32_t )( disp_data.frame - ctrl.fb_frame ) > 0 ) {
+          if( ctrl.fb_frame && disp_data.frame - ctrl.fb_frame - 1 < 1000 ) ctrl.fb_lost += disp_data.frame - ctrl.fb_frame - 1;
+          ctrl.fb_frame = disp_data.frame;
+          ctrl.fb_time = SDL_GetTicks();
+        }
+        ctrl.fb_recv++;
+        if( ( unsigned short )( ctrl.seq - disp_data.echo ) < CTRL_HISTORY ) {
+          hud_rtt_sum += SDL_GetTicks() - ctrl_sent_tick[ disp_data.echo % CTRL_HISTORY ] - disp_data.echo_delay;
+          hud_rtt_count++;
+        }
 
         // Check if outgoing trusted data recieved, free trusted buffers
         SDL_mutexP( trust_mx );
@@ -471,41 +668,63 @@ static void comm_recv( char *buffer, int size ) {
 
         // Handle incoming trusted data
         if( ( ( trust_srv + 1 ) & 0xFF ) == disp_data.trust_srv ) {
-          trust_handler( p_buffer_last->data + 4 + sizeof( disp_data_t ), size - 4 - sizeof( disp_data_t ) );
+          trust_handler( buffer + 4 + sizeof( disp_data_t ), size - 4 - sizeof( disp_data_t ) );
         }
       }
 
     // HELO
-    } else if( memcmp( p_buffer_last->data, pkt_helo, 4 ) == 0 ) {
+    } else if( memcmp( buffer, pkt_helo, 4 ) == 0 ) {
       if( state == STATE_CONNECTING ) {
 
         // Go to queued only if version is correct
-        if( p_buffer_last->data[ 4 ] != CORTEX_VERSION ) {
+        if( buffer[ 4 ] != CORTEX_VERSION ) {
           state = STATE_VERSION;
         } else {
           state = STATE_QUEUED;
           retry = 0;
-          queue_time = *( int* )&p_buffer_last->data[ 5 ];
+          queue_time = *( int* )&buffer[ 5 ];
+          // Session, carried in CTRL and TIME so we can resume from another address
+          if( size >= 5 + sizeof( int ) + sizeof( session_t ) ) {
+            memcpy( &ctrl.session, buffer + 5 + sizeof( int ), sizeof( session_t ) );
+            memcpy( p_time + 4, &ctrl.session, sizeof( session_t ) );
+          }
+          // Encoding the server picked from those offered
+          stream_enc = ( size >= 5 + sizeof( int ) + sizeof( session_t ) + 1 ? buffer[ 5 + sizeof( int ) + sizeof( session_t ) ] : ENC_H264 );
+          printf( "RoboCortex [info]: Server streams %s\n", stream_enc == ENC_JPEG ? "JPEG" : "H.264" );
+          // Frame numbers restart with the server
+          ctrl.fb_frame = 0;
         }
       }
 
     // TIME
-    } else if( memcmp( p_buffer_last->data, pkt_time, 4 ) == 0 ) {
+    } else if( memcmp( buffer, pkt_time, 4 ) == 0 ) {
 
       // Update queue time
       if( state == STATE_QUEUED ) {
         retry = 0;
-        queue_time = *( int* )&p_buffer_last->data[ 4 ];
+        queue_time = *( int* )&buffer[ 4 ];
+      }
+
+    // COOK
+    } else if( memcmp( buffer, pkt_cook, 4 ) == 0 ) {
+
+      // Server requires a cookie, repeat HELO with it and the encodings we decode right away
+      if( state == STATE_CONNECTING && size >= 4 + 8 ) {
+        memcpy( p_helo + 4, buffer + 4, 8 );
+        p_helo[ 12 ] = decoder_codecs( decoder );
+        p_helo[ 13 ] = ( spectate ? HELO_SPECTATOR : 0 ) | ( reduced ? HELO_REDUCED : 0 );
+        i_helo = 4 + 8 + 2;
+        comm_send( p_helo, i_helo );
       }
 
     // LOST
-    } else if( memcmp( p_buffer_last->data, pkt_lost, 4 ) == 0 ) {
+    } else if( memcmp( buffer, pkt_lost, 4 ) == 0 ) {
 
       // Connection was lost (server don't know who we are)
       state = STATE_LOST;
 
     // FULL
-    } else if( memcmp( p_buffer_last->data, pkt_full, 4 ) == 0 ) {
+    } else if( memcmp( buffer, pkt_full, 4 ) == 0 ) {
 
       // Connection could not be established (server queue is full)
       state = STATE_FULL;
@@ -514,6 +733,64 @@ static void comm_recv( char *buffer, int size ) {
   }
 }
 
+// Return time the next CTRL packet is due
+static Uint32 ctrl_due() {
+  Uint32 gap = ctrl_time + 1000 / ctrl_rate;
+  Uint32 due = ctrl_time + ( ctrl.ctrl.kb ? CTRL_HELD : CTRL_KEEPALIVE );
+  // Input changed, send as soon as rate allows
+  if( memcmp( &ctrl.ctrl, &ctrl_sent, sizeof( ctrl_t ) ) != 0 ) return( gap );
+  // Trusted data waiting to be (re)transmitted
+  if( trust_first ) {
+    if( trust_timeout == 0 || ( Sint32 )( trust_timeout - gap ) < 0 ) return( gap );
+    if( ( Sint32 )( trust_timeout - due ) < 0 ) return( trust_timeout );
+  }
+  // Keepalive
+  return( due );
+}
+
+// Sends CTRL packet if due, with trusted data if any is waiting to be (re)transmitted
+static void ctrl_send( Uint32 now ) {
+  char p_ctrl[ 8192 ];
+  int i_ctrl;
+
+  if( ( Sint32 )( now - ctrl_due() ) < 0 ) return;
+
+  // Build CTRL packet, remembering what was sent under which sequence
+  ctrl.seq++;
+  memcpy( &ctrl_history[ ctrl.seq % CTRL_HISTORY ], &ctrl.ctrl, sizeof( ctrl_t ) );
+  ctrl_sent_tick[ ctrl.seq % CTRL_HISTORY ] = now;
+  memcpy( p_ctrl, pkt_ctrl, 4 );
+  i_ctrl = 4;
+  ctrl.trust_cli = trust_cli;
+  ctrl.trust_srv = trust_srv;
+  memcpy( p_ctrl + 4, &ctrl, sizeof( ctrl_data_t ) );
+  i_ctrl += sizeof( ctrl_data_t );
+
+  // Append trusted data if any
+  SDL_mutexP( trust_mx );
+  if( trust_first && ( trust_timeout == 0 || ( Sint32 )( now - trust_timeout ) >= 0 ) ) {
+    memcpy( p_ctrl + i_ctrl, trust_first->data, trust_first->size );
+    i_ctrl += trust_first->size;
+    trust_timeout = now + TIMEOUT_TRUST;
+  }
+  SDL_mutexV( trust_mx );
+
+  // Send CTRL packet
+  comm_send( p_ctrl, i_ctrl );
+  ctrl_time = now;
+  memcpy( &ctrl_sent, &ctrl.ctrl, sizeof( ctrl_t ) );
+
+  // Input-to-send delay
+  if( input_time ) {
+    if( measure ) {
+      input_sum += now - input_time;
+      input_count++;
+      if( now - input_time > input_max ) input_max = now - input_time;
+    }
+    input_time = 0;
+  }
+}
+
 /* == CONFIGURATION ============================================================================= */
 
 static int config_set( char *value, char *token ) {
@@ -526,6 +803,29 @@ static int config_set( char *value, char *token ) {
       screen_bpp = atoi( value );
     } else if( strcmp( token, "fullscreen" ) == 0 ) {
       fullscreen = atoi( value );
+    } else if( strcmp( token, "latency" ) == 0 ) {
+      latency = atoi( value );
+    } else if( strcmp( token, "immediate" ) == 0 ) {
+      immediate = atoi( value );
+    } else if( strcmp( token, "interpolate" ) == 0 ) {
+      interpolate = atoi( value );
+    } else if( strcmp( token, "measure" ) == 0 ) {
+      measure = atoi( value );
+    } else if( strcmp( token, "reproject" ) == 0 ) {
+      reproject = atoi( value );
+    } else if( strcmp( token, "reproject_x" ) == 0 ) {
+      reproject_x = atof( value );
+    } else if( strcmp( token, "reproject_y" ) == 0 ) {
+      reproject_y = atof( value );
+    } else if( strcmp( token, "spectate" ) == 0 ) {
+      spectate = atoi( value );
+    } else if( strcmp( token, "reduced" ) == 0 ) {
+      reduced = atoi( value );
+    } else if( strcmp( token, "ctrl_rate" ) == 0 ) {
+      ctrl_rate = MAX( atoi( value ), 1 );
+    } else if( strcmp( token, "transport" ) == 0 ) {
+      if( comm_prio_count < MAX_PLUGINS && strlen( value ) == 4 ) memcpy( &comm_prio[ comm_prio_count++ ], value, 4 );
+      else printf( "Config [warning]: invalid transport %s\n", value );
     } else if( strcmp( token, "plugin" ) == 0 ) {
       return( 1 );
     } else printf( "Config [warning]: unknown entry %s\n", token );
@@ -590,8 +890,16 @@ static void plug_help( char *text ) {
 }
 
 static void plug_wu( int x0, int y0, int x1, int y1, uint32_t color ) {
-  draw_color( color >> 16, color >> 8, color );
-  draw_wu( x0, y0, x1, y1 );
+  line_t line = { x0, y0, x1, y1 };
+  draw_lines( screen, &line, 1, color );
+}
+
+static void plug_wulines( line_t *lines, int count, uint32_t color ) {
+  draw_lines( screen, lines, count, color );
+}
+
+static void plug_polyline( point_t *points, int count, uint32_t color ) {
+  draw_polyline( screen, points, count, color );
 }
 
 static int plug_cfg( char* dst, char* req_token ) {
@@ -614,8 +922,17 @@ static void plug_thrdelay( int delay ) {
   SDL_Delay( delay );
 }
 
+// Switches to transport at specified priority
+static void comm_select( int index ) {
+  char ident[ 5 ] = { 0 };
+  comms_index = index;
+  comm_send = comms[ index ]->comm_send;
+  memcpy( ident, &comms[ index ]->ident, 4 );
+  printf( "RoboCortex [info]: Using %s for communications\n", ident );
+}
+
 static void load_plugins() {
-  int pid;
+  int pid, n, i;
   host.thread_start     = plug_thrstart;
   host.thread_stop      = plug_thrstop;
   host.thread_delay     = plug_thrdelay;
@@ -636,6 +953,8 @@ static void load_plugins() {
   host.help_add         = plug_help;
   host.speak_text       = speech_queue;
   host.draw_wuline      = plug_wu;
+  host.draw_wulines     = plug_wulines;
+  host.draw_polyline    = plug_polyline;
   host.draw_box         = draw_box;
   host.draw_message     = draw_message;
   host.text_cols        = term_w;
@@ -647,6 +966,9 @@ static void load_plugins() {
   plugs[ plugs_count++ ] = kiwiray_open( &host );
   plugs[ plugs_count++ ] = monitor_open( &host );
   plugs[ plugs_count++ ] = ipv4udp_open( &host );
+  plugs[ plugs_count++ ] = shm0_open( &host );
+  plugs[ plugs_count++ ] = udpm_open( &host );
+  plugs[ plugs_count++ ] = multipath_open( &host );
   printf( "RoboCortex [info]: Initializing plugins...\n" );
   // plugin->init
   for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ ) {
@@ -655,11 +977,17 @@ static void load_plugins() {
     } else {
       memset( plug, 0, sizeof( pluginclient_t ) );
     }
-    if( plug->comm_send ) {
-      if( comm_send ) printf( "RoboCortex [error]: Multiple communications plugins loaded\n" );
-      comm_send = plug->comm_send;
+  }
+  // Order initialized transports, configured priority first and then load order
+  for( n = 0; n <= comm_prio_count; n++ ) {
+    for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ ) {
+      if( plug->comm_send && ( n == comm_prio_count || plug->ident == comm_prio[ n ] ) ) {
+        for( i = 0; i < comms_count; i++ ) if( comms[ i ] == plug ) break;
+        if( i == comms_count ) comms[ comms_count++ ] = plug;
+      }
     }
   }
+  if( comms_count ) comm_select( 0 );
   printf( "RoboCortex [info]: Plugins loaded and initialized\n" );
 }
 
@@ -674,27 +1002,27 @@ static void unload_plugins() {
 
 int main( int argc, char *argv[] ) {
   int                pid;                        // Plugin iteration
+  int                n;                          // Stream iteration
   int                temp;                       // Various uses
-  int                statec = 0;                 // State counter, used for retransmissions
+  Uint32             state_time = 0;             // Next retransmission in current state
+  int                state_due;                  // Retransmission is due
   int                laststate = -1;             // Used to detect state changes
   char               ascii;                      // Used for unicode text input translation
-  char               p_ctrl[ 8192 ];             // CTRL packet buffer
-  int                i_ctrl;                     // Tracks size of p_ctrl
-  AVCodecContext    *pCodecCtx;                  // FFMPEG codec context
-  AVCodec           *pCodec;                     // Pointer to FFMPEG codec (H264)
-  AVFrame           *pFrame;                     // Used in the decoding process
-  struct SwsContext *convertCtx;                 // Used in the scaling/conversion process
-  AVPacket           avpkt;                      // Used in the decoding process
   SDL_Rect           r;                          // Used for various graphics operations
   SDL_Surface       *live = NULL;                // Live decoded video surface
   char              *p_vis;                      // Pointer to speech visualization data
-  Uint32             rmask, gmask, bmask, amask; // Masking (endianness)
   SDL_Event          event;                      // Events
   int                quit = 0;                   // Time to quit?
-  Uint32             time_target;                // Timing target
-  Sint32             time_diff;                  // Timing differential
+  Uint32             tick_target;                // Next refresh tick
+  Uint32             now;                        // Time at wake-up
+  int                tick;                       // Refresh tick is due
   FILE              *cf;                         // Configuration file
-  int                do_decode;                  // Frame available for decoding
+  int                fresh;                      // New frame from decoder, 1 decoded, 2 synthesised
+  SDL_Rect           cells[ MAX_DIRTY ];         // Changed terminal regions
+  point_t            vis_line[ VIS_POINTS + 1 ]; // Speech visualization polyline
+  int                vis, vis_shown = 0;         // Speech visualization drawn now, last update
+  uint64_t           composite_start;            // Composite timing
+  int                x, y;                       // Reprojection
 
   printf( "RoboCortex [info]: OHAI!\n" );
 
@@ -716,21 +1044,6 @@ int main( int argc, char *argv[] ) {
     exit( EXIT_CONFIG );
   }
 
-  // Initialize decoder
-  avcodec_init();
-  avcodec_register_all();
-  pCodecCtx = avcodec_alloc_context();
-  pCodec = avcodec_find_decoder( CODEC_ID_H264 );
-  av_init_packet( &avpkt );
-  if( !pCodec ) {
-    printf( "RoboCortex [error]: Unable to initialize decoder\n" );
-    exit( EXIT_DECODER );
-  }
-  avcodec_open( pCodecCtx, pCodec );
-
-  // Allocate decoder frame
-  pFrame = avcodec_alloc_frame();
-
   SDL_Init( SDL_INIT_VIDEO | SDL_INIT_AUDIO );
   SDL_WM_SetCaption( "KiwiRay Client", "KiwiRay Client" );
 
@@ -746,33 +1059,27 @@ int main( int argc, char *argv[] ) {
 
   set_layout( KL_QWERTY );
 
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-    rmask = 0xff000000;
-    gmask = 0x00ff0000;
-    bmask = 0x0000ff00;
-    amask = 0x000000ff;
-#else
-    rmask = 0x000000ff;
-    gmask = 0x0000ff00;
-    bmask = 0x00ff0000;
-    amask = 0xff000000;
-#endif
-
-  SDL_Surface* frame = SDL_CreateRGBSurface( SDL_SWSURFACE, screen_w, screen_h, 24, 0, 0, 0, 0 );
-
-  if( !frame ) {
-    printf( "RoboCortex [error]: Unable to allcate SDL surface\n" );
-    exit( EXIT_SURFACE );
+  // Initialize decoder, decodes on its own thread into display format surfaces
+  wake = SDL_CreateSemaphore( 0 );
+  decoder = decoder_open( screen_w, screen_h, screen->format, latency, immediate ? wake : NULL, interpolate );
+  if( !decoder ) {
+    printf( "RoboCortex [error]: Unable to initialize decoder\n" );
+    exit( EXIT_DECODER );
   }
 
-  p_buffer_last = malloc( sizeof( linked_buf_t ) );;
-  p_buffer_first = p_buffer_last;
-  p_buffer_last->size = 0;
-
   speech_open();
 
   trust_mx = SDL_CreateMutex();
 
+  // Composition of capture source streams, when the server sends them separately
+  strm_mx = SDL_CreateMutex();
+  strm_comp = SDL_CreateRGBSurface( SDL_SWSURFACE, screen_w, screen_h, screen->format->BitsPerPixel,
+    screen->format->Rmask, screen->format->Gmask, screen->format->Bmask, 0 );
+  if( !strm_comp ) {
+    printf( "RoboCortex [error]: Unable to create composition surface\n" );
+    exit( EXIT_SURFACE );
+  }
+
   // Load plugins
   load_plugins();
   atexit( unload_plugins );
@@ -781,12 +1088,22 @@ int main( int argc, char *argv[] ) {
     exit( EXIT_COMMS );
   }
 
-  time_target = SDL_GetTicks();
+  tick_target = SDL_GetTicks();
+  measure_time = tick_target;
   while( !quit ) {
-    
-    speech_poll();
-    cursor_poll( &ctrl.ctrl.mx, &ctrl.ctrl.my );
-    do_decode = 0;
+
+    // Refresh tick, 1/CLIENT_RPS seconds, constantly correct for processing overhead
+    fresh = 0;
+    now = SDL_GetTicks();
+    tick = ( ( Sint32 )( now - tick_target ) >= 0 );
+    if( tick ) {
+      if( now - tick_target > 1000 ) {
+        printf( "RoboCortex [warning]: Cannot keep up with the desired RPS\n" );
+        tick_target = now;
+      }
+      tick_target += 1000 / CLIENT_RPS;
+      speech_poll();
+    }
 
     if( state != laststate ) {
       if( state == STATE_STREAMING ) ctrl.ctrl.kb = 0;
@@ -796,8 +1113,10 @@ int main( int argc, char *argv[] ) {
       cursor_hook = NULL;
       term_crem();
       laststate = state;
+      dirty_full = 1;
       term_clear();
       draw_help( help_shown );
+      hud_show( hud_shown );
       // Initialize view
       if( state != STATE_STREAMING ) {
         switch( state ) {
@@ -806,7 +1125,10 @@ int main( int argc, char *argv[] ) {
             term_write( ( term_w - 22 ) >> 1, ( term_h >> 1 ) + 10, text_blank, FONT_GREEN );
             break;
           case STATE_QUEUED:
-            term_write( ( term_w - 22 ) >> 1, ( term_h >> 1 ) + 9, text_queued, FONT_GREEN );
+            term_write( ( term_w - 22 ) >> 1, ( term_h >> 1 ) + 9, spectate ? text_spectate : text_queued, FONT_GREEN );
+            live = NULL;
+            shift_x = 0;
+            shift_y = 0;
             break;
           case STATE_ERROR:
             term_write( ( term_w - 22 ) >> 1, ( term_h >> 1 ) + 9, text_error, FONT_RED );
@@ -831,131 +1153,65 @@ int main( int argc, char *argv[] ) {
 
     if( state == STATE_STREAMING ) {
 
-      // Connected & streaming, buld CTRL packet
-      memcpy( p_ctrl, pkt_ctrl, 4 );
-      i_ctrl = 4;
-      ctrl.trust_cli = trust_cli;
-      ctrl.trust_srv = trust_srv;
-      memcpy( p_ctrl + 4, &ctrl, sizeof( ctrl_data_t ) );
-      i_ctrl += sizeof( ctrl_data_t );
-
-      // Append trusted data if any
-      SDL_mutexP( trust_mx );
-      if( trust_timeout == 0 ) {
-        if( trust_first ) {
-          memcpy( p_ctrl + i_ctrl, trust_first->data, trust_first->size );
-          i_ctrl += trust_first->size;
-          trust_timeout = TIMEOUT_TRUST;
-        }
-      } else {
-        trust_timeout--;
-      }
-      SDL_mutexV( trust_mx );
-
-      // Send CTRL packet
-      comm_send( p_ctrl, i_ctrl );
-      if( ++retry == TIMEOUT_STREAM ) state = STATE_LOST;
-
-      if( p_buffer_first->size ) {
-        do_decode = 1;
-        // Decode frame
-        avpkt.data = ( unsigned char* )p_buffer_first->data;
-        avpkt.size = p_buffer_first->size;
-        avpkt.flags = AV_PKT_FLAG_KEY;
-        if( avcodec_decode_video2( pCodecCtx, pFrame, &temp, &avpkt ) < 0 ) {
-          printf( "RoboCortex [info]: Decoding error (packet loss)\n" );
+      // Server stopped streaming
+      if( ( Sint32 )( now - stream_time ) > TIMEOUT_STREAM ) state = STATE_LOST;
+
+      // Statistics for HUD
+      if( now - hud_time >= INTERVAL_HUD ) hud_sample( now );
+
+      // Take newest decoded frame
+      live = ( strm_count ? strm_latest( &fresh ) : decoder_latest( decoder, &fresh ) );
+      if( fresh ) dirty_full = 1;
+      if( fresh == 1 ) {
+        // DATA follows the frame it acknowledges, so latest ack belongs to this frame
+        ack_new = ( ack_pending != ack_shown );
+        ack_shown = ack_pending;
+        hud_lat_sum += now - frame_arrival();
+        hud_lat_count++;
+        // Update control timer
+        term_write( 1, 1, text_controls, FONT_GREEN );
+        if( disp_data.timer == 0 ) {
+          term_white( 1, 2, strlen( text_timeout ) );
         } else {
-          SDL_LockSurface( frame );
-
-          const uint8_t * data[1] = { frame->pixels };
-          int linesize[1] = { frame->pitch };
-
-          // Create scaling & color-space conversion context
-          convertCtx = sws_getContext( pCodecCtx->width, pCodecCtx->height, pCodecCtx->pix_fmt,
-            frame->w, frame->h, PIX_FMT_RGB24, SWS_AREA, NULL, NULL, NULL);
-
-          // Scale and convert the frame
-          sws_scale( convertCtx, (const uint8_t**) pFrame->data, pFrame->linesize, 0,
-            pCodecCtx->height, (uint8_t * const*) data, linesize );
-
-          // Cleanup
-          sws_freeContext( convertCtx );
-
-          SDL_UnlockSurface( frame );
-
-          // Convert to display format for fast blitting
-          if( live ) SDL_FreeSurface( live );
-          live = SDL_DisplayFormat( frame );
-
-          // Update control timer
-          term_write( 1, 1, text_controls, FONT_GREEN );
-          if( disp_data.timer == 0 ) {
-            term_white( 1, 2, strlen( text_timeout ) );
-          } else {
-            temp = disp_data.timer / 25;
-            text_timeout[ 15 ] = '0' + ( ( temp % 60 ) % 10 );
-            text_timeout[ 14 ] = '0' + ( ( temp % 60 ) / 10 );
-            temp /= 60;
-            text_timeout[ 12 ] = '0' + ( ( temp % 60 ) % 10 );
-            text_timeout[ 11 ] = '0' + ( ( temp % 60 ) / 10 );
-            term_write( 1, 2, text_timeout, FONT_GREEN );
-          }
-        }
-
-        // Pop decoding buffer from queue
-        linked_buf_t *p_buf = p_buffer_first;
-        p_buffer_first = p_buffer_first->next;
-        free( p_buf );
-
-      }
-
-      if( live ) {
-        // Draw video
-        SDL_BlitSurface( live, NULL, screen, NULL );
-      } else {
-        // Clear screen
-        SDL_FillRect( screen, rect( &r, 0, 0, screen->w, screen->h ), 0 );
-      }
-
-      if( speech_vis( &p_vis ) == 0 ) {
-        for( temp = 0; temp < 160; temp++ ) {
-          int ksx = temp * screen_w / 160, kex = ( temp + 1 ) * screen_w / 160;
-          int ksy = p_vis[ temp ], key = p_vis[ temp == 159 ? 0 : temp + 1 ];
-          draw_color( 0x00, 0x3F, 0x00 );
-          draw_wu( ksx + 1, screen_h - 39 + ksy, kex + 1, screen_h - 39 + key );
-          draw_wu( ksx - 1, screen_h - 41 + ksy, kex - 1, screen_h - 41 + key );
-          draw_wu( ksx + 1, screen_h - 41 + ksy, kex + 1, screen_h - 41 + key );
-          draw_wu( ksx - 1, screen_h - 39 + ksy, kex - 1, screen_h - 39 + key );
-          draw_color( 0x00, 0x00, 0x00 );
-          draw_wu( ksx + 2, screen_h - 38 + ksy, kex + 2, screen_h - 38 + key );
-        }
-        draw_color( 0x2F, 0xDF, 0x2F );
-        for( temp = 0; temp < 160; temp++ ) {
-          int ksx = temp * screen_w / 160, kex = ( temp + 1 ) * screen_w / 160;
-          int ksy = p_vis[ temp ], key = p_vis[ temp == 159 ? 0 : temp + 1 ];
-          draw_wu( ksx, screen_h - 40 + ksy, kex, screen_h - 40 + key );
+          temp = disp_data.timer / 25;
+          text_timeout[ 15 ] = '0' + ( ( temp % 60 ) % 10 );
+          text_timeout[ 14 ] = '0' + ( ( temp % 60 ) / 10 );
+          temp /= 60;
+          text_timeout[ 12 ] = '0' + ( ( temp % 60 ) % 10 );
+          text_timeout[ 11 ] = '0' + ( ( temp % 60 ) / 10 );
+          term_write( 1, 2, text_timeout, FONT_GREEN );
         }
       }
 
     } else {
 
-      // Clear screen
-      SDL_FillRect( screen, rect( &r, 0, 0, screen->w, screen->h ), 0 );
-      // Draw logo
-      SDL_BlitSurface( spr_logo, NULL, screen, rect( &r, ( screen_w - spr_logo->w ) >> 1, ( screen_h >> 1 ) - spr_logo->h + 80, 0, 0 ) );
-
+      state_due = ( ( Sint32 )( now - state_time ) >= 0 );
+      if( state_due ) state_time = now + INTERVAL_RETRY;
       switch( state ) {
         case STATE_CONNECTING:
-          if( statec == 0 ) {
+          if( state_due ) {
             if( ++retry == MAX_RETRY ) {
-              state = STATE_ERROR;
+              if( comms_index + 1 < comms_count ) {
+                // No answer, fall back to next transport in priority list
+                comm_select( comms_index + 1 );
+                memset( p_helo + 4, 0, 8 );
+                i_helo = HELO_MIN;
+                retry = 0;
+                comm_send( p_helo, i_helo );
+              } else {
+                state = STATE_ERROR;
+              }
             } else {
-              comm_send( pkt_helo, 4 );
+              comm_send( p_helo, i_helo );
             }
           }
           break;
         case STATE_QUEUED:
 
+          // Watch the controller's stream while waiting
+          live = decoder_latest( decoder, &fresh );
+          if( fresh ) dirty_full = 1;
+
           // Draw queue time
           temp = queue_time / 25;
 
@@ -967,37 +1223,192 @@ int main( int argc, char *argv[] ) {
           temp /= 60;
           text_time[  8 ] = '0' + ( temp % 10 );
           text_time[  7 ] = '0' + ( temp / 10 );
-          term_write( ( term_w - 22 ) >> 1, ( term_h >> 1 ) + 10, text_time, FONT_GREEN );
-          if( statec == 0 ) {
+          if( !spectate ) term_write( ( term_w - 22 ) >> 1, ( term_h >> 1 ) + 10, text_time, FONT_GREEN );
+          if( state_due ) {
             if( ++retry == MAX_RETRY ) {
               state = STATE_ERROR;
             } else {
-              comm_send( pkt_time, 4 );
+              comm_send( p_time, sizeof( p_time ) );
             }
           }
           break;
       }
-      if( statec ) statec--; else statec = 100;
 
     }
 
-    // Allow plugins to draw
+    // Clear messages
+    if( message_timeout && ( Sint32 )( now - message_timeout ) >= 0 ) {
+      message_timeout = 0;
+      term_white( 1, term_h - 3, 38 );
+    }
+
+    // Render changed terminal cells into overlay
+    temp = term_draw( cells, MAX_DIRTY );
+    while( temp-- ) dirty_add( cells[ temp ].x, cells[ temp ].y, cells[ temp ].w, cells[ temp ].h );
+
+    // Speech visualization band, once more after speech ends to clear it
+    vis = ( state == STATE_STREAMING && speech_vis( &p_vis ) == 0 );
+    if( vis || vis_shown ) dirty_add( 0, screen_h - VIS_SPAN, screen_w, VIS_SPAN );
+    vis_shown = vis;
+
+    // Reproject last frame by input the server has not acted upon yet
+    if( reproject && state == STATE_STREAMING ) {
+      temp = ( unsigned short )( ctrl.seq - ack_shown );
+      if( temp < CTRL_HISTORY ) {
+        x = -( ctrl.ctrl.mx - ctrl_history[ ack_shown % CTRL_HISTORY ].mx ) * reproject_x;
+        y = -( ctrl.ctrl.my - ctrl_history[ ack_shown % CTRL_HISTORY ].my ) * reproject_y;
+        x = MAX( MIN( x, screen_w >> 2 ), -( screen_w >> 2 ) );
+        y = MAX( MIN( y, screen_h >> 2 ), -( screen_h >> 2 ) );
+      } else {
+        // Acknowledgement too old or from before reconnecting
+        x = 0;
+        y = 0;
+      }
+      if( x != shift_x || y != shift_y ) {
+        shift_x = x;
+        shift_y = y;
+        dirty_full = 1;
+      }
+    }
+
+    // Plugin drawing can touch anything
     for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ )
-      if( plug->draw ) plug->draw( screen );
+      if( plug->draw ) dirty_full = 1;
+
+    // Composite changed regions only, the screen keeps the previous composite elsewhere
+    if( dirty_full || dirty_count ) {
+      composite_start = sys_time_us();
+      if( !dirty_full ) {
+        // Clip to bounding box of changes
+        r = dirty[ 0 ];
+        for( temp = 1; temp < dirty_count; temp++ ) {
+          if( dirty[ temp ].x + dirty[ temp ].w > r.x + r.w ) r.w = dirty[ temp ].x + dirty[ temp ].w - r.x;
+          if( dirty[ temp ].y + dirty[ temp ].h > r.y + r.h ) r.h = dirty[ temp ].y + dirty[ temp ].h - r.y;
+          if( dirty[ temp ].x < r.x ) { r.w += r.x - dirty[ temp ].x; r.x = dirty[ temp ].x; }
+          if( dirty[ temp ].y < r.y ) { r.h += r.y - dirty[ temp ].y; r.y = dirty[ temp ].y; }
+        }
+        SDL_SetClipRect( screen, &r );
+      }
 
-    // Draw help overlay
-    if( help_shown ) draw_box( ( term_w - 34 ) >> 1, ( term_h - 2 - help_count ) >> 1, 34, help_count + 2, screen );
+      if( state == STATE_STREAMING || ( state == STATE_QUEUED && live ) ) {
+        if( live && ( shift_x || shift_y ) ) {
+          // Draw shifted video, fill exposed edges
+          SDL_BlitSurface( live, NULL, screen, rect( &r, shift_x, shift_y, 0, 0 ) );
+          if( shift_x > 0 ) SDL_FillRect( screen, rect( &r, 0, 0, shift_x, screen_h ), 0 );
+          if( shift_x < 0 ) SDL_FillRect( screen, rect( &r, screen_w + shift_x, 0, -shift_x, screen_h ), 0 );
+          if( shift_y > 0 ) SDL_FillRect( screen, rect( &r, 0, 0, screen_w, shift_y ), 0 );
+          if( shift_y < 0 ) SDL_FillRect( screen, rect( &r, 0, screen_h + shift_y, screen_w, -shift_y ), 0 );
+        } else if( live ) {
+          // Draw video
+          SDL_BlitSurface( live, NULL, screen, NULL );
+        } else {
+          // Clear screen
+          SDL_FillRect( screen, rect( &r, 0, 0, screen->w, screen->h ), 0 );
+        }
 
-    // Clear messages
-    if( message_timeout ) {
-      if( --message_timeout == 0 ) term_white( 1, term_h - 3, 38 );
-    }
+        if( vis ) {
+          // Waveform with glow and shadow, wraps around to the first sample
+          for( temp = 0; temp <= VIS_POINTS; temp++ ) {
+            vis_line[ temp ].x = temp * screen_w / VIS_POINTS;
+            vis_line[ temp ].y = screen_h - 40 + p_vis[ temp % VIS_POINTS ];
+          }
+          vis_offset( vis_line, 1, 1 );
+          draw_polyline( screen, vis_line, VIS_POINTS + 1, 0x003F00 );
+          vis_offset( vis_line, -2, -2 );
+          draw_polyline( screen, vis_line, VIS_POINTS + 1, 0x003F00 );
+          vis_offset( vis_line, 2, 0 );
+          draw_polyline( screen, vis_line, VIS_POINTS + 1, 0x003F00 );
+          vis_offset( vis_line, -2, 2 );
+          draw_polyline( screen, vis_line, VIS_POINTS + 1, 0x003F00 );
+          vis_offset( vis_line, 3, 1 );
+          draw_polyline( screen, vis_line, VIS_POINTS + 1, 0x000000 );
+          vis_offset( vis_line, -2, -2 );
+          draw_polyline( screen, vis_line, VIS_POINTS + 1, 0x2FDF2F );
+        }
+      } else {
+        // Clear screen
+        SDL_FillRect( screen, rect( &r, 0, 0, screen->w, screen->h ), 0 );
+        // Draw logo
+        SDL_BlitSurface( spr_logo, NULL, screen, rect( &r, ( screen_w - spr_logo->w ) >> 1, ( screen_h >> 1 ) - spr_logo->h + 80, 0, 0 ) );
+      }
 
-    // Draw terminal overlay
-    term_draw();
+      // Allow plugins to draw
+      for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ )
+        if( plug->draw ) plug->draw( screen );
 
-    // Refresh screen
-    SDL_UpdateRect( screen, 0, 0, 0, 0 );
+      // Draw HUD sparklines
+      if( hud_shown ) hud_draw( screen );
+
+      // Draw help overlay
+      if( help_shown && spr_help ) SDL_BlitSurface( spr_help, NULL, screen, rect( &r, ( ( term_w - 34 ) >> 1 ) << 4, ( ( term_h - 2 - help_count ) >> 1 ) << 4, 0, 0 ) );
+
+      // Draw terminal overlay
+      term_blit();
+      SDL_SetClipRect( screen, NULL );
+
+      // Refresh changed regions
+      if( dirty_full ) {
+        SDL_UpdateRect( screen, 0, 0, 0, 0 );
+      } else {
+        SDL_UpdateRects( screen, dirty_count, dirty );
+      }
+
+      if( measure ) {
+        composite_start = sys_time_us() - composite_start;
+        composite_sum += composite_start;
+        if( composite_start > composite_max ) composite_max = composite_start;
+        composite_count++;
+        if( dirty_full ) {
+          composite_area += screen_w * screen_h;
+        } else {
+          for( temp = 0; temp < dirty_count; temp++ ) composite_area += dirty[ temp ].w * dirty[ temp ].h;
+        }
+      }
+      dirty_full = 0;
+      dirty_count = 0;
+    }
+
+    // Receive-to-present delay of new frame
+    if( measure && state == STATE_STREAMING && fresh == 1 ) {
+      temp = SDL_GetTicks() - frame_arrival();
+      measure_sum += temp;
+      measure_count++;
+      if( temp > measure_max ) measure_max = temp;
+      // Glass to glass, from sending control data to presenting the first frame captured after it
+      if( ack_new && ( unsigned short )( ctrl.seq - ack_shown ) < CTRL_HISTORY ) {
+        temp = SDL_GetTicks() - ctrl_sent_tick[ ack_shown % CTRL_HISTORY ];
+        g2g_sum += temp;
+        g2g_count++;
+        if( temp > g2g_max ) g2g_max = temp;
+      }
+      if( SDL_GetTicks() - measure_time >= INTERVAL_MEASURE ) {
+        printf( "RoboCortex [info]: Receive to present avg %.1f ms, max %u ms (%s)\n",
+          ( double )measure_sum / measure_count, measure_max, immediate ? "immediate" : "on refresh" );
+        if( input_count ) printf( "RoboCortex [info]: Input to send avg %.1f ms, max %u ms\n",
+          ( double )input_sum / input_count, input_max );
+        if( composite_count ) printf( "RoboCortex [info]: Composite avg %.2f ms, max %.2f ms, %u updates, %.1f%% of screen each\n",
+          composite_sum / 1000.0 / composite_count, composite_max / 1000.0, composite_count,
+          100.0 * composite_area / composite_count / ( screen_w * screen_h ) );
+        if( g2g_count ) printf( "RoboCortex [info]: Control to present avg %.1f ms, max %u ms (%s at %i kbps)\n",
+          ( double )g2g_sum / g2g_count, g2g_max, stream_enc == ENC_JPEG ? "JPEG" : "H.264",
+          ( int )( measure_bytes * 8 / ( SDL_GetTicks() - measure_time ) ) );
+        g2g_sum = 0;
+        g2g_count = 0;
+        g2g_max = 0;
+        measure_bytes = 0;
+        input_sum = 0;
+        input_count = 0;
+        input_max = 0;
+        composite_sum = 0;
+        composite_max = 0;
+        composite_count = 0;
+        composite_area = 0;
+        measure_sum = 0;
+        measure_count = 0;
+        measure_max = 0;
+        measure_time = SDL_GetTicks();
+      }
+    }
 
     while( SDL_PollEvent( &event ) && !quit ) {
       switch( event.type ) {
@@ -1005,6 +1416,10 @@ int main( int argc, char *argv[] ) {
           quit = 1; // Set time to quit
           break;
 
+        case SDL_VIDEOEXPOSE:
+          dirty_full = 1; // Window needs repainting
+          break;
+
         case SDL_ACTIVEEVENT:
           if( event.active.state & SDL_APPINPUTFOCUS ) {
             if( event.active.gain == 1 ) {
@@ -1016,7 +1431,11 @@ int main( int argc, char *argv[] ) {
           break;
 
         case SDL_MOUSEMOTION:
-          if( state == STATE_STREAMING && cursor_hook != NULL ) {
+          if( cursor_hook == NULL && cursor_grabbed ) {
+            // Grabbed with hidden cursor, SDL reports relative motion without screen edges
+            ctrl.ctrl.mx += event.motion.xrel;
+            ctrl.ctrl.my += event.motion.yrel;
+          } else if( state == STATE_STREAMING && cursor_hook != NULL ) {
             plug = cursor_hook; // Notify plugin
             if( plug->cursor ) plug->cursor( E_MOVE, event.motion.x, event.motion.y );
           }
@@ -1064,6 +1483,12 @@ int main( int argc, char *argv[] ) {
                 draw_help( help_shown = !help_shown );
                 break;
 
+              case SDLK_p: // Toggle performance HUD
+                hud_show( hud_shown = !hud_shown );
+                hud_rect( &r );
+                dirty_add( r.x, r.y, r.w, r.h );
+                break;
+
               default: // WASD control scheme
                 if( event.key.keysym.sym == keymap[ KM_LEFT ] ) {
                   ctrl.ctrl.kb |= KB_LEFT;
@@ -1106,19 +1531,22 @@ int main( int argc, char *argv[] ) {
           }
           break;
       }
+      // Stamp input on dequeue, SDL 1.2 events carry no timestamp
+      if( !input_time && memcmp( &ctrl.ctrl, &ctrl_sent, sizeof( ctrl_t ) ) != 0 ) input_time = SDL_GetTicks();
     }
 
-    // Delay 1/CLIENT_RPS seconds, constantly correct for processing overhead
-    time_diff = SDL_GetTicks() - time_target;
-    //printf( "decode: %i, time: %i, diff: %i, ", do_decode, SDL_GetTicks(), time_diff );
-    if( time_diff > 1000 ) {
-      printf( "RoboCortex [warning]: Cannot keep up with the desired RPS\n" );
-      time_target = SDL_GetTicks();
-      time_diff = ( 1000 / CLIENT_RPS );
+    // Send input right away instead of waiting for the next refresh
+    if( state == STATE_STREAMING ) ctrl_send( SDL_GetTicks() );
+
+    // Sleep until next refresh tick, CTRL packet, a decoded frame or input, whichever comes first
+    while( !quit ) {
+      temp = tick_target - SDL_GetTicks();
+      if( state == STATE_STREAMING ) temp = MIN( temp, ( Sint32 )( ctrl_due() - SDL_GetTicks() ) );
+      if( temp <= 0 ) break;
+      SDL_PumpEvents();
+      if( SDL_PeepEvents( &event, 1, SDL_PEEKEVENT, SDL_ALLEVENTS ) > 0 ) break;
+      if( SDL_SemWaitTimeout( wake, MIN( temp, WAIT_SLICE ) ) == 0 ) break;
     }
-    time_target += 1000 / CLIENT_RPS;
-    //printf( "target: %i, delay: %i\n", time_target, MAX( 0, ( 1000 / CLIENT_RPS ) - time_diff ) );
-    SDL_Delay( MAX( 0, ( 1000 / CLIENT_RPS ) - time_diff ) );
 
   }
 
@@ -1127,9 +1555,12 @@ int main( int argc, char *argv[] ) {
 
   // Clean up
   sprites_free();
-  avcodec_close( pCodecCtx );
+  decoder_close( decoder );
+  for( n = 0; n < STREAMS_MAX; n++ ) if( strms[ n ].dec ) decoder_close( strms[ n ].dec );
+  SDL_FreeSurface( strm_comp );
+  SDL_DestroyMutex( strm_mx );
+  SDL_DestroySemaphore( wake );
   SDL_DestroyMutex( trust_mx );
-  SDL_FreeSurface( frame );
   SDL_Quit();
 
   printf( "RoboCortex [info]: KTHXBYE!\n" );
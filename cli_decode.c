@@ -0,0 +1,707 @@
+#include <stdio.h>
+#include <limits.h>
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+#include <libswscale/swscale.h>
+#include <libavcodec/avcodec.h>
+#include "include/oswrap.h"
+#include "include/robocortex.h"
+#include "include/encoder.h"
+#include "include/cli_decode.h"
+
+#define DEC_SLOTS  ( ENC_PACKETS_MAX * 2 ) // Packets queued between receive and decode thread, a frame of slices fits
+#define DEC_SLOT_SIZE       8192 // Max packet size, matches transport receive buffers
+
+// Degradation under overload
+#define DEC_BUDGET         15000 // Decode time (us) per frame, leaves headroom in a 20 ms refresh
+#define DEC_LEVELS             4 // Number of degradation levels, see decoder_degrade
+#define DEC_OVER              10 // Frames over budget before degrading further
+#define DEC_UNDER             50 // Frames well under budget before backing off
+
+// Frame-rate upconversion by block motion extrapolation, see decoder_motion and decoder_mid
+#define ME_SCALE               4 // Luma is downscaled by this factor before searching
+#define ME_BLOCK               8 // Block size in downscaled luma
+#define ME_RANGE               4 // Search range in downscaled luma
+#define ME_STILL               2 // Mean absolute difference accepted as no motion
+#define ME_CUT                24 // Mean absolute difference of best matches considered a scene cut
+#define ME_MAX_LUMA       ( 1024 * 1024 ) // Max downscaled luma size, 4096x4096 stream
+#define ME_MAX_BLOCKS     ( ME_MAX_LUMA / ( ME_BLOCK * ME_BLOCK ) )
+#define ME_BUDGET           6000 // Motion search + synthesis time (us) per frame
+#define ME_HOLD               50 // Frames repeated after exceeding budget before retrying
+#define ME_MAX_INTERVAL      100 // Frame interval (ms) above which frames are only repeated
+
+// Queued stream packet, H.264 or JPEG slice
+typedef struct {
+  int                size;
+  Uint32             tick;             // Arrival time
+  char               data[ DEC_SLOT_SIZE ];
+} dec_slot_t;
+
+// Block motion of a decoded frame relative to the previous one, in downscaled luma pixels
+typedef struct {
+  signed char        v[ ME_MAX_BLOCKS ][ 2 ];
+  int                w, h;             // Blocks, 0 if vectors are not usable
+  int                stream_w, stream_h;
+} dec_motion_t;
+
+struct decoder_s {
+  // Packet ring, filled by receive thread, drained by decode thread
+  dec_slot_t         slot[ DEC_SLOTS ];
+  int                head, tail;
+  SDL_mutex         *mx;
+  SDL_cond          *cond;
+  // Triple buffer, decode thread owns back, render loop owns front
+  SDL_Surface       *surf[ 3 ];
+  int                back, ready, front;
+  int                fresh;            // Ready holds a frame not yet taken by render loop
+  int                shown;            // Render loop has a frame in front
+  Uint32             arrival[ 3 ];     // Arrival time of the packet each surface was decoded from
+  Uint32             arrival_back;     // Arrival time of packet being decoded
+  SDL_sem           *wake;             // Posted when a frame is published, may be NULL
+  // Decoding
+  AVCodecContext    *ctx;
+  AVCodec           *codec;
+  AVFrame           *frame;
+  AVCodecContext    *jctx;             // MJPEG, NULL if not available
+  AVPicture          jpic;             // Frame being assembled from JPEG slices
+  int                jpic_w, jpic_h;   // 0 if jpic is not allocated
+  uint32_t           jpic_frame;       // Frame number being assembled
+  int                jpic_partial;     // Slices of jpic_frame are in, last one is not
+  int                jpic_time;        // Decode time (us) of slices so far
+  uint8_t           *src_data[ 4 ];    // Picture to publish, decoded H.264 or assembled JPEG
+  int                src_linesize[ 4 ];
+  int                src_w, src_h;
+  enum PixelFormat   src_fmt;
+  struct SwsContext *sws;              // Cached scaling & color-space conversion context
+  enum PixelFormat   pix_fmt;          // Format matching surfaces, PIX_FMT_NONE if not supported
+  SDL_Surface       *rgb24;            // Intermediate conversion target when pix_fmt is not supported
+  SDL_Thread        *thread;
+  volatile int       quit;
+  int                latency;          // Backlog budget in ms
+  char               packet[ DEC_SLOT_SIZE ];
+  // Degradation
+  int                level;            // Current degradation level
+  int                over, under;      // Consecutive frames over/well under budget
+  int                time_avg;         // Smoothed decode time (us)
+  // Interpolation
+  int                interpolate;      // Synthesise a frame between decoded ones
+  uint8_t           *luma[ 2 ];        // Downscaled luma of current and previous frame
+  int                luma_w, luma_h;
+  int                luma_cur;         // Index of current frame in luma, -1 if none
+  dec_motion_t      *motion[ 3 ];      // Per surface, travels with the triple buffer
+  int                me_avg;           // Smoothed motion search time (us)
+  int                warp_avg;         // Smoothed synthesis time (us)
+  int                hold;             // Frames left to repeat after exceeding budget
+  Uint32             publish_tick;     // Time previous frame was published
+  int                interval;         // Smoothed frame interval (ms)
+  SDL_Surface       *mid;              // Synthesised frame, owned by render loop
+  int                mid_shown;        // Render loop is showing mid instead of front
+  Uint32             front_tick;       // Time front was taken by render loop
+  // Statistics
+  unsigned int       stat_frames;      // Frames published
+  unsigned int       stat_skipped;     // Packets skipped to reach a recovery point
+  unsigned int       stat_overflow;    // Packets dropped due to full ring
+  unsigned int       stat_late;        // Frames decoded but not published to catch up
+  unsigned int       stat_errors;      // Decoding errors
+  unsigned int       stat_depth_max;
+  unsigned long      stat_depth_sum;
+  unsigned int       stat_depth_samples;
+  unsigned int       stat_time_max;    // Decode time (us)
+  uint64_t           stat_time_sum;
+  unsigned int       stat_decoded;
+  unsigned int       stat_level[ DEC_LEVELS ]; // Frames decoded at each degradation level
+  unsigned int       stat_mid;         // Frames synthesised
+  unsigned int       stat_cut;         // Frames repeated, scene cut
+  unsigned int       stat_budget;      // Frames repeated, over budget
+  uint64_t           stat_me_sum, stat_warp_sum;
+  unsigned int       stat_me_count;
+};
+
+/* == HELPERS =================================================================================== */
+
+// Return 1 if packet holds a point decoding can start from: IDR, SEI recovery point or the first JPEG slice
+static int decoder_recovery( char *data, int size ) {
+  unsigned char *p = ( unsigned char* )data;
+  jpeg_slice_t s;
+  int n;
+  if( size >= 4 && memcmp( data, "JPEG", 4 ) == 0 ) {
+    if( size < 4 + sizeof( jpeg_slice_t ) ) return( 0 );
+    memcpy( &s, data + 4, sizeof( jpeg_slice_t ) );
+    return( s.slice == 0 );
+  }
+  for( n = 0; n + 4 < size; n++ ) {
+    if( p[ n ] == 0 && p[ n + 1 ] == 0 && p[ n + 2 ] == 1 ) {
+      if( ( p[ n + 3 ] & 0x1F ) == 5 ) return( 1 );
+      if( ( p[ n + 3 ] & 0x1F ) == 6 && p[ n + 4 ] == 6 ) return( 1 );
+      n += 2;
+    }
+  }
+  return( 0 );
+}
+
+// Return number of queued packets, call with mutex held
+static int decoder_depth( decoder_t *dec ) {
+  return( ( dec->head - dec->tail + DEC_SLOTS ) % DEC_SLOTS );
+}
+
+// Return swscale format matching the memory layout of an SDL pixel format, PIX_FMT_NONE if none does
+static enum PixelFormat decoder_format( SDL_PixelFormat *format ) {
+  if( format->BitsPerPixel == 32 && format->Gmask == 0x0000FF00 ) {
+    // Native endian 32-bit words
+    if( format->Rmask == 0x00FF0000 && format->Bmask == 0x000000FF ) return( PIX_FMT_RGB32 );
+    if( format->Rmask == 0x000000FF && format->Bmask == 0x00FF0000 ) return( PIX_FMT_BGR32 );
+  }
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+  if( format->BitsPerPixel == 24 && format->Gmask == 0x0000FF00 ) {
+    // Byte order is reversed in memory
+    if( format->Rmask == 0x00FF0000 && format->Bmask == 0x000000FF ) return( PIX_FMT_BGR24 );
+    if( format->Rmask == 0x000000FF && format->Bmask == 0x00FF0000 ) return( PIX_FMT_RGB24 );
+  }
+#endif
+  return( PIX_FMT_NONE );
+}
+
+// Sets the picture decoder_motion and decoder_publish work on
+static void decoder_source( decoder_t *dec, uint8_t **data, int *linesize, int w, int h, enum PixelFormat fmt ) {
+  memcpy( dec->src_data, data, sizeof( dec->src_data ) );
+  memcpy( dec->src_linesize, linesize, sizeof( dec->src_linesize ) );
+  dec->src_w = w;
+  dec->src_h = h;
+  dec->src_fmt = fmt;
+}
+
+// Applies degradation level, trading picture quality for decode time
+static void decoder_degrade( decoder_t *dec, int level ) {
+  static const char *names[ DEC_LEVELS ] = { "full quality", "no deblocking on non-reference frames", "no deblocking", "skipping non-reference frames" };
+  dec->level = level;
+  dec->over = 0;
+  dec->under = 0;
+  dec->ctx->skip_loop_filter = ( level >= 2 ? AVDISCARD_ALL : level >= 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT );
+  dec->ctx->skip_frame       = ( level >= 3 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT );
+  printf( "Decoder [info]: Level %i, %s\n", level, names[ level ] );
+}
+
+// Tracks decode time, degrades under sustained overload and backs off once it recovers
+static void decoder_timing( decoder_t *dec, int time ) {
+  dec->time_avg = ( dec->time_avg * 7 + time ) / 8;
+  dec->stat_decoded++;
+  dec->stat_time_sum += time;
+  if( time > dec->stat_time_max ) dec->stat_time_max = time;
+  dec->stat_level[ dec->level ]++;
+  if( dec->time_avg > DEC_BUDGET ) {
+    dec->under = 0;
+    if( ++dec->over >= DEC_OVER && dec->level + 1 < DEC_LEVELS ) decoder_degrade( dec, dec->level + 1 );
+  } else if( dec->time_avg < DEC_BUDGET * 6 / 10 ) {
+    dec->over = 0;
+    if( ++dec->under >= DEC_UNDER && dec->level > 0 ) decoder_degrade( dec, dec->level - 1 );
+  } else {
+    dec->over = 0;
+    dec->under = 0;
+  }
+}
+
+// Sum of absolute differences between block at x, y in cur and at x + dx, y + dy in prev
+static int decoder_sad( uint8_t *cur, uint8_t *prev, int stride, int x, int y, int dx, int dy, int limit ) {
+  uint8_t *c = cur + y * stride + x;
+  uint8_t *p = prev + ( y + dy ) * stride + x + dx;
+  int sad = 0, i, j;
+  for( j = 0; j < ME_BLOCK; j++ ) {
+    for( i = 0; i < ME_BLOCK; i++ ) sad += abs( c[ i ] - p[ i ] );
+    if( sad >= limit ) break;
+    c += stride;
+    p += stride;
+  }
+  return( sad );
+}
+
+// Downscales luma of the decoded frame and, when publishing, estimates block motion against the
+// previous frame into the back buffer's vectors. Vectors are left unusable on scene cuts and
+// while over budget, the render loop then repeats frames
+static void decoder_motion( decoder_t *dec, int publish ) {
+  dec_motion_t *m = dec->motion[ dec->back ];
+  uint8_t *src, *cur, *prev;
+  uint64_t start = sys_time_us();
+  int w = dec->src_w / ME_SCALE, h = dec->src_h / ME_SCALE;
+  int x, y, i, j, sum, dx, dy, sad, best, bx, by, cost = 0;
+
+  m->w = 0;
+  if( w * h > ME_MAX_LUMA || w < ME_BLOCK || h < ME_BLOCK ) return;
+  if( w != dec->luma_w || h != dec->luma_h ) {
+    dec->luma_w = w;
+    dec->luma_h = h;
+    dec->luma_cur = -1;
+  }
+
+  // Downscale luma by averaging
+  cur = dec->luma[ dec->luma_cur == 0 ? 1 : 0 ];
+  for( y = 0; y < h; y++ ) {
+    for( x = 0; x < w; x++ ) {
+      src = dec->src_data[ 0 ] + y * ME_SCALE * dec->src_linesize[ 0 ] + x * ME_SCALE;
+      for( sum = 0, j = 0; j < ME_SCALE; j++, src += dec->src_linesize[ 0 ] ) {
+        for( i = 0; i < ME_SCALE; i++ ) sum += src[ i ];
+      }
+      cur[ y * w + x ] = sum / ( ME_SCALE * ME_SCALE );
+    }
+  }
+  prev = ( dec->luma_cur < 0 ? NULL : dec->luma[ dec->luma_cur ] );
+  dec->luma_cur = ( dec->luma_cur == 0 ? 1 : 0 );
+  if( !publish || !prev ) return;
+  if( dec->hold ) {
+    dec->hold--;
+    dec->stat_budget++;
+    return;
+  }
+
+  // Full search per block, content moved by v from prev to cur
+  m->w = w / ME_BLOCK;
+  m->h = h / ME_BLOCK;
+  m->stream_w = dec->src_w;
+  m->stream_h = dec->src_h;
+  for( by = 0; by < m->h; by++ ) {
+    for( bx = 0; bx < m->w; bx++ ) {
+      x = bx * ME_BLOCK;
+      y = by * ME_BLOCK;
+      best = decoder_sad( cur, prev, w, x, y, 0, 0, INT_MAX );
+      m->v[ by * m->w + bx ][ 0 ] = 0;
+      m->v[ by * m->w + bx ][ 1 ] = 0;
+      if( best > ME_STILL * ME_BLOCK * ME_BLOCK ) {
+        for( dy = -ME_RANGE; dy <= ME_RANGE; dy++ ) {
+          if( y + dy < 0 || y + dy + ME_BLOCK > h ) continue;
+          for( dx = -ME_RANGE; dx <= ME_RANGE; dx++ ) {
+            if( x + dx < 0 || x + dx + ME_BLOCK > w || ( dx == 0 && dy == 0 ) ) continue;
+            sad = decoder_sad( cur, prev, w, x, y, dx, dy, best );
+            if( sad < best ) {
+              best = sad;
+              m->v[ by * m->w + bx ][ 0 ] = -dx;
+              m->v[ by * m->w + bx ][ 1 ] = -dy;
+            }
+          }
+        }
+      }
+      cost += best;
+    }
+  }
+
+  // Nothing matches well, extrapolating would smear
+  if( cost > ME_CUT * ME_BLOCK * ME_BLOCK * m->w * m->h ) {
+    m->w = 0;
+    dec->stat_cut++;
+  }
+
+  // Over budget, repeat frames for a while
+  dec->me_avg = ( dec->me_avg * 7 + ( int )( sys_time_us() - start ) ) / 8;
+  dec->stat_me_sum += sys_time_us() - start;
+  dec->stat_me_count++;
+  if( dec->me_avg + dec->warp_avg > ME_BUDGET ) {
+    printf( "Decoder [warning]: Interpolation over budget, repeating frames\n" );
+    dec->hold = ME_HOLD;
+    dec->me_avg = 0;
+    dec->warp_avg = 0;
+  }
+}
+
+// Synthesises front extrapolated half a frame ahead into mid, moving each block by half its vector
+static void decoder_mid( decoder_t *dec ) {
+  SDL_Surface *src = dec->surf[ dec->front ], *dst = dec->mid;
+  dec_motion_t *m = dec->motion[ dec->front ];
+  uint64_t start = sys_time_us();
+  int bpp = dst->format->BytesPerPixel;
+  int bx, by, x0, x1, y0, y1, vx, vy, sx, sy, y;
+
+  SDL_LockSurface( src );
+  SDL_LockSurface( dst );
+  for( by = 0; by < m->h; by++ ) {
+    y0 = by * dst->h / m->h;
+    y1 = ( by + 1 ) * dst->h / m->h;
+    for( bx = 0; bx < m->w; bx++ ) {
+      x0 = bx * dst->w / m->w;
+      x1 = ( bx + 1 ) * dst->w / m->w;
+      // Half vector in display pixels
+      vx = m->v[ by * m->w + bx ][ 0 ] * ME_SCALE * dst->w / m->stream_w / 2;
+      vy = m->v[ by * m->w + bx ][ 1 ] * ME_SCALE * dst->h / m->stream_h / 2;
+      sx = MAX( MIN( x0 - vx, dst->w - ( x1 - x0 ) ), 0 );
+      for( y = y0; y < y1; y++ ) {
+        sy = MAX( MIN( y - vy, dst->h - 1 ), 0 );
+        memcpy( ( uint8_t* )dst->pixels + y * dst->pitch + x0 * bpp,
+                ( uint8_t* )src->pixels + sy * src->pitch + sx * bpp, ( x1 - x0 ) * bpp );
+      }
+    }
+  }
+  SDL_UnlockSurface( dst );
+  SDL_UnlockSurface( src );
+
+  dec->warp_avg = ( dec->warp_avg * 7 + ( int )( sys_time_us() - start ) ) / 8;
+  dec->stat_warp_sum += sys_time_us() - start;
+  dec->stat_mid++;
+}
+
+// Converts decoded picture into the back buffer and publishes it
+static void decoder_publish( decoder_t *dec ) {
+  SDL_Surface *target = ( dec->pix_fmt == PIX_FMT_NONE ? dec->rgb24 : dec->surf[ dec->back ] );
+  int temp;
+
+  // Scaling & color-space conversion context, only rebuilt when stream size or format changes
+  dec->sws = sws_getCachedContext( dec->sws, dec->src_w, dec->src_h, dec->src_fmt,
+    target->w, target->h, dec->pix_fmt == PIX_FMT_NONE ? PIX_FMT_RGB24 : dec->pix_fmt, SWS_AREA, NULL, NULL, NULL );
+  if( !dec->sws ) return;
+
+  SDL_LockSurface( target );
+
+  uint8_t *data[1] = { target->pixels };
+  int linesize[1] = { target->pitch };
+
+  // Scale and convert the frame, straight into the back buffer when formats allow
+  sws_scale( dec->sws, ( const uint8_t** )dec->src_data, dec->src_linesize, 0,
+    dec->src_h, data, linesize );
+
+  SDL_UnlockSurface( target );
+
+  // Convert to display format for fast blitting
+  if( target == dec->rgb24 ) SDL_BlitSurface( dec->rgb24, NULL, dec->surf[ dec->back ], NULL );
+
+  // Swap back and ready
+  SDL_mutexP( dec->mx );
+  // A pause in the stream (static scene at a lower rate) is not an interval, and motion across it
+  // must not be extrapolated
+  temp = SDL_GetTicks() - dec->publish_tick;
+  if( dec->publish_tick && temp > ME_MAX_INTERVAL ) {
+    if( dec->motion[ dec->back ] ) dec->motion[ dec->back ]->w = 0;
+  } else if( dec->publish_tick ) {
+    dec->interval = ( dec->interval * 7 + temp ) / 8;
+  }
+  dec->publish_tick = SDL_GetTicks();
+  dec->arrival[ dec->back ] = dec->arrival_back;
+  temp = dec->ready;
+  dec->ready = dec->back;
+  dec->back = temp;
+  dec->fresh = 1;
+  dec->stat_frames++;
+  SDL_mutexV( dec->mx );
+
+  // Wake render loop
+  if( dec->wake && SDL_SemValue( dec->wake ) == 0 ) SDL_SemPost( dec->wake );
+}
+
+// Decodes a JPEG slice into the frame being assembled, publishes it once the last slice is in
+// Rows of lost slices keep the previous frame
+static void decoder_jpeg( decoder_t *dec, int size, int depth ) {
+  jpeg_slice_t s;
+  AVPacket avpkt;
+  uint64_t start = sys_time_us();
+  int got, p, y, rows, w, sh;
+
+  if( !dec->jctx || size < 4 + sizeof( jpeg_slice_t ) ) {
+    dec->stat_errors++;
+    return;
+  }
+  memcpy( &s, dec->packet + 4, sizeof( jpeg_slice_t ) );
+  if( s.y >= s.h || s.slice >= s.slices ) {
+    dec->stat_errors++;
+    return;
+  }
+
+  // Slice of a newer frame, the one being assembled lost its last slice and is never shown
+  if( s.frame != dec->jpic_frame ) {
+    if( dec->jpic_partial ) dec->stat_late++;
+    dec->jpic_frame = s.frame;
+    dec->jpic_partial = 0;
+    dec->jpic_time = 0;
+  }
+
+  // Assembly buffer, black until slices arrive
+  if( s.w != dec->jpic_w || s.h != dec->jpic_h ) {
+    if( dec->jpic_w ) avpicture_free( &dec->jpic );
+    dec->jpic_w = 0;
+    if( avpicture_alloc( &dec->jpic, PIX_FMT_YUVJ420P, s.w, s.h ) < 0 ) return;
+    dec->jpic_w = s.w;
+    dec->jpic_h = s.h;
+    memset( dec->jpic.data[ 0 ], 0, dec->jpic.linesize[ 0 ] * s.h );
+    memset( dec->jpic.data[ 1 ], 128, dec->jpic.linesize[ 1 ] * ( ( s.h + 1 ) / 2 ) );
+    memset( dec->jpic.data[ 2 ], 128, dec->jpic.linesize[ 2 ] * ( ( s.h + 1 ) / 2 ) );
+  }
+
+  av_init_packet( &avpkt );
+  avpkt.data = ( unsigned char* )dec->packet + 4 + sizeof( jpeg_slice_t );
+  avpkt.size = size - 4 - sizeof( jpeg_slice_t );
+  avpkt.flags = AV_PKT_FLAG_KEY;
+  if( avcodec_decode_video2( dec->jctx, dec->frame, &got, &avpkt ) < 0 || !got || dec->jctx->pix_fmt != PIX_FMT_YUVJ420P ) {
+    dec->stat_errors++;
+    return;
+  }
+
+  // Copy rows into place, slices start on a macroblock row so chroma lines up
+  rows = MIN( dec->jctx->height, s.h - s.y );
+  w = MIN( dec->jctx->width, s.w );
+  for( p = 0; p < 3; p++ ) {
+    sh = ( p ? 1 : 0 );
+    for( y = 0; y < ( rows + sh ) >> sh; y++ ) {
+      memcpy( dec->jpic.data[ p ] + ( ( s.y >> sh ) + y ) * dec->jpic.linesize[ p ],
+              dec->frame->data[ p ] + y * dec->frame->linesize[ p ], ( w + sh ) >> sh );
+    }
+  }
+  dec->jpic_time += ( int )( sys_time_us() - start );
+  dec->jpic_partial = 1;
+  if( s.slice + 1 < s.slices ) return;
+
+  // Frame complete
+  dec->jpic_partial = 0;
+  decoder_timing( dec, dec->jpic_time );
+  decoder_source( dec, dec->jpic.data, dec->jpic.linesize, s.w, s.h, PIX_FMT_YUVJ420P );
+  if( dec->interpolate ) decoder_motion( dec, depth == 0 );
+  if( depth == 0 ) decoder_publish( dec ); else dec->stat_late++;
+}
+
+/* == DECODE THREAD ============================================================================= */
+
+static int decoder_thread( void *p_dec ) {
+  decoder_t *dec = p_dec;
+  AVPacket avpkt;
+  uint64_t start;
+  int n, got, size, depth;
+
+  av_init_packet( &avpkt );
+  while( !dec->quit ) {
+    SDL_mutexP( dec->mx );
+    while( dec->head == dec->tail && !dec->quit ) SDL_CondWait( dec->cond, dec->mx );
+    if( dec->quit ) {
+      SDL_mutexV( dec->mx );
+      break;
+    }
+
+    // Backlog over budget, skip to the newest point decoding can restart from
+    if( SDL_GetTicks() - dec->slot[ dec->tail ].tick > dec->latency ) {
+      for( n = ( dec->head + DEC_SLOTS - 1 ) % DEC_SLOTS; n != dec->tail; n = ( n + DEC_SLOTS - 1 ) % DEC_SLOTS ) {
+        if( decoder_recovery( dec->slot[ n ].data, dec->slot[ n ].size ) ) break;
+      }
+      dec->stat_skipped += ( n - dec->tail + DEC_SLOTS ) % DEC_SLOTS;
+      dec->tail = n;
+    }
+
+    // Statistics
+    depth = decoder_depth( dec );
+    if( depth > dec->stat_depth_max ) dec->stat_depth_max = depth;
+    dec->stat_depth_sum += depth;
+    dec->stat_depth_samples++;
+
+    // Pop packet
+    size = dec->slot[ dec->tail ].size;
+    dec->arrival_back = dec->slot[ dec->tail ].tick;
+    memcpy( dec->packet, dec->slot[ dec->tail ].data, size );
+    dec->tail = ( dec->tail + 1 ) % DEC_SLOTS;
+    depth--;
+    SDL_mutexV( dec->mx );
+
+    // JPEG slice, intra-only mode
+    if( memcmp( dec->packet, "JPEG", 4 ) == 0 ) {
+      decoder_jpeg( dec, size, depth );
+      continue;
+    }
+
+    // Decode frame
+    avpkt.data = ( unsigned char* )dec->packet;
+    avpkt.size = size;
+    avpkt.flags = AV_PKT_FLAG_KEY;
+    start = sys_time_us();
+    if( avcodec_decode_video2( dec->ctx, dec->frame, &got, &avpkt ) < 0 ) {
+      dec->stat_errors++;
+    } else if( got ) {
+      decoder_timing( dec, ( int )( sys_time_us() - start ) );
+      decoder_source( dec, dec->frame->data, dec->frame->linesize, dec->ctx->width, dec->ctx->height, dec->ctx->pix_fmt );
+      if( dec->interpolate ) decoder_motion( dec, depth == 0 );
+      // Only the newest frame is worth converting when more are waiting
+      if( depth == 0 ) decoder_publish( dec ); else dec->stat_late++;
+    }
+  }
+  return( 0 );
+}
+
+/* == INTERFACE ================================================================================= */
+
+// Opens a decoder producing w x h frames in the specified pixel format, posting wake for each
+// frame and synthesising frames in between if interpolate is set, return NULL on failure
+decoder_t *decoder_open( int w, int h, SDL_PixelFormat *format, int latency, SDL_sem *wake, int interpolate ) {
+  decoder_t *dec;
+  AVCodec *codec;
+  int n;
+
+  dec = calloc( 1, sizeof( decoder_t ) );
+  if( !dec ) return( NULL );
+  dec->latency = latency;
+  dec->wake = wake;
+
+  // Initialize decoder
+  avcodec_init();
+  avcodec_register_all();
+  dec->ctx = avcodec_alloc_context();
+  dec->codec = avcodec_find_decoder( CODEC_ID_H264 );
+  if( !dec->codec ) {
+    free( dec );
+    return( NULL );
+  }
+  // Low latency: output each frame as soon as it is decoded, spread slices over all cores,
+  // never use frame threading as it delays output by one frame per thread
+  dec->ctx->flags |= CODEC_FLAG_LOW_DELAY;
+  dec->ctx->flags2 |= CODEC_FLAG2_FAST;
+  dec->ctx->thread_count = sys_cpu_count();
+#ifdef FF_THREAD_SLICE
+  dec->ctx->thread_type = FF_THREAD_SLICE;
+#else
+  avcodec_thread_init( dec->ctx, dec->ctx->thread_count );
+#endif
+  avcodec_open( dec->ctx, dec->codec );
+  dec->frame = avcodec_alloc_frame();
+
+  // MJPEG for the intra-only mode, offered to the server only if available
+  codec = avcodec_find_decoder( CODEC_ID_MJPEG );
+  if( codec ) {
+    dec->jctx = avcodec_alloc_context();
+    if( avcodec_open( dec->jctx, codec ) < 0 ) {
+      av_free( dec->jctx );
+      dec->jctx = NULL;
+    }
+  }
+
+  // Surfaces, in display format so rendering is a plain copy
+  dec->pix_fmt = decoder_format( format );
+  if( dec->pix_fmt == PIX_FMT_NONE ) {
+    printf( "Decoder [warning]: No direct conversion to %i-bit display format, converting twice\n", format->BitsPerPixel );
+    dec->rgb24 = SDL_CreateRGBSurface( SDL_SWSURFACE, w, h, 24, 0, 0, 0, 0 );
+    if( !dec->rgb24 ) return( NULL );
+  }
+  for( n = 0; n < 3; n++ ) {
+    dec->surf[ n ] = SDL_CreateRGBSurface( SDL_SWSURFACE, w, h, format->BitsPerPixel,
+      format->Rmask, format->Gmask, format->Bmask, format->Amask );
+    if( !dec->surf[ n ] ) return( NULL );
+  }
+  dec->back = 0;
+  dec->ready = 1;
+  dec->front = 2;
+
+  // Interpolation
+  if( interpolate ) {
+    dec->mid = SDL_CreateRGBSurface( SDL_SWSURFACE, w, h, format->BitsPerPixel,
+      format->Rmask, format->Gmask, format->Bmask, format->Amask );
+    dec->luma[ 0 ] = malloc( ME_MAX_LUMA );
+    dec->luma[ 1 ] = malloc( ME_MAX_LUMA );
+    for( n = 0; n < 3; n++ ) dec->motion[ n ] = calloc( 1, sizeof( dec_motion_t ) );
+    dec->interpolate = ( dec->mid && dec->luma[ 0 ] && dec->luma[ 1 ] && dec->motion[ 0 ] && dec->motion[ 1 ] && dec->motion[ 2 ] );
+    if( !dec->interpolate ) printf( "Decoder [warning]: Unable to allocate interpolation buffers, repeating frames\n" );
+    dec->luma_cur = -1;
+  }
+
+  dec->mx = SDL_CreateMutex();
+  dec->cond = SDL_CreateCond();
+  dec->thread = SDL_CreateThread( decoder_thread, dec );
+  return( dec );
+}
+
+// Stops decode thread, prints statistics and frees resources
+void decoder_close( decoder_t *dec ) {
+  int n;
+  SDL_mutexP( dec->mx );
+  dec->quit = 1;
+  SDL_CondSignal( dec->cond );
+  SDL_mutexV( dec->mx );
+  SDL_WaitThread( dec->thread, NULL );
+
+  printf( "Decoder [info]: Frames shown:              %u\n", dec->stat_frames );
+  printf( "Decoder [info]: Frames decoded late:       %u\n", dec->stat_late );
+  printf( "Decoder [info]: Packets skipped (latency): %u\n", dec->stat_skipped );
+  printf( "Decoder [info]: Packets dropped (full):    %u\n", dec->stat_overflow );
+  printf( "Decoder [info]: Decoding errors:           %u\n", dec->stat_errors );
+  printf( "Decoder [info]: Queue depth avg/max:       %.2f/%u\n",
+    dec->stat_depth_samples ? ( double )dec->stat_depth_sum / dec->stat_depth_samples : 0.0, dec->stat_depth_max );
+  printf( "Decoder [info]: Decode time avg/max:       %.2f/%.2f ms\n",
+    dec->stat_decoded ? ( double )dec->stat_time_sum / dec->stat_decoded / 1000.0 : 0.0, dec->stat_time_max / 1000.0 );
+  for( n = 0; n < DEC_LEVELS; n++ ) {
+    if( dec->stat_level[ n ] ) printf( "Decoder [info]: Frames at level %i:         %u\n", n, dec->stat_level[ n ] );
+  }
+  if( dec->interpolate ) {
+    printf( "Decoder [info]: Frames synthesised:        %u\n", dec->stat_mid );
+    printf( "Decoder [info]: Repeated, cut/budget:      %u/%u (%.1f%% fallback)\n", dec->stat_cut, dec->stat_budget,
+      dec->stat_frames ? 100.0 * ( dec->stat_cut + dec->stat_budget ) / dec->stat_frames : 0.0 );
+    printf( "Decoder [info]: Search/synthesis avg:      %.2f/%.2f ms\n",
+      dec->stat_me_count ? ( double )dec->stat_me_sum / dec->stat_me_count / 1000.0 : 0.0,
+      dec->stat_mid ? ( double )dec->stat_warp_sum / dec->stat_mid / 1000.0 : 0.0 );
+  }
+
+  avcodec_close( dec->ctx );
+  av_free( dec->frame );
+  if( dec->jctx ) {
+    avcodec_close( dec->jctx );
+    av_free( dec->jctx );
+  }
+  if( dec->jpic_w ) avpicture_free( &dec->jpic );
+  if( dec->sws ) sws_freeContext( dec->sws );
+  for( n = 0; n < 3; n++ ) SDL_FreeSurface( dec->surf[ n ] );
+  for( n = 0; n < 3; n++ ) free( dec->motion[ n ] );
+  free( dec->luma[ 0 ] );
+  free( dec->luma[ 1 ] );
+  if( dec->mid ) SDL_FreeSurface( dec->mid );
+  if( dec->rgb24 ) SDL_FreeSurface( dec->rgb24 );
+  SDL_DestroyCond( dec->cond );
+  SDL_DestroyMutex( dec->mx );
+  free( dec );
+}
+
+// Queues a stream packet, drops the oldest packet when full
+void decoder_push( decoder_t *dec, char *data, int size ) {
+  if( size > DEC_SLOT_SIZE ) return;
+  SDL_mutexP( dec->mx );
+  if( ( dec->head + 1 ) % DEC_SLOTS == dec->tail ) {
+    dec->tail = ( dec->tail + 1 ) % DEC_SLOTS;
+    dec->stat_overflow++;
+  }
+  memcpy( dec->slot[ dec->head ].data, data, size );
+  dec->slot[ dec->head ].size = size;
+  dec->slot[ dec->head ].tick = SDL_GetTicks();
+  dec->head = ( dec->head + 1 ) % DEC_SLOTS;
+  SDL_CondSignal( dec->cond );
+  SDL_mutexV( dec->mx );
+}
+
+// Return newest frame or NULL if none yet, fresh is 1 for a decoded frame not returned before
+// and 2 for a frame synthesised halfway to the next one
+SDL_Surface *decoder_latest( decoder_t *dec, int *fresh ) {
+  int temp, interval;
+  SDL_mutexP( dec->mx );
+  *fresh = dec->fresh;
+  if( dec->fresh ) {
+    temp = dec->front;
+    dec->front = dec->ready;
+    dec->ready = temp;
+    dec->fresh = 0;
+    dec->shown = 1;
+    dec->mid_shown = 0;
+    dec->front_tick = SDL_GetTicks();
+  }
+  interval = dec->interval;
+  SDL_mutexV( dec->mx );
+  if( !dec->shown ) return( NULL );
+
+  // Halfway to the next frame, show front extrapolated by its motion instead of repeating it
+  if( dec->interpolate && !*fresh && !dec->mid_shown && dec->motion[ dec->front ]->w && interval <= ME_MAX_INTERVAL
+   && SDL_GetTicks() - dec->front_tick >= interval / 2 ) {
+    decoder_mid( dec );
+    dec->mid_shown = 1;
+    *fresh = 2;
+  }
+  return( dec->mid_shown ? dec->mid : dec->surf[ dec->front ] );
+}
+
+// Copies running counters, dropped covers skipped, overflowed, late and broken frames
+void decoder_counters( decoder_t *dec, unsigned int *decoded, unsigned int *dropped, int *time_avg ) {
+  *decoded = dec->stat_decoded;
+  *dropped = dec->stat_skipped + dec->stat_overflow + dec->stat_late + dec->stat_errors;
+  *time_avg = dec->time_avg;
+}
+
+// Return encoder_e mask of the stream encodings this decoder handles
+int decoder_codecs( decoder_t *dec ) {
+  return( ENC_H264 | ( dec->jctx ? ENC_JPEG : 0 ) );
+}
+
+// Return arrival time of the packet the newest returned frame was decoded from
+Uint32 decoder_arrival( decoder_t *dec ) {
+  return( dec->arrival[ dec->front ] );
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <SDL/SDL.h>
+#include "include/robocortex.h"
+#include "plugins/cli.h"
+#include "include/cli_draw.h"
+
+// Wu-line implementation, courtesy of http://www.codeproject.com/KB/GDI/antialias.aspx
+// Reworked to draw batches of lines on a 32-bit surface, locked once per batch
+
+// Batch state
+typedef struct {
+  Uint32            *pixels;
+  int                stride;           // In pixels
+  int                x0, y0, x1, y1;   // Clipping bounds, exclusive x1/y1
+  Uint32             rb, g;            // Color, red/blue and green/x lanes
+  Uint32             solid;            // Color blended at full weight
+  int                clip;             // Current line crosses clipping bounds
+} batch_t;
+
+// Blends two channels per multiply: background weight a, color weight 255 - a
+#define BLEND( d, b, a ) ( ( ( ( ( *( d ) & 0x00FF00FF ) * ( a ) + ( b )->rb * ( 255 - ( a ) ) ) >> 8 ) & 0x00FF00FF ) \
+                         | ( ( ( ( *( d ) >> 8 ) & 0x00FF00FF ) * ( a ) + ( b )->g * ( 255 - ( a ) ) ) & 0xFF00FF00 ) )
+
+// Plots a pixel, bounds are only checked for lines crossing them
+static inline void plot( batch_t *b, int x, int y, unsigned int a ) {
+  Uint32 *d;
+  if( b->clip && ( x < b->x0 || x >= b->x1 || y < b->y0 || y >= b->y1 ) ) return;
+  d = b->pixels + y * b->stride + x;
+  *d = ( a ? BLEND( d, b, a ) : b->solid );
+}
+
+// Draws a run of full weight pixels, x0 <= x1
+static void span( batch_t *b, int x0, int x1, int y ) {
+  Uint32 *d, *e;
+  if( b->clip ) {
+    if( y < b->y0 || y >= b->y1 ) return;
+    if( x0 < b->x0 ) x0 = b->x0;
+    if( x1 >= b->x1 ) x1 = b->x1 - 1;
+  }
+  d = b->pixels + y * b->stride + x0;
+  e = b->pixels + y * b->stride + x1;
+  while( d <= e ) *d++ = b->solid;
+}
+
+// Draws one line, skips the first pixel when continuing a polyline
+static void wu( batch_t *b, int X0, int Y0, int X1, int Y1, int skip ) {
+  unsigned short ErrorAdj, ErrorAcc, ErrorAccTemp, Weighting;
+  int DeltaX, DeltaY, Temp, XDir;
+  int first = !skip, last = 1;
+
+  // Trivially reject or accept against bounds, +1 for the anti-aliasing neighbour
+  if( MAX( X0, X1 ) + 1 < b->x0 || MIN( X0, X1 ) - 1 >= b->x1
+   || MAX( Y0, Y1 ) + 1 < b->y0 || MIN( Y0, Y1 ) >= b->y1 ) return;
+  b->clip = ( MIN( X0, X1 ) - 1 < b->x0 || MAX( X0, X1 ) + 1 >= b->x1
+           || MIN( Y0, Y1 ) < b->y0 || MAX( Y0, Y1 ) + 1 >= b->y1 );
+
+  if( Y0 > Y1 ) {
+    Temp = Y0; Y0 = Y1; Y1 = Temp;
+    Temp = X0; X0 = X1; X1 = Temp;
+    // First pixel is now the last one
+    first = 1;
+    last = !skip;
+  }
+  if( ( DeltaX = X1 - X0 ) >= 0 ) {
+    XDir = 1;
+  } else {
+    XDir = -1;
+    DeltaX = -DeltaX;
+  }
+  // Horizontal, as a single span
+  if( ( DeltaY = Y1 - Y0 ) == 0 ) {
+    if( !first ) X0 += XDir;
+    if( !last ) X1 -= XDir;
+    if( XDir * ( X1 - X0 ) >= 0 ) span( b, MIN( X0, X1 ), MAX( X0, X1 ), Y0 );
+    return;
+  }
+  if( first ) plot( b, X0, Y0, 0 );
+  // Vertical, diagonal
+  if( DeltaX == 0 ) {
+    while( --DeltaY ) plot( b, X0, ++Y0, 0 );
+  } else if( DeltaX == DeltaY ) {
+    while( --DeltaY ) plot( b, X0 += XDir, ++Y0, 0 );
+  } else {
+    // Draw X/Y major
+    ErrorAcc = 0;
+    if( DeltaY > DeltaX ) {
+      ErrorAdj = ( ( unsigned long )DeltaX << 16 ) / ( unsigned long )DeltaY;
+      while( --DeltaY ) {
+        ErrorAccTemp = ErrorAcc;
+        ErrorAcc += ErrorAdj;
+        if( ErrorAcc <= ErrorAccTemp ) X0 += XDir;
+        Y0++;
+        Weighting = ErrorAcc >> 8;
+        plot( b, X0, Y0, Weighting );
+        plot( b, X0 + XDir, Y0, Weighting ^ 0xFF );
+      }
+    } else {
+      ErrorAdj = ( ( unsigned long )DeltaY << 16 ) / ( unsigned long )DeltaX;
+      while( --DeltaX ) {
+        ErrorAccTemp = ErrorAcc;
+        ErrorAcc += ErrorAdj;
+        if( ErrorAcc <= ErrorAccTemp ) Y0++;
+        X0 += XDir;
+        Weighting = ErrorAcc >> 8;
+        plot( b, X0, Y0, Weighting );
+        plot( b, X0, Y0 + 1, Weighting ^ 0xFF );
+      }
+    }
+  }
+  if( last ) plot( b, X1, Y1, 0 );
+}
+
+// Prepares a batch for surface s, returns 0 if the surface can not be drawn on
+static int batch_begin( batch_t *b, SDL_Surface *s, uint32_t color ) {
+  Uint32 c;
+  if( s->format->BytesPerPixel != 4 ) return( 0 );
+  if( SDL_MUSTLOCK( s ) && SDL_LockSurface( s ) != 0 ) return( 0 );
+  b->pixels = s->pixels;
+  b->stride = s->pitch >> 2;
+  b->x0 = s->clip_rect.x;
+  b->y0 = s->clip_rect.y;
+  b->x1 = s->clip_rect.x + s->clip_rect.w;
+  b->y1 = s->clip_rect.y + s->clip_rect.h;
+  c = SDL_MapRGB( s->format, ( color >> 16 ) & 0xFF, ( color >> 8 ) & 0xFF, color & 0xFF );
+  b->rb = c & 0x00FF00FF;
+  b->g = ( c >> 8 ) & 0x00FF00FF;
+  b->solid = ( ( ( b->rb * 255 ) >> 8 ) & 0x00FF00FF ) | ( ( b->g * 255 ) & 0xFF00FF00 );
+  return( 1 );
+}
+
+static void batch_end( SDL_Surface *s ) {
+  if( SDL_MUSTLOCK( s ) ) SDL_UnlockSurface( s );
+}
+
+// Draws a batch of anti-aliased lines in color (0xRRGGBB)
+void draw_lines( SDL_Surface *s, line_t *lines, int count, uint32_t color ) {
+  batch_t b;
+  if( count <= 0 || !batch_begin( &b, s, color ) ) return;
+  while( count-- ) {
+    wu( &b, lines->x0, lines->y0, lines->x1, lines->y1, 0 );
+    lines++;
+  }
+  batch_end( s );
+}
+
+// Draws an anti-aliased polyline through count points in color (0xRRGGBB)
+// Shared points are blended once
+void draw_polyline( SDL_Surface *s, point_t *points, int count, uint32_t color ) {
+  batch_t b;
+  int n;
+  if( count < 2 || !batch_begin( &b, s, color ) ) return;
+  for( n = 1; n < count; n++ ) {
+    wu( &b, points[ n - 1 ].x, points[ n - 1 ].y, points[ n ].x, points[ n ].y, n > 1 );
+  }
+  batch_end( s );
+}
+
+// Draws src scaled to dst on s (same pixel format), nearest neighbour
+void draw_scaled( SDL_Surface *s, SDL_Surface *src, SDL_Rect *dst ) {
+  SDL_Rect r = *dst;
+  Uint8 *d, *p;
+  int bpp = s->format->BytesPerPixel, x, y, x0, x1, y0, y1, sx, sy;
+  if( src->w == dst->w && src->h == dst->h ) {
+    SDL_BlitSurface( src, NULL, s, &r );
+    return;
+  }
+  if( dst->w <= 0 || dst->h <= 0 || src->format->BytesPerPixel != bpp ) return;
+  x0 = MAX( dst->x, s->clip_rect.x );
+  y0 = MAX( dst->y, s->clip_rect.y );
+  x1 = dst->x + dst->w;
+  x1 = MIN( x1, s->clip_rect.x + s->clip_rect.w );
+  y1 = dst->y + dst->h;
+  y1 = MIN( y1, s->clip_rect.y + s->clip_rect.h );
+  if( x0 >= x1 || y0 >= y1 ) return;
+  if( SDL_MUSTLOCK( s ) && SDL_LockSurface( s ) != 0 ) return;
+  if( SDL_MUSTLOCK( src ) && SDL_LockSurface( src ) != 0 ) {
+    if( SDL_MUSTLOCK( s ) ) SDL_UnlockSurface( s );
+    return;
+  }
+  for( y = y0; y < y1; y++ ) {
+    sy = ( y - dst->y ) * src->h / dst->h;
+    d = ( Uint8* )s->pixels + y * s->pitch + x0 * bpp;
+    p = ( Uint8* )src->pixels + sy * src->pitch;
+    for( x = x0; x < x1; x++, d += bpp ) {
+      sx = ( x - dst->x ) * src->w / dst->w;
+      switch( bpp ) {
+        case 4: *( Uint32* )d = *( Uint32* )( p + sx * 4 ); break;
+        case 2: *( Uint16* )d = *( Uint16* )( p + sx * 2 ); break;
+        default: memcpy( d, p + sx * bpp, bpp );
+      }
+    }
+  }
+  if( SDL_MUSTLOCK( src ) ) SDL_UnlockSurface( src );
+  if( SDL_MUSTLOCK( s ) ) SDL_UnlockSurface( s );
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <SDL/SDL.h>
+#include "include/robocortex.h"
+#include "plugins/cli.h"
+#include "include/cli_term.h"
+#include "include/cli_draw.h"
+#include "include/cli_hud.h"
+
+#define HUD_X                  1 // Position (terminal cells)
+#define HUD_Y                  4
+#define HUD_TEXT              14 // Text columns
+#define HUD_HISTORY           48 // Samples of sparkline history
+#define HUD_STEP               2 // Sparkline pixels per sample
+#define HUD_HEIGHT            12 // Sparkline height (pixels)
+
+static         float  history[ HUD_ROWS ][ HUD_HISTORY ]; // Sample rings, all rows share head
+static           int  head;                               // Slot of next sample
+static           int  shown;                              // HUD is displayed
+static          char  text[ HUD_ROWS ][ HUD_TEXT + 1 ];   // Current text per row
+
+// Sets current sample and text of a row, text is padded to clear the previous one
+void hud_set( int row, float value, char *s ) {
+  history[ row ][ head ] = value;
+  snprintf( text[ row ], HUD_TEXT + 1, "%-*s", HUD_TEXT, s );
+  if( shown ) term_write( HUD_X, HUD_Y + row, text[ row ], FONT_GREEN );
+}
+
+// Advances history, call after setting all rows
+void hud_next() {
+  head = ( head + 1 ) % HUD_HISTORY;
+}
+
+// Shows or hides the HUD text, sparklines are drawn by hud_draw
+void hud_show( int show ) {
+  int row;
+  shown = show;
+  for( row = 0; row < HUD_ROWS; row++ ) {
+    if( shown ) {
+      if( text[ row ][ 0 ] ) term_write( HUD_X, HUD_Y + row, text[ row ], FONT_GREEN );
+    } else {
+      term_white( HUD_X, HUD_Y + row, HUD_TEXT );
+    }
+  }
+}
+
+// Draws sparklines, oldest sample left, each row scaled to its own peak
+void hud_draw( SDL_Surface *s ) {
+  point_t points[ HUD_HISTORY ];
+  float peak;
+  int row, n, i;
+  for( row = 0; row < HUD_ROWS; row++ ) {
+    peak = 0;
+    for( n = 0; n < HUD_HISTORY; n++ ) if( history[ row ][ n ] > peak ) peak = history[ row ][ n ];
+    for( n = 0; n < HUD_HISTORY; n++ ) {
+      i = ( head + n ) % HUD_HISTORY;
+      points[ n ].x = ( ( HUD_X + HUD_TEXT ) << 4 ) + n * HUD_STEP;
+      points[ n ].y = ( ( HUD_Y + row ) << 4 ) + 14 - ( peak > 0 ? ( int )( history[ row ][ i ] * HUD_HEIGHT / peak ) : 0 );
+    }
+    draw_polyline( s, points, HUD_HISTORY, 0x2FDF2F );
+  }
+}
+
+// Returns screen region covered by the HUD
+void hud_rect( SDL_Rect *r ) {
+  rect( r, HUD_X << 4, HUD_Y << 4, ( HUD_TEXT << 4 ) + HUD_HISTORY * HUD_STEP, HUD_ROWS << 4 );
+}
@@ -11,17 +11,28 @@ typedef struct {
 } termchar_t;
 
 static    termchar_t *term;
+static           int *shown;            // Glyph currently rendered in layer per cell, -1 forces render
        unsigned char  term_w, term_h;
 static   SDL_Surface *font[ 2 ];
+static   SDL_Surface *layer;            // Rendered terminal, color keyed overlay
+static        Uint32  layer_key;        // Transparent color of layer
 static const    char  font_chars[] = "#!\"c % '()|+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+static unsigned char  glyph[ 256 ];     // Character to font_chars index, 0xFF if unknown
 static unsigned char  write_index = 0;
 static   SDL_Surface *screen;
 static          char  cx = -1, cy, ct;
+static           int  cursor_cell = -1; // Cell cursor was last rendered in
 
 // Convenience macros
 #define ABS( v ) ( v < 0 ? -v : v )
 #define TERM( x, y ) term[ y * term_w + x ]
 
+// Animation
+#define TERM_STEP 20 // Time (ms) per animation step, independent of how often term_draw is called
+
+// Glyph as rendered: character, font and animation row, 0 if empty
+#define SHOWN( c, f, r ) ( ( c ) ? ( c ) | ( ( f ) << 8 ) | ( ( r ) << 9 ) : 0 )
+
 void term_cins( unsigned char x, unsigned char y ) {
   cx = x;
   cy = y;
@@ -38,7 +49,7 @@ void term_clear() {
 
 void term_init( SDL_Surface *scr ) {
   SDL_Surface* temp;
-  char *p_pixel;
+  int i;
 
   screen = scr;
   
@@ -47,6 +58,19 @@ void term_init( SDL_Surface *scr ) {
   term = malloc( sizeof( termchar_t ) * term_w * term_h );
   term_clear();
 
+  // Glyph lookup, first match wins as with a linear search
+  memset( glyph, 0xFF, sizeof( glyph ) );
+  for( i = sizeof( font_chars ) - 1; i-- > 0; ) glyph[ ( unsigned char )font_chars[ i ] ] = i;
+
+  // Overlay layer, only changed cells are rendered into it
+  layer = SDL_CreateRGBSurface( SDL_SWSURFACE, term_w << 4, term_h << 4, screen->format->BitsPerPixel,
+    screen->format->Rmask, screen->format->Gmask, screen->format->Bmask, 0 );
+  layer_key = SDL_MapRGB( layer->format, 0xFF, 0x00, 0xFF );
+  SDL_FillRect( layer, NULL, layer_key );
+  SDL_SetColorKey( layer, SDL_SRCCOLORKEY | SDL_RLEACCEL, layer_key );
+  shown = malloc( sizeof( int ) * term_w * term_h );
+  memset( shown, 0, sizeof( int ) * term_w * term_h );
+
   temp = SDL_LoadBMP( "font1.bmp" );
   if( !temp ) printf( "KiwiDriveClient [error]: Unable to load font1.bmp\n" );
   font[ 0 ] = SDL_DisplayFormat( temp );
@@ -61,64 +85,116 @@ void term_init( SDL_Surface *scr ) {
   SDL_SetColorKey( font[ 1 ], SDL_SRCCOLORKEY, SDL_MapRGB( screen->format, 0xFF, 0x00, 0xFF ) );
 }
 
-void term_draw() {
+// Renders changed or animating cells into the layer, see term_blit
+// Returns changed screen regions in rects, merged per row, a single rect if more than max
+int term_draw( SDL_Rect *rects, int max ) {
+  static Uint32 last;
+  Uint32 now = SDL_GetTicks();
   unsigned char x, y;
-  unsigned char i, j;
-  write_index = 0;
+  int steps, tick, row, cell, glyph_now, count = 0, overflow = 0;
   SDL_Rect srcrect;
   SDL_Rect dstrect;
+  write_index = 0;
   srcrect.w = 16;
   srcrect.h = 16;
+  // Number of animation steps since last draw
+  if( last == 0 ) last = now;
+  steps = ( now - last ) / TERM_STEP;
+  last += steps * TERM_STEP;
+  if( steps > 64 ) steps = 64;
+  // Cursor moved, blinked or was removed: re-render old and new cell
+  if( cursor_cell >= 0 ) shown[ cursor_cell ] = -1;
+  if( cx >= 0 ) {
+    ct = ( ct + steps ) % 32;
+    cursor_cell = cy * term_w + cx;
+    shown[ cursor_cell ] = -1;
+  } else {
+    cursor_cell = -1;
+  }
   for( y = 0; y < term_h; y++ ) {
     for( x = 0; x < term_w; x++ ) {
-      if( TERM( x, y ).tick < 15 ) {
-        if( ++TERM( x,  y ).tick == 0 ) {
+      if( TERM( x, y ).tick < 15 && steps ) {
+        tick = TERM( x,  y ).tick + steps;
+        if( TERM( x,  y ).tick < 0 && tick >= 0 ) {
           TERM( x, y ).cchar = TERM( x,  y ).nchar;
           TERM( x, y ).cfont = TERM( x,  y ).nfont;
         }
+        TERM( x,  y ).tick = ( tick > 15 ? 15 : tick );
       }
 
+      row = ( TERM( x,  y ).tick >= 0 ? TERM( x,  y ).tick : 15 );
+      glyph_now = SHOWN( TERM( x,  y ).cchar, TERM( x,  y ).cfont, row );
+      cell = y * term_w + x;
+      if( shown[ cell ] == glyph_now ) continue;
+      shown[ cell ] = glyph_now;
+
+      // Re-render cell
+      dstrect.x = x << 4;
+      dstrect.y = y << 4;
+      dstrect.w = 16;
+      dstrect.h = 16;
+      SDL_FillRect( layer, &dstrect, layer_key );
       if( TERM( x,  y ).cchar ) {
+        srcrect.x = TERM( x,  y ).cchar << 4;
+        srcrect.y = row << 4;
+        SDL_BlitSurface( font[ TERM( x,  y ).cfont ], &srcrect, layer, &dstrect );
+      }
+      if( cell == cursor_cell ) {
+        srcrect.x = 0;
+        srcrect.y = ( ct > 15 ? 240 : ct << 4 );
         dstrect.x = x << 4;
         dstrect.y = y << 4;
-        srcrect.x = TERM( x,  y ).cchar << 4;
-        srcrect.y = ( TERM( x,  y ).tick >= 0 ? TERM( x,  y ).tick << 4 : 240 );
-        SDL_BlitSurface( font[ TERM( x,  y ).cfont ], &srcrect, screen, &dstrect );
+        SDL_BlitSurface( font[ 0 ], &srcrect, layer, &dstrect );
+        shown[ cell ] = -1;
+      }
+
+      // Extend run on this row or start a new one
+      if( count && rects[ count - 1 ].y == y << 4 && rects[ count - 1 ].x + rects[ count - 1 ].w == x << 4 ) {
+        rects[ count - 1 ].w += 16;
+      } else if( count < max ) {
+        rects[ count ].x = x << 4;
+        rects[ count ].y = y << 4;
+        rects[ count ].w = 16;
+        rects[ count ].h = 16;
+        count++;
+      } else {
+        overflow = 1;
       }
     }
   }
-  if( cx >= 0 ) { 
-    srcrect.x = 0;
-    srcrect.y = ( ct > 15 ? 240 : ct << 4 );
-    dstrect.x = cx << 4;
-    dstrect.y = cy << 4;
-    SDL_BlitSurface( font[ 0 ], &srcrect, screen, &dstrect );
-    if( ++ct == 32 ) ct = 0;
+  if( overflow ) {
+    rects[ 0 ].x = 0;
+    rects[ 0 ].y = 0;
+    rects[ 0 ].w = layer->w;
+    rects[ 0 ].h = layer->h;
+    count = 1;
   }
+  return( count );
+}
+
+// Blits the rendered layer onto the screen
+void term_blit() {
+  SDL_BlitSurface( layer, NULL, screen, NULL );
 }
 
 void term_write( unsigned char x, unsigned char y, char *s, unsigned char f ) {
-  unsigned char i, j, t = 0;
-  int len = strlen( s );
-  for( i = 0; i < len; i++ ) {
-    for( j = 0; j < sizeof( font_chars ) - 1; j++ ) {
-      if( font_chars[ j ] == s[ i ] ) {
-        if( TERM( x,  y ).nchar != j || TERM( x,  y ).nfont != f ) {
-          TERM( x,  y ).nchar = j;
-          TERM( x,  y ).nfont = f;
-          if( t == 0 && write_index == 0 ) {
-            TERM( x,  y ).cchar = j;
-            TERM( x,  y ).cfont = f;
-            TERM( x,  y ).tick = 0;
-          } else {
-            TERM( x,  y ).tick = -( t + write_index * 5 );
-          }
-          t++;
-        }
-        x++;
-        break;
+  unsigned char j, t = 0;
+  for( ; *s; s++ ) {
+    j = glyph[ ( unsigned char )*s ];
+    if( j == 0xFF ) continue;
+    if( TERM( x,  y ).nchar != j || TERM( x,  y ).nfont != f ) {
+      TERM( x,  y ).nchar = j;
+      TERM( x,  y ).nfont = f;
+      if( t == 0 && write_index == 0 ) {
+        TERM( x,  y ).cchar = j;
+        TERM( x,  y ).cfont = f;
+        TERM( x,  y ).tick = 0;
+      } else {
+        TERM( x,  y ).tick = -( t + write_index * 5 );
       }
+      t++;
     }
+    x++;
   }
   write_index++;
 }
@@ -131,14 +207,12 @@ void term_white( unsigned char x, unsigned char y, unsigned char c ) {
 
 void term_close() {
   free( term );
+  free( shown );
+  SDL_FreeSurface( layer );
   SDL_FreeSurface( font[ 0 ] );
   SDL_FreeSurface( font[ 1 ] );
 }
 
 int term_knows( char c ) {
-    int j;
-    for( j = 0; j < sizeof( font_chars ) - 1; j++ ) {
-      if( font_chars[ j ] == c ) return( 1 );
-    }
-    return( 0 );
+  return( glyph[ ( unsigned char )c ] != 0xFF );
 }
\ No newline at end of file
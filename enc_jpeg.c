@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+#include <jpeglib.h>
+#include "oswrap.h"
+#include "robocortex.h"
+#include "encoder.h"
+
+// Intra-only JPEG backend for LAN use. Frames are cut into horizontal slices of whole macroblock
+// rows, each an independent JPEG that fits one packet, compressed in parallel. There is no
+// reference to lose, so a lost packet costs one stripe of one frame
+
+#define JPEG_WORKERS_MAX       8 // Compression threads per encoder
+#define JPEG_PIXELS        24576 // Pixels per slice, keeps a slice within a packet at high quality
+#define JPEG_CRF              20 // Crf at which quality is used as configured
+#define JPEG_CRF_STEP          3 // Quality lost per crf step above JPEG_CRF
+#define JPEG_REFIT            15 // Quality lost per attempt when a slice does not fit its packet
+#define JPEG_QUALITY_MIN      10
+#define JPEG_ADJUST_MIN      -40 // Lowest quality correction for frames over the rate budget
+
+#define JPEG_HEADER ( 4 + sizeof( jpeg_slice_t ) )
+#define JPEG_SLOT   ( ENC_PACKET_MAX - ENC_HEADROOM )
+
+typedef struct jpeg_inst_s jpeg_inst_t;
+
+// Compression thread
+typedef struct {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  jpeg_inst_t       *j;
+  SDL_Thread        *thread;
+  SDL_sem           *go, *done;
+  int                index;
+} worker_t;
+
+// Encoder instance
+struct jpeg_inst_s {
+  worker_t           workers[ JPEG_WORKERS_MAX ];
+  int                worker_count;
+  volatile int       quit;
+  enc_param_t        param;
+  char              *buffer;           // One packet sized slot per slice
+  int                sizes[ ENC_PACKETS_MAX ];
+  int                refits[ ENC_PACKETS_MAX ];
+  // Frame being compressed, shared with the workers
+  uint8_t           *plane[ 3 ];
+  int                stride[ 3 ];
+  int                rows, slices;     // Luma rows per slice, slices per frame
+  int                quality;
+  uint32_t           frame;
+  int                adjust;           // Quality correction, follows the rate budget
+  unsigned int       stat_refits;
+};
+
+static      encoder_t  backend;               // Backend descriptor
+
+// Compresses one slice into its slot, at lower quality until it fits
+static void slice_encode( worker_t *w, int n ) {
+  struct jpeg_compress_struct *c = &w->cinfo;
+  jpeg_inst_t *j = w->j;
+  JSAMPROW y[ 16 ], cb[ 8 ], cr[ 8 ];
+  JSAMPARRAY data[ 3 ] = { y, cb, cr };
+  jpeg_slice_t s;
+  unsigned char *out;
+  unsigned long size;
+  char *slot = j->buffer + n * JPEG_SLOT;
+  int q = j->quality, top = n * j->rows, h = j->param.h, r, i;
+
+  s.frame  = j->frame;
+  s.w      = j->param.w;
+  s.h      = h;
+  s.y      = top;
+  s.slice  = n;
+  s.slices = j->slices;
+  memcpy( slot, "JPEG", 4 );
+  memcpy( slot + 4, &s, sizeof( jpeg_slice_t ) );
+  c->image_height = MIN( j->rows, h - top );
+  j->refits[ n ] = 0;
+
+  for( ;; ) {
+    out = ( unsigned char* )slot + JPEG_HEADER;
+    size = JPEG_SLOT - JPEG_HEADER;
+    jpeg_mem_dest( c, &out, &size );
+    jpeg_set_quality( c, q, TRUE );
+    jpeg_start_compress( c, TRUE );
+    for( r = 0; r < c->image_height; r += 16 ) {
+      // Rows past the bottom of the frame repeat the last one
+      for( i = 0; i < 16; i++ ) y[ i ] = j->plane[ 0 ] + MIN( top + r + i, h - 1 ) * j->stride[ 0 ];
+      for( i = 0; i < 8; i++ ) {
+        cb[ i ] = j->plane[ 1 ] + MIN( ( top + r ) / 2 + i, ( h - 1 ) / 2 ) * j->stride[ 1 ];
+        cr[ i ] = j->plane[ 2 ] + MIN( ( top + r ) / 2 + i, ( h - 1 ) / 2 ) * j->stride[ 2 ];
+      }
+      jpeg_write_raw_data( c, data, 16 );
+    }
+    jpeg_finish_compress( c );
+    // Output outgrew the slot and was moved to the heap
+    if( out == ( unsigned char* )slot + JPEG_HEADER ) break;
+    free( out );
+    j->refits[ n ]++;
+    if( q == JPEG_QUALITY_MIN ) {
+      size = 0;
+      break;
+    }
+    q = MAX( q - JPEG_REFIT, JPEG_QUALITY_MIN );
+  }
+  j->sizes[ n ] = ( size ? JPEG_HEADER + size : 0 );
+}
+
+static int worker_thread( void *p_worker ) {
+  worker_t *w = p_worker;
+  int n;
+  for( ;; ) {
+    SDL_SemWait( w->go );
+    if( w->j->quit ) break;
+    for( n = w->index; n < w->j->slices; n += w->j->worker_count ) slice_encode( w, n );
+    SDL_SemPost( w->done );
+  }
+  return( 0 );
+}
+
+// Quality follows crf, on top of the configured quality at JPEG_CRF
+static void quality_set( jpeg_inst_t *j ) {
+  j->quality = j->param.quality - ( j->param.crf - JPEG_CRF ) * JPEG_CRF_STEP + j->adjust;
+  j->quality = MIN( MAX( j->quality, JPEG_QUALITY_MIN ), 100 );
+}
+
+static void enc_reconfig( void *h, enc_param_t *p ) {
+  jpeg_inst_t *j = h;
+  int n;
+  j->param.rate   = p->rate;
+  j->param.crf    = p->crf;
+  j->param.effort = p->effort;
+  quality_set( j );
+  // Faster DCT on the faster effort levels
+  for( n = 0; n < j->worker_count; n++ ) j->workers[ n ].cinfo.dct_method = ( p->effort >= ENC_EFFORTS - 3 ? JDCT_IFAST : JDCT_ISLOW );
+}
+
+static void enc_close( void *h ) {
+  jpeg_inst_t *j = h;
+  int n;
+  if( j == NULL ) return;
+  j->quit = 1;
+  for( n = 0; n < j->worker_count; n++ ) {
+    SDL_SemPost( j->workers[ n ].go );
+    SDL_WaitThread( j->workers[ n ].thread, NULL );
+    SDL_DestroySemaphore( j->workers[ n ].go );
+    SDL_DestroySemaphore( j->workers[ n ].done );
+    jpeg_destroy_compress( &j->workers[ n ].cinfo );
+  }
+  if( j->stat_refits ) printf( "RoboCortex [info]: JPEG slices compressed again to fit a packet: %u\n", j->stat_refits );
+  free( j->buffer );
+  free( j );
+}
+
+static void *enc_open( enc_param_t *p ) {
+  jpeg_inst_t *j;
+  worker_t *w;
+  int n;
+
+  j = calloc( 1, sizeof( jpeg_inst_t ) );
+  if( j == NULL ) return( NULL );
+  memcpy( &j->param, p, sizeof( enc_param_t ) );
+  j->frame = SDL_GetTicks(); // Frame numbers of a reopened encoder do not repeat recent ones
+  // Whole macroblock rows, few enough slices to fit a frame
+  j->rows = ( JPEG_PIXELS / p->w ) & ~15;
+  n = ( ( p->h + ENC_PACKETS_MAX - 1 ) / ENC_PACKETS_MAX + 15 ) & ~15;
+  j->rows = MAX( j->rows, n );
+  j->rows = MAX( j->rows, 16 );
+  j->slices = ( p->h + j->rows - 1 ) / j->rows;
+  j->buffer = malloc( j->slices * JPEG_SLOT );
+  if( j->buffer == NULL ) {
+    free( j );
+    return( NULL );
+  }
+
+  j->worker_count = MIN( MAX( sys_cpu_count(), 1 ), MIN( JPEG_WORKERS_MAX, j->slices ) );
+  for( n = 0; n < j->worker_count; n++ ) {
+    w = &j->workers[ n ];
+    w->cinfo.err = jpeg_std_error( &w->jerr );
+    jpeg_create_compress( &w->cinfo );
+    w->cinfo.image_width = p->w;
+    w->cinfo.image_height = j->rows;
+    w->cinfo.input_components = 3;
+    w->cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults( &w->cinfo );
+    jpeg_set_colorspace( &w->cinfo, JCS_YCbCr );
+    // 4:2:0 straight from the I420 planes
+    w->cinfo.raw_data_in = TRUE;
+    w->cinfo.comp_info[ 0 ].h_samp_factor = 2;
+    w->cinfo.comp_info[ 0 ].v_samp_factor = 2;
+    w->cinfo.comp_info[ 1 ].h_samp_factor = 1;
+    w->cinfo.comp_info[ 1 ].v_samp_factor = 1;
+    w->cinfo.comp_info[ 2 ].h_samp_factor = 1;
+    w->cinfo.comp_info[ 2 ].v_samp_factor = 1;
+    w->j = j;
+    w->index = n;
+    w->go = SDL_CreateSemaphore( 0 );
+    w->done = SDL_CreateSemaphore( 0 );
+    w->thread = SDL_CreateThread( worker_thread, w );
+  }
+  enc_reconfig( j, p );
+  printf( "RoboCortex [info]: JPEG encoder, %i slices of %i rows on %i threads\n", j->slices, j->rows, j->worker_count );
+  return( j );
+}
+
+static int enc_encode( void *h, uint8_t *plane[ 3 ], int stride[ 3 ], float *quant_offsets, enc_frame_t *out ) {
+  jpeg_inst_t *j = h;
+  int n, size = 0, budget;
+
+  memcpy( j->plane, plane, sizeof( j->plane ) );
+  memcpy( j->stride, stride, sizeof( j->stride ) );
+  j->frame++;
+
+  // Compress slices in parallel
+  for( n = 0; n < j->worker_count; n++ ) SDL_SemPost( j->workers[ n ].go );
+  for( n = 0; n < j->worker_count; n++ ) SDL_SemWait( j->workers[ n ].done );
+
+  // Pack slices back to back, slices that did not fit at all are left out
+  out->count = 0;
+  for( n = 0; n < j->slices; n++ ) {
+    j->stat_refits += j->refits[ n ];
+    if( !j->sizes[ n ] ) continue;
+    memmove( j->buffer + size, j->buffer + n * JPEG_SLOT, j->sizes[ n ] );
+    out->sizes[ out->count++ ] = j->sizes[ n ];
+    size += j->sizes[ n ];
+  }
+  out->data = j->buffer;
+  out->size = size;
+  out->qp = j->quality;
+  out->type = 'I';
+  out->key = 1;
+
+  // No rate control in JPEG, pull quality down while frames exceed the per-frame budget
+  budget = j->param.rate * 1000 / 8 / j->param.fps;
+  if( size > budget && j->adjust > JPEG_ADJUST_MIN ) j->adjust -= 2;
+  else if( size < budget * 3 / 4 && j->adjust < 0 ) j->adjust++;
+  quality_set( j );
+  return( 0 );
+}
+
+// Every frame is a full refresh
+static void enc_refresh( void *h ) {
+}
+
+// Sets up the backend descriptor
+encoder_t *enc_jpeg_open() {
+  backend.name       = "jpeg";
+  backend.ident      = ENC_JPEG;
+  backend.full_range = 1;
+  backend.open       = enc_open;
+  backend.close      = enc_close;
+  backend.reconfig   = enc_reconfig;
+  backend.encode     = enc_encode;
+  backend.refresh    = enc_refresh;
+  return( &backend );
+}
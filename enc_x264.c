@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <SDL/SDL.h>
+#include <x264.h>
+#include "oswrap.h"
+#include "robocortex.h"
+#include "encoder.h"
+
+// H.264 backend, single-frame VBV with intra-refresh through x264
+
+// Encoder instance
+typedef struct {
+  x264_t            *encoder;
+  x264_param_t       param;
+  x264_picture_t     pic_in, pic_out;
+  char               buffer[ 65536 ];  // Frame NALs, back to back
+} x264_inst_t;
+
+static      encoder_t  backend;               // Backend descriptor
+
+// Presets the effort levels are named after
+static     const char *presets[ ENC_EFFORTS ] = { "veryslow", "slower", "slow", "medium", "fast", "faster", "veryfast", "superfast", "ultrafast" };
+
+// Copies analysis settings of the preset for effort, these may change on a running encoder
+static void effort( x264_param_t *param, int level ) {
+  x264_param_t p;
+  x264_param_default_preset( &p, presets[ MIN( MAX( level, 0 ), ENC_EFFORTS - 1 ) ], "zerolatency" );
+  param->analyse.intra              = p.analyse.intra;
+  param->analyse.inter              = p.analyse.inter;
+  param->analyse.b_transform_8x8    = p.analyse.b_transform_8x8;
+  param->analyse.i_me_method        = p.analyse.i_me_method;
+  param->analyse.i_me_range         = p.analyse.i_me_range;
+  param->analyse.i_subpel_refine    = p.analyse.i_subpel_refine;
+  param->analyse.b_mixed_references = p.analyse.b_mixed_references;
+  param->analyse.i_trellis          = p.analyse.i_trellis;
+  param->analyse.b_fast_pskip       = p.analyse.b_fast_pskip;
+}
+
+static void *enc_open( enc_param_t *p ) {
+  x264_inst_t *x = calloc( 1, sizeof( x264_inst_t ) );
+  if( x == NULL ) return( NULL );
+  x264_param_default_preset( &x->param, presets[ MIN( MAX( p->effort, 0 ), ENC_EFFORTS - 1 ) ], "zerolatency" );
+
+  x->param.i_width   = p->w;
+  x->param.i_height  = p->h;
+  x->param.i_fps_num = p->fps;
+
+  // Settings as explained by http://x264dev.multimedia.cx/archives/249
+
+  x264_param_parse( &x->param, "slice-max-size", "8192" ); /* Practically disables slicing.
+  																											   Slicing is the splitting of frame data into
+  																											   a series of NALs, each having a maximum size
+  																											   so that they can be transported over
+  																											   interfaces that has a limited packet size/MTU */
+
+  x->param.rc.i_vbv_max_bitrate = p->rate;              /* Set VBV mode and max bitrate (kbps).
+  																												 VBV is variable bitrate, which means the rate
+  																												 will vary depending on how complex the scene
+  																												 is at the moment - detail, motion, etc. */
+
+  x->param.rc.i_vbv_buffer_size = MAX( p->rate * 3 / 50, 1 ); /* Enable single-frame VBV.
+  																												 This will cap all frames so that they only
+  																												 contain a maximum amount of information,
+  																												 which in turn means that each frame can
+  																												 always be sent in one packet and packetss
+  																												 will be of a much more unform size. */
+
+  x->param.rc.i_rc_method = X264_RC_CRF;
+  x->param.rc.f_rf_constant = p->crf;                   /* Constant Rate Factor.
+  																												 Tells VBV to target a specific quality. */
+
+  x264_param_parse( &x->param, "intra-refresh", NULL );		/* Enable intra-refresh.
+  																												 Intra-refresh allows single-frame VBV to
+  																												 work well by disabling I-frames and
+  																												 replacing them with a periodic refresh
+  																												 that scans across the image, refreshing
+  																												 only a smaller portion each frame.
+  																												 I-frames can be seen as a full-frame
+  																												 refresh that needs no other data to decode
+  																												 the picture, and takes a lot more space
+  																												 than P/B (differential) frames. */
+
+  x->param.b_annexb = 1;																		/* Use Annex-B packaging.
+  																											   This appends a marker at the start of
+  																											   each NAL unit. */
+
+  x->param.i_frame_reference = 1;													/* Needed for intra-refresh. */
+
+  if( p->slices > 1 ) x->param.i_slice_count = p->slices; /* Split each frame into independent slices.
+  																											   Lets slice-threaded decoders spread a
+  																											   frame across several cores, at a small
+  																											   cost in compression. */
+
+  x264_param_apply_profile( &x->param, "high" );						/* Apply HIGH profile.
+  																												 Allows for better compression, but needs
+  																												 to be supported by the decoder. We use
+  																												 FFMPEG, which does support this profile. */
+
+  x->encoder = x264_encoder_open( &x->param );
+  if( x->encoder == NULL ) {
+    free( x );
+    return( NULL );
+  }
+  x264_picture_init( &x->pic_in );
+  x->pic_in.img.i_csp = X264_CSP_I420;
+  x->pic_in.img.i_plane = 3;
+  return( x );
+}
+
+static void enc_close( void *h ) {
+  x264_inst_t *x = h;
+  if( x == NULL ) return;
+  x264_encoder_close( x->encoder );
+  free( x );
+}
+
+static void enc_reconfig( void *h, enc_param_t *p ) {
+  x264_inst_t *x = h;
+  x->param.rc.i_vbv_max_bitrate = p->rate;
+  x->param.rc.i_vbv_buffer_size = MAX( p->rate * 3 / 50, 1 ); // Keeps single-frame VBV, 30 kbit at 500 kbps
+  x->param.rc.f_rf_constant = p->crf;
+  effort( &x->param, p->effort );
+  x264_encoder_reconfig( x->encoder, &x->param );
+}
+
+static int enc_encode( void *h, uint8_t *plane[ 3 ], int stride[ 3 ], float *quant_offsets, enc_frame_t *out ) {
+  x264_inst_t *x = h;
+  x264_nal_t *nals;
+  int i_nals, n, size = 0;
+  for( n = 0; n < 3; n++ ) {
+    x->pic_in.img.plane[ n ] = plane[ n ];
+    x->pic_in.img.i_stride[ n ] = stride[ n ];
+  }
+  x->pic_in.prop.quant_offsets = quant_offsets;
+  if( x264_encoder_encode( x->encoder, &nals, &i_nals, &x->pic_in, &x->pic_out ) < 0 ) return( -1 );
+
+  // Concatenate NALs into one packet
+  for( n = 0; n < i_nals; n++ ) {
+    if( size + nals[ n ].i_payload > sizeof( x->buffer ) ) break;
+    memcpy( x->buffer + size, nals[ n ].p_payload, nals[ n ].i_payload );
+    size += nals[ n ].i_payload;
+  }
+  out->data = x->buffer;
+  out->size = size;
+  out->count = ( size ? 1 : 0 );
+  out->sizes[ 0 ] = size;
+  out->qp = x->pic_out.i_qpplus1 - 1;
+  out->type = IS_X264_TYPE_I( x->pic_out.i_type ) ? 'I' : x->pic_out.i_type == X264_TYPE_P ? 'P' : 'B';
+  out->key = x->pic_out.b_keyframe; // Also set where an intra-refresh wave starts
+  return( 0 );
+}
+
+static void enc_refresh( void *h ) {
+  x264_encoder_intra_refresh( ( ( x264_inst_t* )h )->encoder );
+}
+
+// Sets up the backend descriptor
+encoder_t *enc_x264_open() {
+  backend.name       = "x264";
+  backend.ident      = ENC_H264;
+  backend.full_range = 0;
+  backend.open       = enc_open;
+  backend.close      = enc_close;
+  backend.reconfig   = enc_reconfig;
+  backend.encode     = enc_encode;
+  backend.refresh    = enc_refresh;
+  return( &backend );
+}
@@ -0,0 +1,14 @@
+#ifndef _CLI_DECODE_H_
+#define _CLI_DECODE_H_
+
+typedef struct decoder_s decoder_t;
+
+decoder_t   *decoder_open  ( int w, int h, SDL_PixelFormat *format, int latency, SDL_sem *wake, int interpolate );
+void         decoder_close ( decoder_t *dec );
+void         decoder_push  ( decoder_t *dec, char *data, int size );
+SDL_Surface *decoder_latest( decoder_t *dec, int *fresh );
+Uint32       decoder_arrival( decoder_t *dec );
+void         decoder_counters( decoder_t *dec, unsigned int *decoded, unsigned int *dropped, int *time_avg );
+int          decoder_codecs( decoder_t *dec );
+
+#endif
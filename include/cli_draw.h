@@ -0,0 +1,8 @@
+#ifndef _CLI_DRAW_H_
+#define _CLI_DRAW_H_
+
+void draw_lines   ( SDL_Surface *s, line_t *lines, int count, uint32_t color );
+void draw_polyline( SDL_Surface *s, point_t *points, int count, uint32_t color );
+void draw_scaled  ( SDL_Surface *s, SDL_Surface *src, SDL_Rect *dst );
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _CLI_HUD_H_
+#define _CLI_HUD_H_
+
+// HUD rows, each with text and sparkline
+enum hud_row_e {
+  HUD_RATE,
+  HUD_FRAMES,
+  HUD_DECODE,
+  HUD_LATENCY,
+  HUD_TRUST,
+  HUD_RTT,
+  HUD_LOSS,
+  HUD_ENCODER,
+  HUD_TARGET,
+  HUD_ROWS
+};
+
+void hud_set ( int row, float value, char *text );
+void hud_next();
+void hud_show( int show );
+void hud_draw( SDL_Surface *s );
+void hud_rect( SDL_Rect *r );
+
+#endif
@@ -1,6 +1,7 @@
 void term_init( SDL_Surface *screen );
 void term_clear();
-void term_draw();
+int  term_draw( SDL_Rect *rects, int max );
+void term_blit();
 void term_write( unsigned char x, unsigned char y, char *s, unsigned char f );
 void term_white( unsigned char x, unsigned char y, unsigned char c );
 void term_cins( unsigned char x, unsigned char y );
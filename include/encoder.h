@@ -0,0 +1,51 @@
+#ifndef _ENCODER_H_
+#define _ENCODER_H_
+
+#define ENC_PACKET_MAX      8192 // Max stream packet size, matches client receive buffers
+#define ENC_PACKETS_MAX       64 // Max packets per frame
+#define ENC_EFFORTS            9 // Effort levels, named after x264 presets veryslow to ultrafast
+#define ENC_HEADROOM          64 // Bytes left in packets split by the encoder, for STRM (22) and MPTH (32) headers
+
+// Encoder settings, rate, crf and effort may be changed on a running encoder
+typedef struct {
+  int                w, h;             // I420 picture size
+  int                fps;
+  int                slices;           // Slices per frame, 0 for one
+  int                rate;             // Max bitrate (kbps)
+  int                crf;              // Quality, on the x264 constant rate factor scale
+  int                effort;           // 0 (veryslow) to ENC_EFFORTS - 1 (ultrafast)
+  int                quality;          // Intra-only quality (1-100) at the default crf
+} enc_param_t;
+
+// Encoded frame, ready to send packet by packet
+typedef struct {
+  char              *data;             // Packets, back to back
+  int                size;
+  int                count;            // Number of packets
+  int                sizes[ ENC_PACKETS_MAX ];
+  int                qp;               // Statistics
+  char               type;             // 'I', 'P' or 'B'
+  int                key;              // Decoding can start at this frame (IDR or recovery point)
+} enc_frame_t;
+
+// Encoder backend, open returns an instance handle passed to the other calls
+typedef struct {
+  char              *name;             // Name in configuration
+  int                ident;            // encoder_e
+  int                full_range;       // Takes full range YUV (JPEG) instead of video range
+  // Opens an encoder, return NULL on failure
+  void *( *open    )( enc_param_t *param );
+  void ( *close    )( void *h );
+  // Applies rate, crf and effort of param to the running encoder
+  void ( *reconfig )( void *h, enc_param_t *param );
+  // Encodes an I420 picture, quant_offsets holds a QP offset per macroblock or is NULL
+  // Return 0 on success, out is valid until the next call
+  int  ( *encode   )( void *h, uint8_t *plane[ 3 ], int stride[ 3 ], float *quant_offsets, enc_frame_t *out );
+  // Next frame refreshes the whole picture
+  void ( *refresh  )( void *h );
+} encoder_t;
+
+encoder_t *enc_x264_open();
+encoder_t *enc_jpeg_open();
+
+#endif
@@ -61,6 +61,11 @@ int      net_send     ( NET_SOCK *h_sock, void* p_buf, int size, NET_ADDR *p_add
 int      net_bind     ( NET_SOCK *h_sock, NET_ADDR *p_addr );
 uint32_t net_dtoa     ( char* dotted_ip );
 
+// System API
+int      sys_random   ( void *p_buf, int size );
+int      sys_cpu_count();
+uint64_t sys_time_us  ();
+
 // Thread API
 //int  thr_create( THR_HANDLE *p_receiver_h, THR_ID *p_receiver_id, thr_func p_func );
 //void thr_sleep ( int ms );
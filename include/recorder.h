@@ -0,0 +1,38 @@
+#ifndef _RECORDER_H_
+#define _RECORDER_H_
+
+#define REC_INDEX_VERSION      1
+#define REC_KEY             0x01 // Index flag, decoding can start at this frame
+
+// Segment index file header, followed by rec_index_t entries in stream order
+// Entries have a fixed size, so a player can mmap the file and binary search it by time
+typedef struct {
+  char               magic[ 4 ];       // "RIDX"
+  uint32_t           version;          // REC_INDEX_VERSION
+  uint32_t           entry_size;       // sizeof( rec_index_t )
+  uint32_t           ident;            // Encoding of the segment, encoder_e
+  uint64_t           start;            // Wall clock time (s since 1970) the recording started
+} rec_index_hdr_t;
+
+typedef struct {
+  uint64_t           offset;           // Frame offset in the segment
+  uint32_t           time;             // Since the recording started (ms)
+  uint32_t           size;
+  uint32_t           flags;            // REC_KEY
+  uint32_t           reserved;
+} rec_index_t;
+
+// Starts recording to path-NNNN.h264/.jpeg with a .idx beside each segment
+// Segments roll at a refresh point past max_mb megabytes or max_s seconds, 0 for no limit
+// Return 0 on success
+int  recorder_open ( const char *path, int max_mb, int max_s );
+void recorder_close();
+// Queues an encoded frame, never blocks: frames are dropped up to the next refresh point
+// while the disk can not keep up
+void recorder_push ( const char *data, int size, int key, int ident );
+// Return 1 once when a segment is due to roll and waits on a refresh point
+int  recorder_due  ();
+// Return index of the last refresh point at or before time in a mapped index, -1 if none
+int  recorder_seek ( const rec_index_t *index, int count, uint32_t time );
+
+#endif
@@ -2,7 +2,7 @@
 #define _ROBOCORTEX_H_
 #include "SDL/SDL_video.h"
 
-#define CORTEX_VERSION       3 // Current protocol revision
+#define CORTEX_VERSION      15 // Current protocol revision
 #define CFG_TOKEN_MAX_SIZE  32 // Maxmimum length of a token value
 #define CFG_VALUE_MAX_SIZE 256 // Maxmimum length of a configuration value
 
@@ -18,13 +18,64 @@ enum kb_bitmask_e {
   KB_DOWN  = 8
 };
 
+// Stream encodings, offered by the client in HELO as a bitmask
+enum encoder_e {
+  ENC_H264 = 1,
+  ENC_JPEG = 2
+};
+
+// First HELO is padded with a zero cookie to the size of the COOK reply, so challenges do not amplify
+#define HELO_MIN          12
+
+// HELO flags, follow the encodings offered
+#define HELO_SPECTATOR    0x01 // Watch only, never queued for control
+#define HELO_REDUCED      0x02 // Start on the reduced simulcast layer, if the server has one
+
+// Session token, issued in HELO and carried in CTRL/TIME
+// The 64-bit tag is split in words so the layout has no padding on any ABI
+typedef struct {
+  uint32_t index;
+  uint32_t tag[ 2 ];
+} session_t;
+
 // DISP packet
 typedef struct {
   unsigned char trust_srv;
   unsigned char trust_cli;
+  unsigned short ack; // Sequence of last CTRL packet applied before capturing this frame
+  unsigned short echo; // Sequence of last CTRL packet received
+  unsigned short echo_delay; // Time (ms) between receiving echo and sending this packet
+  unsigned char qp; // Encoder statistics for this frame
+  unsigned char type; // 'I', 'P' or 'B'
+  int size;
+  uint32_t frame; // Frame number, gaps are lost packets
+  unsigned short rate; // Target bitrate (kbps) of the rate control
+  unsigned short stream_w; // Encoded size, steps down the resolution ladder under congestion
+  unsigned short stream_h;
+  unsigned char still; // Scene is static, frames arrive at a lower rate
   int timer;
 } disp_data_t;
 
+// JPEG packet, follows "JPEG", an independent JPEG of rows y and on of a frame
+typedef struct {
+  uint32_t frame; // Frame number, as in DATA
+  unsigned short w, h; // Frame size
+  unsigned short y; // First row of slice
+  unsigned char slice; // Slice index, frames are complete after the last one
+  unsigned char slices;
+} jpeg_slice_t;
+
+// STRM packet, follows "STRM", a packet of one capture source's own stream followed by the
+// payload (H.264 or "JPEG" slice), composed by the client at the destination rectangle
+typedef struct {
+  unsigned char id; // Stream, index of the capture source
+  unsigned char z; // Composition order, higher on top
+  unsigned short canvas_w, canvas_h; // Composition size, destination is relative to it
+  short x, y; // Destination rectangle
+  unsigned short w, h;
+  unsigned short enc_w, enc_h; // Encoded size
+} strm_data_t;
+
 // Control data
 typedef struct {
   long mx;
@@ -34,8 +85,14 @@ typedef struct {
 
 // DATA packet
 typedef struct {
+  session_t session;
   unsigned char trust_srv;
   unsigned char trust_cli;
+  unsigned short seq; // Incremented for every CTRL packet
+  uint32_t fb_frame; // Rate control feedback: newest frame received in DATA
+  uint32_t fb_time; // Client time (ms) at which fb_frame arrived
+  unsigned short fb_recv; // DATA packets received, wrapping
+  unsigned short fb_lost; // DATA packets missing from frame number gaps, wrapping
   ctrl_t ctrl;
 } ctrl_data_t;
 
@@ -0,0 +1,12 @@
+#ifndef _RTP_H_
+#define _RTP_H_
+
+// Starts RTP/H.264 output (RFC 6184) to dest, "address:port"
+// An SDP describing the stream is written to sdp once parameter sets have been seen, if not NULL
+// Return 0 on success
+int  rtp_open ( const char *dest, const char *sdp );
+void rtp_close();
+// Packetises an Annex-B access unit and sends it, time in ms
+void rtp_send ( const char *data, int size, uint32_t time );
+
+#endif
@@ -74,11 +74,38 @@ int net_init() {
   return( 0 );
 }
 
+// Fills buffer with cryptographically secure random bytes, return 0 on success else < 0
+int sys_random( void *p_buf, int size ) {
+  HCRYPTPROV h_prov;
+  int ret = -1;
+  if( CryptAcquireContext( &h_prov, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT ) ) {
+    if( CryptGenRandom( h_prov, size, ( BYTE* )p_buf ) ) ret = 0;
+    CryptReleaseContext( h_prov, 0 );
+  }
+  return( ret );
+}
+
+// Return number of online processors
+int sys_cpu_count() {
+  SYSTEM_INFO info;
+  GetSystemInfo( &info );
+  return( MAX( ( int )info.dwNumberOfProcessors, 1 ) );
+}
+
+// Return monotonic time in microseconds
+uint64_t sys_time_us() {
+  LARGE_INTEGER freq, now;
+  QueryPerformanceFrequency( &freq );
+  QueryPerformanceCounter( &now );
+  return( ( uint64_t )( now.QuadPart / freq.QuadPart ) * 1000000 + ( uint64_t )( now.QuadPart % freq.QuadPart ) * 1000000 / freq.QuadPart );
+}
+
 #else
 
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 
 
 int h_serial;
@@ -210,6 +237,29 @@ int serial_close() {
 int net_init() {
 }
 
+// Fills buffer with cryptographically secure random bytes, return 0 on success else < 0
+int sys_random( void *p_buf, int size ) {
+  int h_rand, ret;
+  h_rand = open( "/dev/urandom", O_RDONLY );
+  if( h_rand < 0 ) return( -1 );
+  ret = read( h_rand, p_buf, size );
+  close( h_rand );
+  return( ret == size ? 0 : -1 );
+}
+
+// Return number of online processors
+int sys_cpu_count() {
+  long ret = sysconf( _SC_NPROCESSORS_ONLN );
+  return( ret > 0 ? ( int )ret : 1 );
+}
+
+// Return monotonic time in microseconds
+uint64_t sys_time_us() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return( ( uint64_t )ts.tv_sec * 1000000 + ts.tv_nsec / 1000 );
+}
+
 #endif
 
 int net_sock( NET_SOCK *h_sock ) {
@@ -12,6 +12,15 @@ enum event_e {
   E_MOVE
 };
 
+// Line and point, for batched drawing
+typedef struct {
+  short x0, y0, x1, y1;
+} line_t;
+
+typedef struct {
+  short x, y;
+} point_t;
+
 typedef struct {
   // Requests a parameter from the configuration file
   int      ( *cfg_read     )( char *value, char *token );
@@ -55,6 +64,10 @@ typedef struct {
   void ( *draw_box         )( unsigned char x, unsigned char y, unsigned char w, unsigned char h, SDL_Surface *s );
   // Draws wu-lines
   void ( *draw_wuline      )( int x0, int y0, int x1, int y1, uint32_t color );
+  // Draws a batch of wu-lines, much faster than one draw_wuline per line
+  void ( *draw_wulines     )( line_t *lines, int count, uint32_t color );
+  // Draws connected wu-lines through count points
+  void ( *draw_polyline    )( point_t *points, int count, uint32_t color );
   // Draws message
   void ( *draw_message     )( char *message );
   // Process a received packet
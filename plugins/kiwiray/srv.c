@@ -1,13 +1,17 @@
 #include "srv.h" // This is a server plugin
 
 #define ROT_DZN                3        // Dead-zone
-#define ROT_ACC                6        // Acceleration
+#define ROT_ACC                3        // Acceleration
 #define ROT_DMP                6        // Dampening
-#define ROT_SEN              0.5        // Sensitivity
+#define ROT_SEN             0.25        // Sensitivity
 #define ROT_MAX             1000        // Max accumulated rotation
 
-#define MOV_ACC                2        // Acceleration
-#define MOV_BRK                5        // Breaking
+#define MOV_ACC                1        // Acceleration
+#define MOV_BRK                3        // Breaking
+
+// Motion is stepped by the serial thread, constants above are per step and
+// halved from the old per-frame values at 25 fps (braking rounded up to 3)
+#define DRIVE_STEP            20        // Step interval (ms)
 
 #define CAM_SEN              0.3        // Sensitivity
 
@@ -31,6 +35,9 @@ static          char   drive_y;         // Move
 static          char   drive_r;         // Turn
 static unsigned  int   drive_p;         // Pitch
 static          long   integrate_r;     // Rotational(turn) integration
+static volatile long   pending_r;       // Turn input not yet integrated
+static volatile  int   drive_kb;        // Movement keys, as last received
+static volatile  int   drive_stop;      // Stop requested, applied by the next step
 
 static          void  *h_thread;        // Communications thread handle
 static           int   connected;       // Successfully connected
@@ -79,6 +86,58 @@ const unsigned  char   emotidata[ 4 ][ 24 ] = {
   }
 };
 
+// Steps motion towards current input, called at a fixed rate from commthread
+static void drive_step() {
+  int kb;
+
+  // Motion is only written here, a stop from another thread waits for the step
+  if( __sync_lock_test_and_set( &drive_stop, 0 ) ) {
+    __sync_lock_test_and_set( &pending_r, 0 );
+    drive_x = 0;
+    drive_y = 0;
+    drive_r = 0;
+    integrate_r = 0;
+    return;
+  }
+  kb = drive_kb;
+
+  // Handle movement X and Y
+  if( kb & KB_LEFT  ) {
+    drive_x = ( drive_x > -( 127 - MOV_ACC ) ? drive_x - MOV_ACC : -127 );
+  } else if( drive_x < 0 ) {
+    drive_x = ( drive_x < -MOV_BRK ? drive_x + MOV_BRK : 0 );
+  }
+  if( kb & KB_RIGHT ) {
+    drive_x = ( drive_x <  ( 127 - MOV_ACC ) ? drive_x + MOV_ACC :  127 );
+  } else if( drive_x > 0 ) {
+    drive_x = ( drive_x >  MOV_BRK ? drive_x - MOV_BRK : 0 );
+  }
+  if( kb & KB_UP    ) {
+    drive_y = ( drive_y > -( 127 - MOV_ACC ) ? drive_y - MOV_ACC : -127 );
+  } else if( drive_y < 0 ) {
+    drive_y = ( drive_y < -MOV_BRK ? drive_y + MOV_BRK : 0 );
+  }
+  if( kb & KB_DOWN  ) {
+    drive_y = ( drive_y <  ( 127 - MOV_ACC ) ? drive_y + MOV_ACC :  127 );
+  } else if( drive_y > 0 ) {
+    drive_y = ( drive_y >  MOV_BRK ? drive_y - MOV_BRK : 0 );
+  }
+
+  // Handle movement R
+  integrate_r -= ( drive_r * ROT_SEN );
+  integrate_r += __sync_lock_test_and_set( &pending_r, 0 );
+  integrate_r = MAX( MIN( integrate_r, ROT_MAX ), -ROT_MAX );
+  if( integrate_r > ROT_DZN ) {
+    drive_r = ( drive_r <  ( 127 - ROT_ACC ) ? drive_r + ROT_ACC :  127 );
+    if( drive_r > integrate_r / ROT_DMP + ROT_DZN ) drive_r = integrate_r / ROT_DMP + ROT_DZN;
+  } else if( integrate_r < -ROT_DZN ) {
+    drive_r = ( drive_r > -( 127 - ROT_ACC ) ? drive_r - ROT_ACC : -127 );
+    if( drive_r < integrate_r / ROT_DMP - ROT_DZN ) drive_r = integrate_r / ROT_DMP - ROT_DZN;
+  } else {
+    drive_r = 0;
+  }
+}
+
 // Thread: manage KiwiRay serial communications
 static int commthread() {
   int b_working = 0;
@@ -107,6 +166,7 @@ static int commthread() {
       b_working = ( serial_open( serdev ) == 0 );
       if( b_working ) b_working = serial_params( "115200,n,8,1" );
     }
+    drive_step();
     p_pkt[ 1 ] = 0x00;               // Drive XYZ
     p_pkt[ 2 ] = -drive_x;           // Strafe X
     p_pkt[ 3 ] = -drive_y;           // Move   Y
@@ -121,7 +181,7 @@ static int commthread() {
       if( b_working) b_working = ( serial_write( p_pkt, 27 ) == 27 );
       emotilast = emoticon;
     }
-    host->thread_delay( 20 ); // roughly 50 times second
+    host->thread_delay( DRIVE_STEP ); // roughly 50 times second
   }
   return( 0 );
 }
@@ -160,70 +220,39 @@ static void process_data( void* p_data, unsigned char size ) {
   }
 }
 
-// Tick: updates motion and timeouts
-static void tick() {
-	int temp;
-
-	if( !connected ) return; // Important - host->ctrl/diff not valid!
-	
-	// Emoticon timeout
-	if( emoticon_timeout ) {
-	  if( --emoticon_timeout == 0 ) emoticon = EMO_CONNECTED;
-	}
+// Control: called as soon as control data arrives, motion itself is stepped by commthread
+static void control( ctrl_t *ctrl, ctrl_t *diff ) {
+  drive_kb = ctrl->kb;
 
-  // Handle movement X and Y
-  if( host->ctrl->kb & KB_LEFT  ) {
-    drive_x = ( drive_x > -( 127 - MOV_ACC ) ? drive_x - MOV_ACC : -127 );
-  } else if( drive_x < 0 ) {
-    drive_x = ( drive_x < -MOV_BRK ? drive_x + MOV_BRK : 0 );
-  }
-  if( host->ctrl->kb & KB_RIGHT ) {
-    drive_x = ( drive_x <  ( 127 - MOV_ACC ) ? drive_x + MOV_ACC :  127 );
-  } else if( drive_x > 0 ) {
-    drive_x = ( drive_x >  MOV_BRK ? drive_x - MOV_BRK : 0 );
-  }
-  if( host->ctrl->kb & KB_UP    ) {
-    drive_y = ( drive_y > -( 127 - MOV_ACC ) ? drive_y - MOV_ACC : -127 );
-  } else if( drive_y < 0 ) {
-    drive_y = ( drive_y < -MOV_BRK ? drive_y + MOV_BRK : 0 );
-  }
-  if( host->ctrl->kb & KB_DOWN  ) {
-    drive_y = ( drive_y <  ( 127 - MOV_ACC ) ? drive_y + MOV_ACC :  127 );
-  } else if( drive_y > 0 ) {
-    drive_y = ( drive_y >  MOV_BRK ? drive_y - MOV_BRK : 0 );
-  }
-
-  // Handle movement R
-  integrate_r -= ( drive_r * ROT_SEN );
-  integrate_r += host->diff->mx;
-  integrate_r = MAX( MIN( integrate_r, ROT_MAX ), -ROT_MAX );
-  if( integrate_r > ROT_DZN ) {
-    drive_r = ( drive_r <  ( 127 - ROT_ACC ) ? drive_r + ROT_ACC :  127 );
-    if( drive_r > integrate_r / ROT_DMP + ROT_DZN ) drive_r = integrate_r / ROT_DMP + ROT_DZN;
-  } else if( integrate_r < -ROT_DZN ) {
-    drive_r = ( drive_r > -( 127 - ROT_ACC ) ? drive_r - ROT_ACC : -127 );
-    if( drive_r < integrate_r / ROT_DMP - ROT_DZN ) drive_r = integrate_r / ROT_DMP - ROT_DZN;
-  } else {
-    drive_r = 0;
-  }
+  // Accumulate turn input
+  __sync_fetch_and_add( &pending_r, diff->mx );
 
   // Handle camera pitch
-  if( ( long )drive_p + host->diff->my > 255 / CAM_SEN ) {
+  if( ( long )drive_p + diff->my > 255 / CAM_SEN ) {
     drive_p = 255 / CAM_SEN;
-  } else if( ( long )drive_p + host->diff->my < 0 ) {
+  } else if( ( long )drive_p + diff->my < 0 ) {
     drive_p = 0;
   } else {
-    drive_p = drive_p + host->diff->my;
+    drive_p = drive_p + diff->my;
+  }
+}
+
+// Tick: updates timeouts
+static void tick() {
+  if( !connected ) return;
+
+  // Emoticon timeout
+  if( emoticon_timeout ) {
+    if( --emoticon_timeout == 0 ) emoticon = EMO_CONNECTED;
   }
 }
 
 // Connection has glitched: stops all motion
 static void stop_moving() {
-  drive_x = 0;
-  drive_y = 0;
-  drive_r = 0;
+  drive_kb = 0;
+  __sync_lock_test_and_set( &pending_r, 0 );
   drive_p = 165 / CAM_SEN;
-  integrate_r = 0;
+  drive_stop = 1;
 }
 
 // Frees allocated resources
@@ -234,6 +263,7 @@ static void closer() {
 // Switches emoticon based on connection status
 static void connect_status( int status ) {
   connected = status;
+  drive_kb = 0;
   emoticon = ( connected ? EMO_CONNECTED : EMO_IDLE );
 }
 
@@ -258,6 +288,7 @@ pluginclient_t *kiwiray_open( pluginhost_t *p_host ) {
   kiwiray.close      = closer;
   kiwiray.still      = stop_moving;
   kiwiray.tick       = tick;
+  kiwiray.control    = control;
   kiwiray.recv       = process_data;
   kiwiray.connected  = connect_status;
   return( &kiwiray );
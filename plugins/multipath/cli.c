@@ -0,0 +1,167 @@
+#include "cli.h" // This is a client plugin
+#include "multipath.h"
+
+static pluginclient_t  mpth;            // Plugin descriptor
+static   pluginhost_t *host;            // RoboCortex descriptor
+
+static            int  port = MP_PORT;  // Server port
+static            int  stats;           // Statistics interval in seconds, 0 = off
+
+static            int  initialized;     // Successful initialization
+
+static      mp_link_t  srv_link;        // All paths to server
+static       NET_SOCK  socks[ MP_PATHS ];     // Socket for each path
+static           void *threads[ MP_PATHS ];   // Receive thread for each path
+static            int  started;         // Threads started, used to hand out paths
+
+static           void *h_stats;         // Statistics thread handle
+
+static           char  last[ sizeof( mp_hdr_t ) + 8192 ]; // Last packet sent, resent when a path gets its token
+static            int  last_size;
+static       uint32_t  last_seq;
+
+// Takes the token the server issued for a path, and resends the last packet on it right away
+// so a handshake is not held up until the next retry
+static void path_auth( mp_hdr_t *hdr ) {
+  char packet[ sizeof( mp_hdr_t ) + 8192 ];
+  int p = hdr->path, size;
+  uint32_t seq;
+  if( p >= MP_PATHS || !srv_link.path[ p ].used ) return;
+  mp_lock( &srv_link );
+  memcpy( srv_link.path[ p ].auth, hdr->auth, 8 );
+  size = last_size;
+  seq = last_seq;
+  memcpy( packet, last, size );
+  mp_unlock( &srv_link );
+  if( size == 0 ) return;
+  mp_header( &srv_link, ( mp_hdr_t* )packet, p, seq );
+  net_send( &socks[ p ], packet, size, &srv_link.path[ p ].addr );
+}
+
+// Receives packets on one path, drops duplicates and passes the rest to RoboCortex
+static int receiver() {
+  char buffer[ 8192 ];
+  mp_hdr_t *hdr = ( mp_hdr_t* )buffer;
+  NET_ADDR addr;
+  int size, p;
+  if( !initialized ) return( 1 );
+  p = __sync_fetch_and_add( &started, 1 );
+  while( 1 ) {
+    size = net_recv( &socks[ p ], buffer, sizeof( buffer ), &addr );
+    if( size < ( int )sizeof( mp_hdr_t ) + 4 || hdr->group != srv_link.group ) continue;
+    if( hdr->seq == 0 ) {
+      if( memcmp( buffer + sizeof( mp_hdr_t ), "AUTH", 4 ) == 0 ) path_auth( hdr );
+      continue;
+    }
+    if( mp_receive( &srv_link, hdr, p ) ) host->comm_recv( buffer + sizeof( mp_hdr_t ), size - sizeof( mp_hdr_t ) );
+  }
+  return( 0 );
+}
+
+// Sends packets duplicated on all paths
+static void sender( char* data, int size ) {
+  char packet[ sizeof( mp_hdr_t ) + 8192 ];
+  uint32_t seq;
+  int p;
+  // Header included, packets must fit the 8192 byte receive buffers
+  if( !initialized || size > 8192 - ( int )sizeof( mp_hdr_t ) ) return;
+  memcpy( packet + sizeof( mp_hdr_t ), data, size );
+  seq = mp_next( &srv_link );
+  mp_lock( &srv_link );
+  memcpy( last, packet, sizeof( mp_hdr_t ) + size );
+  last_size = sizeof( mp_hdr_t ) + size;
+  last_seq = seq;
+  mp_unlock( &srv_link );
+  for( p = 0; p < MP_PATHS; p++ ) {
+    if( !srv_link.path[ p ].used ) continue;
+    mp_header( &srv_link, ( mp_hdr_t* )packet, p, seq );
+    net_send( &socks[ p ], packet, sizeof( mp_hdr_t ) + size, &srv_link.path[ p ].addr );
+  }
+}
+
+// Prints path statistics periodically
+static int reporter() {
+  while( 1 ) {
+    host->thread_delay( stats * 1000 );
+    mp_report( &srv_link );
+  }
+  return( 0 );
+}
+
+// Initializes network and sets up one socket per local address
+static void init() {
+  char temp[ CFG_VALUE_MAX_SIZE ], token[ 16 ];
+  uint32_t server = 0, group = 0, local;
+  NET_ADDR addr;
+  int p, paths = 0;
+
+  // Configuration
+  if( host->cfg_read( temp, "server" ) ) server = net_dtoa( temp );
+  if( host->cfg_read( temp, "port" ) ) port = atoi( temp );
+  if( host->cfg_read( temp, "stats" ) ) stats = atoi( temp );
+
+  // Initialize network
+  if( net_init() < 0 ) {
+    fprintf( stderr, "MPTH [error]: Network initialization failed\n" );
+    return;
+  }
+
+  while( group == 0 ) sys_random( &group, sizeof( group ) );
+  mp_init( &srv_link, group );
+
+  // One path per local address, each may go to its own server address
+  for( p = 0; p < MP_PATHS; p++ ) {
+    sprintf( token, "local%i", p );
+    if( !host->cfg_read( temp, token ) ) {
+      if( p > 0 ) break;
+      local = NET_ADDR_ANY;
+    } else {
+      local = net_dtoa( temp );
+    }
+    sprintf( token, "server%i", p );
+    net_addr_init( &srv_link.path[ p ].addr, host->cfg_read( temp, token ) ? net_dtoa( temp ) : server, port );
+    if( net_addr_get( &srv_link.path[ p ].addr ) == 0 ) {
+      printf( "MPTH [error]: No server specified/wrong format for path %i\n", p );
+      return;
+    }
+    if( net_sock( &socks[ p ] ) < 0 ) {
+      fprintf( stderr, "MPTH [error]: Socket aquire failed\n" );
+      return;
+    }
+    net_addr_init( &addr, local, 0 );
+    if( net_bind( &socks[ p ], &addr ) < 0 ) {
+      fprintf( stderr, "MPTH [error]: Unable to bind path %i to local address\n", p );
+      return;
+    }
+    srv_link.path[ p ].used = 1;
+    paths++;
+  }
+
+  printf( "MPTH [info]: Using %i path(s)\n", paths );
+  initialized = 1;
+
+  // Binding this function late allows RoboCortex to detect successful initialization
+  mpth.comm_send = sender;
+
+  for( p = 0; p < paths; p++ ) threads[ p ] = host->thread_start( receiver );
+  if( stats > 0 ) h_stats = host->thread_start( reporter );
+}
+
+// Frees allocated resources
+static void closer() {
+  int p;
+  if( h_stats ) host->thread_stop( h_stats );
+  for( p = 0; p < MP_PATHS; p++ ) {
+    if( threads[ p ] ) host->thread_stop( threads[ p ] );
+  }
+  if( initialized ) mp_report( &srv_link );
+}
+
+// Sets up the plugin descriptor
+pluginclient_t *multipath_open( pluginhost_t *p_host ) {
+  memcpy( &mpth.ident, "MPTH", 4 );
+  host = p_host;
+  mpth.close      = closer;
+  mpth.init       = init;
+  return( &mpth );
+}
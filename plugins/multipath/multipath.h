@@ -0,0 +1,212 @@
+// Path header, statistics and duplicate detection, common to MPTH server and client plugins
+#ifndef _MULTIPATH_H_
+#define _MULTIPATH_H_
+
+#define MP_PORT             6980        // Default port
+#define MP_PATHS               4        // Max number of paths per client
+#define MP_WINDOW            256        // Duplicate detection window, in packets
+#define MP_TIMEOUT          1000        // Path is considered down after this many ms of silence
+#define MP_HYSTERESIS         20        // Score improvement (ms) needed to move video to another path
+#define MP_LOSS_WEIGHT         2        // Score penalty (ms) per 1/255 of loss
+#define MP_LOSS_SAMPLE        32        // Packets per loss sample
+#define MP_AUTH_LIMIT        100        // Max path tokens issued per second by the server
+
+// Prepended to every packet, on every path
+typedef struct {
+  uint32_t group;                       // Client identifier, same on all paths
+  uint32_t seq;                         // Packet sequence, same on all duplicates
+  uint32_t pseq;                        // Path sequence, for loss measurement
+  uint32_t stamp;                       // Sender time (ms), never 0
+  uint32_t echo;                        // Latest stamp received on this path, 0 if none
+  uint16_t echo_delay;                  // Time (ms) echo was held by sender
+  uint8_t  path;                        // Path index, as numbered by client
+  uint8_t  loss;                        // Loss measured by sender when receiving on this path, 0-255
+  uint32_t auth[ 2 ];                   // Path token, binds group and path to the client's address
+} mp_hdr_t;
+
+// A packet with sequence 0 and an "AUTH" payload issues the token in auth for the path in path,
+// the server only accepts a client packet if its token matches the address it came from
+
+// One path between client and server
+typedef struct {
+  NET_ADDR          addr;               // Remote address
+  int               used;               // Path has been set up
+  uint32_t          seen;               // Local time of last packet received
+  uint32_t          pseq_tx;            // Last path sequence sent
+  uint32_t          pseq_rx;            // Highest path sequence received
+  int               got, lost;          // Current loss sample
+  int               loss_rx;            // Loss when receiving, 0-255
+  int               loss_tx;            // Loss when sending, as reported by remote end, 0-255
+  uint32_t          echo;               // Latest stamp received
+  uint32_t          echo_time;          // Local time echo was received
+  int               rtt;                // Smoothed round trip time (ms), < 0 if unknown
+  uint32_t          auth[ 2 ];          // Path token, as issued by the server
+  unsigned int      stat_rx, stat_tx, stat_dup;
+} mp_path_t;
+
+// All paths to one client, duplicate detection window
+typedef struct {
+  uint32_t          group;
+  uint32_t          seq_tx;             // Last packet sequence sent
+  uint32_t          top;                // Highest packet sequence received
+  uint32_t          bits[ MP_WINDOW / 32 ];
+  int               best;               // Path carrying video, < 0 if none
+  volatile int      lock;
+  mp_path_t         path[ MP_PATHS ];
+} mp_link_t;
+
+// Return current time in ms, never 0
+static uint32_t mp_now() {
+  uint32_t now = ( uint32_t )( sys_time_us() / 1000 );
+  return( now ? now : 1 );
+}
+
+static void mp_lock( mp_link_t *link ) {
+  while( __sync_lock_test_and_set( &link->lock, 1 ) );
+}
+
+static void mp_unlock( mp_link_t *link ) {
+  __sync_lock_release( &link->lock );
+}
+
+// Resets link for a new group
+static void mp_init( mp_link_t *link, uint32_t group ) {
+  int p;
+  memset( link, 0, sizeof( mp_link_t ) );
+  link->group = group;
+  link->best = -1;
+  for( p = 0; p < MP_PATHS; p++ ) link->path[ p ].rtt = -1;
+}
+
+// Return 1 if packets were received on path recently
+static int mp_alive( mp_path_t *path, uint32_t now ) {
+  return( path->used && path->seen && ( int32_t )( now - path->seen ) < MP_TIMEOUT );
+}
+
+// Return packet sequence for a new outgoing packet
+static uint32_t mp_next( mp_link_t *link ) {
+  return( __sync_add_and_fetch( &link->seq_tx, 1 ) );
+}
+
+// Fills in header for a packet sent on path p
+static void mp_header( mp_link_t *link, mp_hdr_t *hdr, int p, uint32_t seq ) {
+  mp_path_t *path = &link->path[ p ];
+  uint32_t now = mp_now();
+  mp_lock( link );
+  hdr->group = link->group;
+  hdr->seq = seq;
+  hdr->pseq = ++path->pseq_tx;
+  hdr->stamp = now;
+  hdr->echo = path->echo;
+  hdr->echo_delay = path->echo ? MIN( now - path->echo_time, 0xFFFF ) : 0;
+  hdr->path = p;
+  hdr->loss = path->loss_rx;
+  memcpy( hdr->auth, path->auth, 8 );
+  path->stat_tx++;
+  mp_unlock( link );
+}
+
+// Marks packet sequence as seen, return 1 if it was not seen before
+static int mp_fresh( mp_link_t *link, uint32_t seq ) {
+  int32_t diff = ( int32_t )( seq - link->top );
+  uint32_t bit;
+  if( diff > 0 ) {
+    // Newer than anything seen, slide window
+    if( diff >= MP_WINDOW ) {
+      memset( link->bits, 0, sizeof( link->bits ) );
+    } else {
+      for( bit = link->top + 1; bit != seq; bit++ ) link->bits[ ( bit % MP_WINDOW ) / 32 ] &= ~( 1 << ( bit % 32 ) );
+    }
+    link->top = seq;
+  } else if( -diff >= MP_WINDOW ) {
+    // Far behind window, remote end restarted its sequence
+    memset( link->bits, 0, sizeof( link->bits ) );
+    link->top = seq;
+  } else if( link->bits[ ( seq % MP_WINDOW ) / 32 ] & ( 1 << ( seq % 32 ) ) ) {
+    return( 0 );
+  }
+  link->bits[ ( seq % MP_WINDOW ) / 32 ] |= 1 << ( seq % 32 );
+  return( 1 );
+}
+
+// Updates path p from a received header, return 1 if packet is new, 0 if it is a duplicate
+static int mp_receive( mp_link_t *link, mp_hdr_t *hdr, int p ) {
+  mp_path_t *path = &link->path[ p ];
+  uint32_t now = mp_now();
+  int32_t diff;
+  int ret;
+  mp_lock( link );
+  path->seen = now;
+  path->stat_rx++;
+  // Round trip time from echoed stamp
+  if( hdr->echo ) {
+    diff = ( int32_t )( now - hdr->echo - hdr->echo_delay );
+    if( diff >= 0 && diff < 60000 ) path->rtt = ( path->rtt < 0 ? diff : ( path->rtt * 7 + diff ) / 8 );
+  }
+  path->echo = hdr->stamp;
+  path->echo_time = now;
+  path->loss_tx = hdr->loss;
+  // Loss from gaps in path sequence, late packets make up for earlier gaps
+  diff = ( int32_t )( hdr->pseq - path->pseq_rx );
+  if( diff > 0 ) {
+    if( path->pseq_rx && diff < 1000 ) path->lost += diff - 1;
+    path->pseq_rx = hdr->pseq;
+  } else if( path->lost ) {
+    path->lost--;
+  }
+  path->got++;
+  if( path->got + path->lost >= MP_LOSS_SAMPLE ) {
+    path->loss_rx = ( path->loss_rx * 3 + 255 * path->lost / ( path->got + path->lost ) ) / 4;
+    path->got = 0;
+    path->lost = 0;
+  }
+  ret = mp_fresh( link, hdr->seq );
+  if( !ret ) path->stat_dup++;
+  mp_unlock( link );
+  return( ret );
+}
+
+// Return path score (lower is better), from round trip time and loss when sending
+static int mp_score( mp_path_t *path ) {
+  return( ( path->rtt < 0 ? MP_TIMEOUT : path->rtt ) + path->loss_tx * MP_LOSS_WEIGHT );
+}
+
+// Selects path for video, return path index or < 0 if no path is alive
+static int mp_best( mp_link_t *link ) {
+  uint32_t now = mp_now();
+  int p, score, best = -1, best_score = 0;
+  mp_lock( link );
+  for( p = 0; p < MP_PATHS; p++ ) {
+    if( !mp_alive( &link->path[ p ], now ) ) continue;
+    score = mp_score( &link->path[ p ] );
+    if( best < 0 || score < best_score ) {
+      best = p;
+      best_score = score;
+    }
+  }
+  // Stay on current path unless the new one is clearly better
+  if( best >= 0 && link->best >= 0 && link->best != best && mp_alive( &link->path[ link->best ], now ) ) {
+    if( best_score + MP_HYSTERESIS >= mp_score( &link->path[ link->best ] ) ) best = link->best;
+  }
+  if( best != link->best && best >= 0 ) printf( "MPTH [info]: Video moved to path %i\n", best );
+  link->best = best;
+  mp_unlock( link );
+  return( best );
+}
+
+// Prints statistics for all paths
+static void mp_report( mp_link_t *link ) {
+  uint32_t now = mp_now();
+  mp_path_t *path;
+  int p;
+  for( p = 0; p < MP_PATHS; p++ ) {
+    path = &link->path[ p ];
+    if( !path->used ) continue;
+    printf( "MPTH [info]: %08X path %i %s rtt %i ms, loss rx %i%% tx %i%%, %u rx %u tx %u dup%s\n",
+            link->group, p, mp_alive( path, now ) ? "up  " : "down", path->rtt,
+            path->loss_rx * 100 / 255, path->loss_tx * 100 / 255,
+            path->stat_rx, path->stat_tx, path->stat_dup, p == link->best ? " (video)" : "" );
+  }
+}
+
+#endif
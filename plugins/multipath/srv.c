@@ -0,0 +1,217 @@
+#include "srv.h" // This is a server plugin
+#include "multipath.h"
+
+#define MAX_PEERS             16        // Max number of clients tracked
+#define PEER_STALE         30000        // Client slot may be reused after this many ms of silence
+
+static pluginclient_t  mpth;            // Plugin descriptor
+static   pluginhost_t *host;            // RoboCortex descriptor
+
+static            int  port = MP_PORT;  // Default port
+static            int  stats;           // Statistics interval in seconds, 0 = off
+
+static            int  initialized;     // Successful initialization
+
+static       NET_SOCK  h_sock;          // Socket
+
+static      mp_link_t  peers[ MAX_PEERS ];   // Paths for each client
+static       remote_t  remotes[ MAX_PEERS ]; // Client address as seen by RoboCortex, the group
+static            int  peers_count;
+
+static           char  buffer[ 8192 ];  // Receive buffer
+
+static           void *h_thread;        // Receive thread handle
+static           void *h_stats;         // Statistics thread handle
+
+static       uint32_t  auth_time;       // Start of the current path token second
+static            int  auth_count;      // Path tokens issued this second
+
+// Return link for group or -1 if group is unknown, never claims a slot
+static int peer_known( uint32_t group ) {
+  int n;
+  for( n = 0; n < peers_count; n++ ) {
+    if( peers[ n ].group == group ) return( n );
+  }
+  return( -1 );
+}
+
+// Return link for group, claims a new or stale slot if group is unknown
+static int peer_find( uint32_t group ) {
+  uint32_t now = mp_now();
+  int n, p, stale;
+  n = peer_known( group );
+  if( n >= 0 ) return( n );
+  for( n = 0; n < MAX_PEERS; n++ ) {
+    if( n == peers_count ) {
+      peers_count++;
+      break;
+    }
+    stale = 1;
+    for( p = 0; p < MP_PATHS; p++ ) {
+      if( peers[ n ].path[ p ].used && ( int32_t )( now - peers[ n ].path[ p ].seen ) < PEER_STALE ) stale = 0;
+    }
+    if( stale ) break;
+  }
+  if( n == MAX_PEERS ) return( -1 );
+  mp_init( &peers[ n ], group );
+  remotes[ n ].addr = &peers[ n ].group;
+  remotes[ n ].size = sizeof( uint32_t );
+  remotes[ n ].handler = &mpth;
+  return( n );
+}
+
+// Return token binding group and path to the address packets on it come from
+static uint64_t path_token( uint32_t group, int path, NET_ADDR *addr ) {
+  uint8_t msg[ 4 + 1 + 4 + 2 ];
+  uint32_t ip = net_addr_get( addr );
+  uint16_t port = net_port_get( addr );
+  memcpy( msg, &group, 4 );
+  msg[ 4 ] = path;
+  memcpy( msg + 5, &ip, 4 );
+  memcpy( msg + 9, &port, 2 );
+  return( host->mac( msg, sizeof( msg ) ) );
+}
+
+// Issues the token for a path that did not carry a valid one
+// A known client gets it over a live path, so only its own paths can be moved. The source
+// address only gets it if the client has none, the reply is never larger than the request.
+static void path_auth( mp_hdr_t *req, NET_ADDR *addr, uint64_t token ) {
+  char packet[ sizeof( mp_hdr_t ) + 4 ];
+  mp_hdr_t *hdr = ( mp_hdr_t* )packet;
+  NET_ADDR *dest = addr;
+  uint32_t now = mp_now();
+  int n, p;
+  n = peer_known( req->group );
+  if( n >= 0 ) {
+    // Path still up from its bound address, this is a replay or spoofed
+    if( mp_alive( &peers[ n ].path[ req->path ], now ) ) return;
+    for( p = 0; p < MP_PATHS; p++ ) {
+      if( mp_alive( &peers[ n ].path[ p ], now ) ) {
+        dest = &peers[ n ].path[ p ].addr;
+        break;
+      }
+    }
+  }
+  if( now - auth_time >= 1000 ) {
+    auth_time = now;
+    auth_count = 0;
+  }
+  if( auth_count >= MP_AUTH_LIMIT ) return;
+  auth_count++;
+  memset( hdr, 0, sizeof( mp_hdr_t ) );
+  hdr->group = req->group;
+  hdr->stamp = now;
+  hdr->path = req->path;
+  memcpy( hdr->auth, &token, 8 );
+  memcpy( packet + sizeof( mp_hdr_t ), "AUTH", 4 );
+  net_send( &h_sock, packet, sizeof( packet ), dest );
+}
+
+// Receives packets on all paths, drops duplicates and passes the rest to RoboCortex
+static int receiver() {
+  mp_hdr_t *hdr = ( mp_hdr_t* )buffer;
+  NET_ADDR addr;
+  uint64_t token;
+  int size, n;
+  if( !initialized ) return( 1 );
+  while( 1 ) {
+    size = net_recv( &h_sock, buffer, sizeof( buffer ), &addr );
+    if( size < ( int )sizeof( mp_hdr_t ) + 4 || hdr->path >= MP_PATHS || hdr->seq == 0 ) continue;
+    // Only a packet with the token for its source address may claim a slot or move a path
+    token = path_token( hdr->group, hdr->path, &addr );
+    if( memcmp( hdr->auth, &token, 8 ) != 0 ) {
+      path_auth( hdr, &addr, token );
+      continue;
+    }
+    n = peer_find( hdr->group );
+    if( n < 0 ) continue;
+    // Path address may change, follow it once the token for the new one is presented
+    peers[ n ].path[ hdr->path ].addr = addr;
+    peers[ n ].path[ hdr->path ].used = 1;
+    if( mp_receive( &peers[ n ], hdr, hdr->path ) ) {
+      host->comm_recv( buffer + sizeof( mp_hdr_t ), size - sizeof( mp_hdr_t ), &remotes[ n ] );
+    }
+  }
+  return( 0 );
+}
+
+// Sends video on the best path and everything else duplicated on all live paths
+static void sender( char* data, int size, remote_t *remote ) {
+  char packet[ sizeof( mp_hdr_t ) + 8192 ];
+  uint32_t seq, now = mp_now();
+  mp_link_t *link = NULL;
+  int n, p, best = -1;
+  // Header included, packets must fit the 8192 byte receive buffers
+  if( !initialized || size > 8192 - ( int )sizeof( mp_hdr_t ) ) return;
+  for( n = 0; n < peers_count; n++ ) {
+    if( peers[ n ].group == *( uint32_t* )remote->addr ) link = &peers[ n ];
+  }
+  if( !link ) return;
+  memcpy( packet + sizeof( mp_hdr_t ), data, size );
+  seq = mp_next( link );
+  // Video is an H.264 start code, a JPEG slice or a packet of a source's own stream
+  if( size >= 4 && ( ( data[ 0 ] == 0 && data[ 1 ] == 0 && data[ 2 ] == 0 && data[ 3 ] == 1 )
+   || memcmp( data, "JPEG", 4 ) == 0 || memcmp( data, "STRM", 4 ) == 0 ) ) best = mp_best( link );
+  for( p = 0; p < MP_PATHS; p++ ) {
+    if( best >= 0 ? p != best : !mp_alive( &link->path[ p ], now ) ) continue;
+    mp_header( link, ( mp_hdr_t* )packet, p, seq );
+    net_send( &h_sock, packet, sizeof( mp_hdr_t ) + size, &link->path[ p ].addr );
+  }
+}
+
+// Prints path statistics periodically
+static int reporter() {
+  int n;
+  while( 1 ) {
+    host->thread_delay( stats * 1000 );
+    for( n = 0; n < peers_count; n++ ) mp_report( &peers[ n ] );
+  }
+  return( 0 );
+}
+
+// Initializes network and binds UDP socket
+static void init() {
+  char temp[ CFG_VALUE_MAX_SIZE ];
+  NET_ADDR addr;
+
+  // Configuration
+  if( host->cfg_read( temp, "port" ) ) port = atoi( temp );
+  if( host->cfg_read( temp, "stats" ) ) stats = atoi( temp );
+
+  // Initialize network
+  if( net_init() < 0 ) {
+    fprintf( stderr, "MPTH [error]: Network initialization failed\n" );
+    return;
+  }
+  if( net_sock( &h_sock ) < 0 ) {
+    fprintf( stderr, "MPTH [error]: Socket aquire failed\n" );
+    return;
+  }
+  net_addr_init( &addr, NET_ADDR_ANY, port );
+  if( net_bind( &h_sock, &addr ) < 0 ) {
+    fprintf( stderr, "MPTH [error]: Socket bind failed\n" );
+    return;
+  }
+
+  initialized = 1;
+  h_thread = host->thread_start( receiver );
+  if( stats > 0 ) h_stats = host->thread_start( reporter );
+}
+
+// Frees allocated resources
+static void closer() {
+  int n;
+  if( h_stats ) host->thread_stop( h_stats );
+  if( h_thread ) host->thread_stop( h_thread );
+  for( n = 0; n < peers_count; n++ ) mp_report( &peers[ n ] );
+}
+
+// Sets up the plugin descriptor
+pluginclient_t *multipath_open( pluginhost_t *p_host ) {
+  memcpy( &mpth.ident, "MPTH", 4 );
+  host = p_host;
+  mpth.close      = closer;
+  mpth.init       = init;
+  mpth.comm_send  = sender;
+  return( &mpth );
+}
@@ -23,10 +23,28 @@ IF ERRORLEVEL 1 GOTO ERROR
 gcc monitor/cli.c -c %CFLAGS% -I../include -I. -o monitor_cli.o
 IF ERRORLEVEL 1 GOTO ERROR
 
+ECHO Compiling plugins/shm0/...
+gcc shm0/srv.c -c %CFLAGS% -I../include -I. -o shm0_srv.o
+IF ERRORLEVEL 1 GOTO ERROR
+gcc shm0/cli.c -c %CFLAGS% -I../include -I. -o shm0_cli.o
+IF ERRORLEVEL 1 GOTO ERROR
+
+ECHO Compiling plugins/udpm/...
+gcc udpm/srv.c -c %CFLAGS% -I../include -I. -o udpm_srv.o
+IF ERRORLEVEL 1 GOTO ERROR
+gcc udpm/cli.c -c %CFLAGS% -I../include -I. -o udpm_cli.o
+IF ERRORLEVEL 1 GOTO ERROR
+
+ECHO Compiling plugins/multipath/...
+gcc multipath/srv.c -c %CFLAGS% -I../include -I. -o multipath_srv.o
+IF ERRORLEVEL 1 GOTO ERROR
+gcc multipath/cli.c -c %CFLAGS% -I../include -I. -o multipath_cli.o
+IF ERRORLEVEL 1 GOTO ERROR
+
 ECHO Librarian...
-ar rcs ..\lib-w32\librcplug_srv.a ipv4udp_srv.o kiwiray_srv.o monitor_srv.o
+ar rcs ..\lib-w32\librcplug_srv.a ipv4udp_srv.o kiwiray_srv.o monitor_srv.o shm0_srv.o udpm_srv.o multipath_srv.o
 IF ERRORLEVEL 1 GOTO ERROR
-ar rcs ..\lib-w32\librcplug_cli.a ipv4udp_cli.o kiwiray_cli.o monitor_cli.o
+ar rcs ..\lib-w32\librcplug_cli.a ipv4udp_cli.o kiwiray_cli.o monitor_cli.o shm0_cli.o udpm_cli.o multipath_cli.o
 IF ERRORLEVEL 1 GOTO ERROR
 
 ECHO Cleaning up...
@@ -38,4 +56,4 @@ ECHO Done!
 
 :ERROR
 
-ENDLOCAL
\ No newline at end of file
+ENDLOCAL
\ No newline at end of file
@@ -16,9 +16,21 @@ echo Compiling plugins/monitor/...
 gcc monitor/srv.c -c $CFLAGS -I../include -I. -o monitor_srv.o
 gcc monitor/cli.c -c $CFLAGS -I../include -I. -o monitor_cli.o
 
+echo Compiling plugins/shm0/...
+gcc shm0/srv.c -c $CFLAGS -I../include -I. -o shm0_srv.o
+gcc shm0/cli.c -c $CFLAGS -I../include -I. -o shm0_cli.o
+
+echo Compiling plugins/udpm/...
+gcc udpm/srv.c -c $CFLAGS -I../include -I. -o udpm_srv.o
+gcc udpm/cli.c -c $CFLAGS -I../include -I. -o udpm_cli.o
+
+echo Compiling plugins/multipath/...
+gcc multipath/srv.c -c $CFLAGS -I../include -I. -o multipath_srv.o
+gcc multipath/cli.c -c $CFLAGS -I../include -I. -o multipath_cli.o
+
 echo Librarian...
-ar rcs ..\lib-linux\librcplug_srv.a ipv4udp_srv.o kiwiray_srv.o monitor_srv.o
-ar rcs ..\lib-linux\librcplug_cli.a ipv4udp_cli.o kiwiray_cli.o monitor_cli.o
+ar rcs ..\lib-linux\librcplug_srv.a ipv4udp_srv.o kiwiray_srv.o monitor_srv.o shm0_srv.o udpm_srv.o multipath_srv.o
+ar rcs ..\lib-linux\librcplug_cli.a ipv4udp_cli.o kiwiray_cli.o monitor_cli.o shm0_cli.o udpm_cli.o multipath_cli.o
 
 echo Cleaning up...
 rm *.o
@@ -29,4 +41,4 @@ echo Done!
 
 :ERROR
 
-ENDLOCAL
\ No newline at end of file
+ENDLOCAL
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "cli.h" // This is a client plugin
+#include "shm0/shm0.h"
+
+static pluginclient_t  shm0;            // Plugin descriptor
+static   pluginhost_t *host;            // RoboCortex descriptor
+
+static           char  name[ CFG_VALUE_MAX_SIZE ] = SHM_NAME; // Shared memory object name
+
+static            int  initialized;     // Successful initialization
+
+static           void *h_thread;        // Receive thread handle
+
+#ifndef _WIN32
+
+#include <signal.h>
+
+static          shm_t *shm;             // Mapped shared memory
+static  shm_channel_t *channel;         // Claimed channel
+static   volatile int  lock;            // Producer lock for up ring
+
+// Receives packets from the server and passes them to RoboCortex
+static int receiver() {
+  uint32_t wake;
+  shm_slot_t *slot;
+  if( !initialized ) return( 1 );
+  while( 1 ) {
+    if( ( slot = shm_peek( &channel->down ) ) != NULL ) {
+      if( slot->size >= 4 ) host->comm_recv( slot->data, slot->size );
+      shm_pop( &channel->down );
+    } else {
+      // Nothing to do, sleep until the server bumps the wake word
+      wake = channel->down.wake;
+      channel->down.waiting = 1;
+      __sync_synchronize();
+      if( channel->down.tail == channel->down.head ) shm_sleep( &channel->down.wake, wake, 1000 );
+      channel->down.waiting = 0;
+    }
+  }
+  return( 0 );
+}
+
+// Writes packets to the server when called by RoboCortex
+static void sender( char* data, int size ) {
+  if( !initialized ) return;
+  shm_lock( &lock );
+  if( shm_push( &channel->up, data, size ) == 0 ) shm_wake( &shm->wake, &shm->waiting );
+  shm_unlock( &lock );
+}
+
+// Maps the servers shared memory object and claims a free channel
+static void init() {
+  int n, h_shm;
+  int32_t owner;
+
+  // Configuration
+  host->cfg_read( name, "name" );
+
+  // Map shared memory, missing object simply means no local server
+  h_shm = shm_open( name, O_RDWR, 0 );
+  if( h_shm < 0 ) {
+    printf( "SHM0 [info]: No local server at %s\n", name );
+    return;
+  }
+  shm = mmap( NULL, sizeof( shm_t ), PROT_READ | PROT_WRITE, MAP_SHARED, h_shm, 0 );
+  close( h_shm );
+  if( shm == MAP_FAILED ) {
+    fprintf( stderr, "SHM0 [error]: Unable to map %s\n", name );
+    return;
+  }
+  if( shm->magic != SHM_MAGIC ) {
+    fprintf( stderr, "SHM0 [error]: %s is not a RoboCortex server\n", name );
+    munmap( shm, sizeof( shm_t ) );
+    return;
+  }
+
+  // Claim a channel that is free or owned by a process that no longer exists
+  for( n = 0; n < SHM_CHANNELS; n++ ) {
+    owner = shm->channel[ n ].owner;
+    if( owner == 0 || ( kill( owner, 0 ) < 0 && errno == ESRCH ) ) {
+      if( __sync_bool_compare_and_swap( &shm->channel[ n ].owner, owner, getpid() ) ) break;
+    }
+  }
+  if( n == SHM_CHANNELS ) {
+    fprintf( stderr, "SHM0 [error]: All %i channels are in use\n", SHM_CHANNELS );
+    munmap( shm, sizeof( shm_t ) );
+    return;
+  }
+  channel = &shm->channel[ n ];
+
+  // Discard anything left behind by a previous owner
+  channel->down.tail = channel->down.head;
+  channel->up.head = channel->up.tail;
+
+  initialized = 1;
+
+  // Binding this function late allows RoboCortex to detect successful initialization
+  shm0.comm_send = sender;
+
+  h_thread = host->thread_start( receiver );
+}
+
+// Frees allocated resources
+static void closer() {
+  if( h_thread ) host->thread_stop( h_thread );
+  if( initialized ) {
+    initialized = 0;
+    channel->owner = 0;
+    munmap( shm, sizeof( shm_t ) );
+  }
+}
+
+#else
+
+static void init() {
+  fprintf( stderr, "SHM0 [error]: Not supported on this platform\n" );
+}
+
+static void closer() {
+}
+
+#endif
+
+// Sets up the plugin descriptor
+pluginclient_t *shm0_open( pluginhost_t *p_host ) {
+  memcpy( &shm0.ident, "SHM0", 4 );
+  host = p_host;
+  shm0.close      = closer;
+  shm0.init       = init;
+  return( &shm0 );
+}
@@ -0,0 +1,101 @@
+// Shared memory layout and ring helpers, common to SHM0 server and client plugins
+#ifndef _SHM0_H_
+#define _SHM0_H_
+
+#define SHM_NAME      "/robocortex" // Default shared memory object name
+#define SHM_MAGIC     0x304D4853    // "SHM0"
+#define SHM_CHANNELS           4    // Max number of simultaneous local clients
+#define SHM_SLOTS             64    // Number of slots in each ring
+#define SHM_SLOT_SIZE       8192    // Max packet size, matches UDP receive buffers
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Fixed size packet slot
+typedef struct {
+  volatile uint32_t size;
+  char              data[ SHM_SLOT_SIZE ];
+} shm_slot_t;
+
+// Single producer, single consumer ring of slots
+typedef struct {
+  volatile uint32_t head;      // Next slot to write, owned by producer
+  volatile uint32_t tail;      // Next slot to read, owned by consumer
+  volatile uint32_t wake;      // Futex word, bumped by producer for each packet
+  volatile uint32_t waiting;   // Consumer is (about to go) asleep on wake
+  shm_slot_t        slot[ SHM_SLOTS ];
+} shm_ring_t;
+
+// Connection to a single local client
+typedef struct {
+  volatile int32_t  owner;     // Process id of client, 0 if free
+  shm_ring_t        down;      // Server to client
+  shm_ring_t        up;        // Client to server, server sleeps on shm_t.wake
+} shm_channel_t;
+
+// Whole shared memory object
+typedef struct {
+  uint32_t          magic;
+  volatile uint32_t wake;      // Futex word for server, bumped for packets on any up ring
+  volatile uint32_t waiting;   // Server is (about to go) asleep on wake
+  shm_channel_t     channel[ SHM_CHANNELS ];
+} shm_t;
+
+// Sleeps on futex word while it holds val, or until timeout
+static void shm_sleep( volatile uint32_t *word, uint32_t val, int ms ) {
+  struct timespec ts = { ms / 1000, ( ms % 1000 ) * 1000000 };
+  syscall( SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0 );
+}
+
+// Bumps futex word and wakes sleeper, only enters the kernel if somebody is asleep
+static void shm_wake( volatile uint32_t *word, volatile uint32_t *waiting ) {
+  __sync_fetch_and_add( word, 1 );
+  if( *waiting ) syscall( SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0 );
+}
+
+// Writes a packet to ring, returns 0 on success or -1 if packet was dropped
+static int shm_push( shm_ring_t *ring, char *data, int size ) {
+  uint32_t head = ring->head;
+  shm_slot_t *slot;
+  if( size >= SHM_SLOT_SIZE ) return( -1 );    // Room for terminator, as receive buffers
+  if( head - ring->tail >= SHM_SLOTS ) return( -1 ); // Full, drop as UDP would
+  slot = &ring->slot[ head % SHM_SLOTS ];
+  memcpy( slot->data, data, size );
+  slot->size = size;
+  __sync_synchronize();
+  ring->head = head + 1;
+  return( 0 );
+}
+
+// Returns oldest unread slot or NULL if ring is empty
+static shm_slot_t *shm_peek( shm_ring_t *ring ) {
+  if( ring->tail == ring->head ) return( NULL );
+  __sync_synchronize();
+  return( &ring->slot[ ring->tail % SHM_SLOTS ] );
+}
+
+// Releases oldest unread slot
+static void shm_pop( shm_ring_t *ring ) {
+  __sync_synchronize();
+  ring->tail++;
+}
+
+// Serializes producers within one process (main loop and receive thread may both send)
+static void shm_lock( volatile int *lock ) {
+  while( __sync_lock_test_and_set( lock, 1 ) ) while( *lock );
+}
+
+static void shm_unlock( volatile int *lock ) {
+  __sync_lock_release( lock );
+}
+
+#endif
+
+#endif
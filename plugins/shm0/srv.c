@@ -0,0 +1,136 @@
+#include "srv.h" // This is a server plugin
+#include "shm0/shm0.h"
+
+static pluginclient_t  shm0;            // Plugin descriptor
+static   pluginhost_t *host;            // RoboCortex descriptor
+
+static           char  name[ CFG_VALUE_MAX_SIZE ] = SHM_NAME; // Shared memory object name
+
+static            int  initialized;     // Successful initialization
+
+static           void *h_thread;        // Receive thread handle
+
+#ifndef _WIN32
+
+static          shm_t *shm;             // Mapped shared memory
+
+static            int  ids[ SHM_CHANNELS ];     // Channel index, used as remote address
+static       remote_t  remotes[ SHM_CHANNELS ]; // One remote per channel
+static   volatile int  locks[ SHM_CHANNELS ];   // Producer locks for down rings
+
+// Receives packets from all channels and passes them to RoboCortex
+static int receiver() {
+  int n, got;
+  uint32_t wake;
+  shm_slot_t *slot;
+  if( !initialized ) return( 1 );
+  while( 1 ) {
+    got = 0;
+    for( n = 0; n < SHM_CHANNELS; n++ ) {
+      while( ( slot = shm_peek( &shm->channel[ n ].up ) ) != NULL ) {
+        if( slot->size >= 4 ) host->comm_recv( slot->data, slot->size, &remotes[ n ] );
+        shm_pop( &shm->channel[ n ].up );
+        got = 1;
+      }
+    }
+    if( !got ) {
+      // Nothing to do, sleep until a client bumps the wake word
+      wake = shm->wake;
+      shm->waiting = 1;
+      __sync_synchronize();
+      for( n = 0; n < SHM_CHANNELS; n++ ) if( shm->channel[ n ].up.tail != shm->channel[ n ].up.head ) break;
+      if( n == SHM_CHANNELS ) shm_sleep( &shm->wake, wake, 1000 );
+      shm->waiting = 0;
+    }
+  }
+  return( 0 );
+}
+
+// Writes packets to a local client when called by RoboCortex
+static void sender( char* data, int size, remote_t *remote ) {
+  int n;
+  shm_channel_t *channel;
+  if( !initialized ) return;
+  n = *( int* )remote->addr;
+  channel = &shm->channel[ n ];
+  if( channel->owner == 0 ) return;
+  shm_lock( &locks[ n ] );
+  if( shm_push( &channel->down, data, size ) == 0 ) shm_wake( &channel->down.wake, &channel->down.waiting );
+  shm_unlock( &locks[ n ] );
+}
+
+// Creates and maps the shared memory object
+static void init() {
+  int n, h_shm;
+
+  // Configuration
+  host->cfg_read( name, "name" );
+
+  // Create a fresh shared memory object
+  shm_unlink( name );
+  h_shm = shm_open( name, O_CREAT | O_EXCL | O_RDWR, 0600 );
+  if( h_shm < 0 ) {
+    fprintf( stderr, "SHM0 [error]: Unable to create %s\n", name );
+    return;
+  }
+  if( ftruncate( h_shm, sizeof( shm_t ) ) < 0 ) {
+    fprintf( stderr, "SHM0 [error]: Unable to size %s\n", name );
+    close( h_shm );
+    shm_unlink( name );
+    return;
+  }
+  shm = mmap( NULL, sizeof( shm_t ), PROT_READ | PROT_WRITE, MAP_SHARED, h_shm, 0 );
+  close( h_shm );
+  if( shm == MAP_FAILED ) {
+    fprintf( stderr, "SHM0 [error]: Unable to map %s\n", name );
+    shm_unlink( name );
+    return;
+  }
+  memset( shm, 0, sizeof( shm_t ) );
+  for( n = 0; n < SHM_CHANNELS; n++ ) {
+    ids[ n ] = n;
+    remotes[ n ].addr = &ids[ n ];
+    remotes[ n ].size = sizeof( int );
+    remotes[ n ].handler = &shm0;
+  }
+  __sync_synchronize();
+  shm->magic = SHM_MAGIC;
+
+  initialized = 1;
+  h_thread = host->thread_start( receiver );
+}
+
+// Frees allocated resources
+static void closer() {
+  if( h_thread ) host->thread_stop( h_thread );
+  if( initialized ) {
+    initialized = 0;
+    shm->magic = 0;
+    munmap( shm, sizeof( shm_t ) );
+    shm_unlink( name );
+  }
+}
+
+#else
+
+static void sender( char* data, int size, remote_t *remote ) {
+}
+
+static void init() {
+  fprintf( stderr, "SHM0 [error]: Not supported on this platform\n" );
+}
+
+static void closer() {
+}
+
+#endif
+
+// Sets up the plugin descriptor
+pluginclient_t *shm0_open( pluginhost_t *p_host ) {
+  memcpy( &shm0.ident, "SHM0", 4 );
+  host = p_host;
+  shm0.close      = closer;
+  shm0.init       = init;
+  shm0.comm_send  = sender;
+  return( &shm0 );
+}
@@ -8,6 +8,8 @@
 #define CAP_TOGGLE  2
 #define CAP_NOP     3
 
+#define ROI_MAX     8 // Region-of-interest slots
+
 typedef struct {
   // Requests a parameter from the configuration file
   int      ( *cfg_read     )( char *value, char *token );
@@ -27,8 +29,13 @@ typedef struct {
   void     ( *cap_set      )( int device, int enabled, SDL_Rect *src, SDL_Rect *dst );
   // Set capture device z-order
   void     ( *cap_zorder   )( int device, int z );
+  // Raise (priority > 0) or lower encoding quality of a stream region, in QP steps
+  // Slots are numbered 0 to ROI_MAX - 1, a NULL region clears the slot
+  void     ( *roi_set      )( int id, SDL_Rect *region, int priority );
   // Process a received packet
   void     ( *comm_recv    )( char* data, int size, remote_t *addr );
+  // Keyed MAC of up to 64 bytes with a secret of this server run, for transports authenticating peers
+  uint64_t ( *mac          )( void *data, int size );
   // Valid in tick(), when client is connected only
   // Contains control/steering information
   ctrl_t  *ctrl; // Current values
@@ -59,6 +66,9 @@ typedef struct {
   // Control/steering information should be processed here
   // Final RGB24 image may be analysed and/or modified here
   void ( *tick       )();
+  // Called from the communications thread as soon as control data arrives from the controlling client
+  // Lets latency sensitive plugins steer without waiting for the next frame, keep this short
+  void ( *control    )( ctrl_t *ctrl, ctrl_t *diff );
   // Called when a data packet is received from the client
   void ( *recv       )( void *data, unsigned char size );
   // Called when a video packet has been encoded for transmission to client
@@ -0,0 +1,99 @@
+#include "cli.h" // This is a client plugin
+
+#ifndef _WIN32
+#include <netdb.h>
+#endif
+
+#define PORT                "6981"      // Default port
+
+static pluginclient_t  udpm;            // Plugin descriptor
+static   pluginhost_t *host;            // RoboCortex descriptor
+
+static           char  server[ CFG_VALUE_MAX_SIZE ];   // Server host name, IPv4 or IPv6 address
+static           char  port[ CFG_VALUE_MAX_SIZE ] = PORT;
+
+static            int  initialized;     // Successful initialization
+
+static       NET_SOCK  h_sock;          // Socket
+static struct sockaddr_storage srv_addr; // Servers address and port
+static            int  srv_size;
+
+static           char  buffer[ 8192 ];  // Receive buffer
+
+static           void *h_thread;        // Receive thread handle
+
+// Receives UDP packets and passes them to RoboCortex
+static int receiver() {
+  int size;
+  if( !initialized ) return( 1 );
+  while( 1 ) {
+    size = recv( h_sock, buffer, sizeof( buffer ), 0 );
+    if( size >= 4 ) host->comm_recv( buffer, size );
+  }
+  return( 0 );
+}
+
+// Sends UDP packets when called by RoboCortex
+static void sender( char* data, int size ) {
+  if( !initialized ) return;
+  sendto( h_sock, data, size, 0, ( struct sockaddr* )&srv_addr, srv_size );
+}
+
+// Resolves server and sets up a socket of matching family
+static void init() {
+  struct addrinfo hints, *res;
+
+  // Configuration
+  host->cfg_read( server, "server" );
+  host->cfg_read( port, "port" );
+
+  if( !server[ 0 ] ) {
+    printf( "UDPM [error]: No server specified\n" );
+    return;
+  }
+
+  // Initialize network
+  if( net_init() < 0 ) {
+    fprintf( stderr, "UDPM [error]: Network initialization failed\n" );
+    return;
+  }
+
+  // Resolve server, IPv4 or IPv6
+  memset( &hints, 0, sizeof( hints ) );
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_protocol = IPPROTO_UDP;
+  if( getaddrinfo( server, port, &hints, &res ) != 0 ) {
+    fprintf( stderr, "UDPM [error]: Unable to resolve %s\n", server );
+    return;
+  }
+  memcpy( &srv_addr, res->ai_addr, res->ai_addrlen );
+  srv_size = res->ai_addrlen;
+  h_sock = socket( res->ai_family, res->ai_socktype, res->ai_protocol );
+  freeaddrinfo( res );
+  if( h_sock == NET_INVALID_SOCKET ) {
+    fprintf( stderr, "UDPM [error]: Socket aquire failed\n" );
+    return;
+  }
+
+  initialized = 1;
+
+  // Binding this function late allows RoboCortex to detect successful initialization
+  udpm.comm_send = sender;
+
+  h_thread = host->thread_start( receiver );
+}
+
+// Frees allocated resources
+static void closer() {
+  if( h_thread ) host->thread_stop( h_thread );
+}
+
+// Sets up the plugin descriptor
+pluginclient_t *udpm_open( pluginhost_t *p_host ) {
+  memcpy( &udpm.ident, "UDPM", 4 );
+  host = p_host;
+  udpm.close      = closer;
+  udpm.init       = init;
+  return( &udpm );
+}
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE       // CPU affinity
+#include "srv.h" // This is a server plugin
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#endif
+
+#define PORT                6981        // Default port
+#define MAX_THREADS           32        // Max receive threads per address family
+
+// Receive socket and thread
+typedef struct {
+  NET_SOCK             sock;
+  int                  core;            // Core to pin receive thread to
+  char                 buffer[ 8192 ];  // Receive buffer
+  struct sockaddr_storage addr;         // Client address and port
+  remote_t             remote;
+  void                *h_thread;
+} worker_t;
+
+static pluginclient_t  udpm;            // Plugin descriptor
+static   pluginhost_t *host;            // RoboCortex descriptor
+
+static            int  port = PORT;     // Default port
+static            int  threads;         // Receive threads per address family (0 = one per core)
+static            int  use_ipv4 = 1;    // Bind IPv4 sockets
+static            int  use_ipv6 = 1;    // Bind IPv6 sockets
+
+static            int  initialized;     // Successful initialization
+
+static       worker_t  workers[ MAX_THREADS * 2 ];
+static            int  workers_count;
+static            int  started;         // Threads started, used to hand out workers
+static       NET_SOCK  send4 = NET_INVALID_SOCKET; // Sockets used for sending
+static       NET_SOCK  send6 = NET_INVALID_SOCKET;
+
+// Receives UDP packets on one of the sockets and passes them to RoboCortex
+static int receiver() {
+  worker_t *w;
+  socklen_t len;
+  int size;
+  if( !initialized ) return( 1 );
+  w = &workers[ __sync_fetch_and_add( &started, 1 ) ];
+#ifdef __linux__
+  {
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( w->core, &set );
+    if( pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) != 0 ) {
+      printf( "UDPM [warning]: Unable to pin receive thread to core %i\n", w->core );
+    }
+  }
+#endif
+  while( 1 ) {
+    len = sizeof( w->addr );
+    size = recvfrom( w->sock, w->buffer, sizeof( w->buffer ), 0, ( struct sockaddr* )&w->addr, &len );
+    if( size >= 4 ) {
+      w->remote.size = len;
+      host->comm_recv( w->buffer, size, &w->remote );
+    }
+  }
+  return( 0 );
+}
+
+// Sends UDP packets when called by RoboCortex, using a socket of matching family
+static void sender( char* data, int size, remote_t *remote ) {
+  if( !initialized ) return;
+  if( ( ( struct sockaddr* )remote->addr )->sa_family == AF_INET6 ) {
+    sendto( send6, data, size, 0, ( struct sockaddr* )remote->addr, remote->size );
+  } else {
+    sendto( send4, data, size, 0, ( struct sockaddr* )remote->addr, remote->size );
+  }
+}
+
+// Creates a socket sharing port with the other workers, return 0 on success else < 0
+static int bind_worker( worker_t *w, int family, int core ) {
+  struct sockaddr_in  addr4;
+  struct sockaddr_in6 addr6;
+  int one = 1;
+  w->sock = socket( family, SOCK_DGRAM, IPPROTO_UDP );
+  if( w->sock == NET_INVALID_SOCKET ) return( -1 );
+#ifdef SO_REUSEPORT
+  if( setsockopt( w->sock, SOL_SOCKET, SO_REUSEPORT, ( char* )&one, sizeof( one ) ) < 0 ) return( -1 );
+#endif
+  if( family == AF_INET6 ) {
+    // Keep IPv4 on its own sockets so the kernel spreads each family separately
+    setsockopt( w->sock, IPPROTO_IPV6, IPV6_V6ONLY, ( char* )&one, sizeof( one ) );
+    memset( &addr6, 0, sizeof( addr6 ) );
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_any;
+    addr6.sin6_port = htons( port );
+    if( bind( w->sock, ( struct sockaddr* )&addr6, sizeof( addr6 ) ) < 0 ) return( -1 );
+    if( send6 == NET_INVALID_SOCKET ) send6 = w->sock;
+  } else {
+    net_addr_init( &addr4, NET_ADDR_ANY, port );
+    if( bind( w->sock, ( struct sockaddr* )&addr4, sizeof( addr4 ) ) < 0 ) return( -1 );
+    if( send4 == NET_INVALID_SOCKET ) send4 = w->sock;
+  }
+  w->core = core;
+  w->remote.addr = &w->addr;
+  w->remote.handler = &udpm;
+  return( 0 );
+}
+
+// Initializes network and binds one socket per thread and address family
+static void init() {
+  char temp[ CFG_VALUE_MAX_SIZE ];
+  int n, cores;
+
+  // Configuration
+  if( host->cfg_read( temp, "port" ) ) port = atoi( temp );
+  if( host->cfg_read( temp, "threads" ) ) threads = atoi( temp );
+  if( host->cfg_read( temp, "ipv4" ) ) use_ipv4 = atoi( temp );
+  if( host->cfg_read( temp, "ipv6" ) ) use_ipv6 = atoi( temp );
+
+  cores = sys_cpu_count();
+  if( threads <= 0 ) threads = cores;
+  threads = MIN( threads, MAX_THREADS );
+#ifndef SO_REUSEPORT
+  if( threads > 1 ) printf( "UDPM [warning]: SO_REUSEPORT not available, using one thread\n" );
+  threads = 1;
+#endif
+
+  // Initialize network
+  if( net_init() < 0 ) {
+    fprintf( stderr, "UDPM [error]: Network initialization failed\n" );
+    return;
+  }
+  for( n = 0; n < threads; n++ ) {
+    if( use_ipv4 ) {
+      if( bind_worker( &workers[ workers_count ], AF_INET, n % cores ) < 0 ) {
+        fprintf( stderr, "UDPM [error]: IPv4 socket bind failed\n" );
+        return;
+      }
+      workers_count++;
+    }
+    if( use_ipv6 ) {
+      if( bind_worker( &workers[ workers_count ], AF_INET6, n % cores ) < 0 ) {
+        fprintf( stderr, "UDPM [error]: IPv6 socket bind failed\n" );
+        return;
+      }
+      workers_count++;
+    }
+  }
+  if( workers_count == 0 ) {
+    fprintf( stderr, "UDPM [error]: Neither IPv4 nor IPv6 enabled\n" );
+    return;
+  }
+
+  printf( "UDPM [info]: Listening on port %i with %i sockets\n", port, workers_count );
+  initialized = 1;
+  for( n = 0; n < workers_count; n++ ) workers[ n ].h_thread = host->thread_start( receiver );
+}
+
+// Frees allocated resources
+static void closer() {
+  int n;
+  for( n = 0; n < workers_count; n++ ) {
+    if( workers[ n ].h_thread ) host->thread_stop( workers[ n ].h_thread );
+  }
+}
+
+// Sets up the plugin descriptor
+pluginclient_t *udpm_open( pluginhost_t *p_host ) {
+  memcpy( &udpm.ident, "UDPM", 4 );
+  host = p_host;
+  udpm.close      = closer;
+  udpm.init       = init;
+  udpm.comm_send  = sender;
+  return( &udpm );
+}
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <time.h>
+#include <SDL/SDL.h>
+#include <SDL/SDL_thread.h>
+#include "oswrap.h"
+#include "robocortex.h"
+#include "recorder.h"
+
+// Stream recorder. The main loop copies encoded frames into a single-producer single-consumer
+// ring without locking, an I/O thread drains it into large aligned writes. Frames that do not
+// fit the ring are dropped up to the next refresh point, so the encoder never waits on the disk
+
+#define REC_RING       ( 4 << 20 ) // Ring size (bytes, power of two), a few seconds of stream
+#define REC_CHUNK      ( 1 << 20 ) // Write size (bytes)
+#define REC_ALIGN           4096   // Write alignment (bytes), of buffer and file offsets
+#define REC_POLL              20   // I/O thread poll interval (ms)
+#define REC_FLUSH           1000   // Max time (ms) whole aligned blocks are held back
+#define REC_WRAP      0xFFFFFFFF   // Record size marking the rest of the ring unused
+
+// Ring record, followed by the frame, padded to 8 bytes
+typedef struct {
+  uint32_t           size;
+  uint32_t           time;             // Since the recording started (ms)
+  uint32_t           key;
+  uint32_t           ident;            // Encoding, encoder_e
+} rec_frame_t;
+
+#define REC_RECORD( size ) ( ( sizeof( rec_frame_t ) + ( size ) + 7 ) & ~7 )
+
+// Ring, head is only written by the producer and tail by the consumer
+static              char *ring;
+static volatile uint32_t  head, tail;     // Bytes written/read, positions modulo REC_RING
+static               int  wait_key = 1;   // Producer drops frames up to the next refresh point
+static            Uint32  rec_start;
+
+// I/O thread
+static        SDL_Thread *thread;
+static      volatile int  quit;
+static      volatile int  due;            // Segment waits on a refresh point to roll
+static              char *chunk_mem;      // Write buffer, chunk is chunk_mem aligned
+static              char *chunk;
+static               int  fill;
+static            Uint32  flush_time;
+
+// Segments
+static              char  base[ CFG_VALUE_MAX_SIZE ];
+static          uint64_t  max_bytes;
+static          uint32_t  max_ms;
+static              FILE *seg_f, *idx_f;
+static      unsigned int  seg_count;
+static          uint64_t  seg_size;
+static          uint32_t  seg_start, seg_ident;
+static          uint64_t  wall_start;
+
+// Statistics
+static      unsigned int  stat_frames;
+static      unsigned int  stat_dropped;   // Ring full
+static      unsigned int  stat_skipped;   // Waiting on a refresh point after a drop
+static          uint64_t  stat_bytes;
+static      unsigned int  stat_errors;    // Short writes
+static            Uint32  stat_write_max; // Slowest write (ms)
+
+/* == I/O THREAD ================================================================================ */
+
+// Writes the first size bytes of the write buffer, keeps the rest
+static void chunk_write( int size ) {
+  Uint32 start = SDL_GetTicks();
+  if( size == 0 ) return;
+  if( fwrite( chunk, 1, size, seg_f ) != size ) stat_errors++;
+  start = SDL_GetTicks() - start;
+  if( start > stat_write_max ) stat_write_max = start;
+  fill -= size;
+  memmove( chunk, chunk + size, fill );
+  flush_time = SDL_GetTicks();
+}
+
+static void segment_close() {
+  if( seg_f == NULL ) return;
+  chunk_write( fill );
+  fclose( seg_f );
+  fclose( idx_f );
+  seg_f = NULL;
+  idx_f = NULL;
+}
+
+// Opens segment files for frames of encoding ident, return 0 on success
+static int segment_open( uint32_t time, uint32_t ident ) {
+  char name[ CFG_VALUE_MAX_SIZE + 16 ];
+  rec_index_hdr_t hdr;
+  sprintf( name, "%s-%04u.%s", base, ++seg_count, ident == ENC_JPEG ? "jpeg" : "h264" );
+  seg_f = fopen( name, "wb" );
+  if( seg_f == NULL ) return( -1 );
+  // Writes are whole chunks already
+  setvbuf( seg_f, NULL, _IONBF, 0 );
+  sprintf( name, "%s-%04u.idx", base, seg_count );
+  idx_f = fopen( name, "wb" );
+  if( idx_f == NULL ) {
+    fclose( seg_f );
+    seg_f = NULL;
+    return( -1 );
+  }
+  memcpy( hdr.magic, "RIDX", 4 );
+  hdr.version = REC_INDEX_VERSION;
+  hdr.entry_size = sizeof( rec_index_t );
+  hdr.ident = ident;
+  hdr.start = wall_start;
+  fwrite( &hdr, sizeof( rec_index_hdr_t ), 1, idx_f );
+  seg_size = 0;
+  seg_start = time;
+  seg_ident = ident;
+  return( 0 );
+}
+
+// Appends a frame to the current segment, segments start and roll at refresh points
+static void frame_write( rec_frame_t *f, char *data ) {
+  rec_index_t entry;
+  int n, size;
+  if( seg_f ) {
+    if( f->ident != seg_ident
+     || ( max_bytes && seg_size + f->size > max_bytes )
+     || ( max_ms && f->time - seg_start >= max_ms ) ) {
+      if( f->key ) segment_close();
+      else due = 1;
+    }
+  }
+  if( seg_f == NULL ) {
+    if( !f->key ) return;
+    if( segment_open( f->time, f->ident ) != 0 ) {
+      stat_errors++;
+      return;
+    }
+  }
+  entry.offset = seg_size;
+  entry.time = f->time;
+  entry.size = f->size;
+  entry.flags = ( f->key ? REC_KEY : 0 );
+  entry.reserved = 0;
+  fwrite( &entry, sizeof( rec_index_t ), 1, idx_f );
+  for( size = f->size; size; size -= n, data += n ) {
+    n = MIN( size, REC_CHUNK - fill );
+    memcpy( chunk + fill, data, n );
+    fill += n;
+    if( fill == REC_CHUNK ) chunk_write( REC_CHUNK );
+  }
+  seg_size += f->size;
+  stat_bytes += f->size;
+  stat_frames++;
+}
+
+static int rec_thread( void *unused ) {
+  rec_frame_t *f;
+  uint32_t pos, end;
+  int done;
+  for( ;; ) {
+    done = quit;
+    end = head;
+    __sync_synchronize(); // Frame data before head
+    while( tail != end ) {
+      pos = tail & ( REC_RING - 1 );
+      f = ( rec_frame_t* )( ring + pos );
+      if( f->size == REC_WRAP ) {
+        tail += REC_RING - pos;
+        continue;
+      }
+      frame_write( f, ( char* )( f + 1 ) );
+      __sync_synchronize(); // Done reading before the producer may reuse it
+      tail += REC_RECORD( f->size );
+    }
+    // Whole blocks of a quiet stream go out anyway
+    if( seg_f && SDL_GetTicks() - flush_time >= REC_FLUSH ) {
+      chunk_write( fill & ~( REC_ALIGN - 1 ) );
+      fflush( idx_f );
+    }
+    if( done ) break;
+    SDL_Delay( REC_POLL );
+  }
+  segment_close();
+  return( 0 );
+}
+
+/* == INTERFACE ================================================================================= */
+
+int recorder_open( const char *path, int max_mb, int max_s ) {
+  strncpy( base, path, sizeof( base ) - 1 );
+  max_bytes = ( uint64_t )max_mb << 20;
+  max_ms = max_s * 1000;
+  ring = malloc( REC_RING );
+  chunk_mem = malloc( REC_CHUNK + REC_ALIGN );
+  if( ring == NULL || chunk_mem == NULL ) {
+    free( ring );
+    free( chunk_mem );
+    return( -1 );
+  }
+  chunk = ( char* )( ( ( uintptr_t )chunk_mem + REC_ALIGN - 1 ) & ~( uintptr_t )( REC_ALIGN - 1 ) );
+  rec_start = SDL_GetTicks();
+  wall_start = time( NULL );
+  flush_time = rec_start;
+  thread = SDL_CreateThread( rec_thread, NULL );
+  printf( "RoboCortex [info]: Recording to %s, segments of %i MB and %i s\n", path, max_mb, max_s );
+  return( 0 );
+}
+
+void recorder_close() {
+  quit = 1;
+  SDL_WaitThread( thread, NULL );
+  free( ring );
+  free( chunk_mem );
+  printf( "RoboCortex [info]: Recorded %u frames, %llu bytes in %u segments, slowest write %u ms\n",
+    stat_frames, ( unsigned long long )stat_bytes, seg_count, stat_write_max );
+  printf( "RoboCortex [info]: Recorder dropped %u frames with the disk behind, %u more up to a refresh point, %u write errors\n",
+    stat_dropped, stat_skipped, stat_errors );
+}
+
+void recorder_push( const char *data, int size, int key, int ident ) {
+  rec_frame_t *f;
+  uint32_t pos = head & ( REC_RING - 1 ), need = REC_RECORD( size ), gap = 0;
+  if( wait_key && !key ) {
+    stat_skipped++;
+    return;
+  }
+  // Records do not wrap, the rest of the ring is skipped instead
+  if( need > REC_RING - pos ) gap = REC_RING - pos;
+  if( need + gap > REC_RING - ( head - tail ) ) {
+    stat_dropped++;
+    wait_key = 1;
+    return;
+  }
+  wait_key = 0;
+  if( gap ) {
+    ( ( rec_frame_t* )( ring + pos ) )->size = REC_WRAP;
+    pos = 0;
+  }
+  f = ( rec_frame_t* )( ring + pos );
+  f->size = size;
+  f->time = SDL_GetTicks() - rec_start;
+  f->key = key;
+  f->ident = ident;
+  memcpy( f + 1, data, size );
+  __sync_synchronize(); // Frame data before head
+  head += gap + need;
+}
+
+int recorder_due() {
+  if( !due ) return( 0 );
+  due = 0;
+  return( 1 );
+}
+
+int recorder_seek( const rec_index_t *index, int count, uint32_t time ) {
+  int lo = 0, hi = count - 1, mid, n = -1;
+  // Last entry at or before time
+  while( lo <= hi ) {
+    mid = ( lo + hi ) / 2;
+    if( index[ mid ].time <= time ) {
+      n = mid;
+      lo = mid + 1;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  // Back to its refresh point
+  while( n >= 0 && !( index[ n ].flags & REC_KEY ) ) n--;
+  return( n );
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <SDL/SDL.h>
+#include "oswrap.h"
+#include "robocortex.h"
+#include "rtp.h"
+
+// RTP/H.264 output, RFC 6184 packetization mode 1. The encoder's Annex-B access units are split
+// at start codes, NAL units that fit a packet go out as they are, larger ones as FU-A fragments.
+// Lets standard tools (ffplay, GStreamer, an NVR) view the stream through the SDP file
+
+#define RTP_MTU             1400 // Max RTP packet size (bytes), within an ethernet frame
+#define RTP_HEADER            12
+#define RTP_PT                96 // Dynamic payload type
+#define RTP_CLOCK             90 // Timestamp units per ms
+#define RTP_FU_A              28 // NAL unit type of a fragmentation unit
+#define RTP_PSET_MAX         256 // Max size of a stored parameter set
+
+static          NET_SOCK  sock;
+static          NET_ADDR  addr;
+static              char  dest_ip[ 32 ];
+static          uint16_t  dest_port;
+static              char  sdp_path[ CFG_VALUE_MAX_SIZE ];
+static              char  packet[ RTP_MTU ];
+static          uint16_t  seq;
+static          uint32_t  ts_base, ssrc;
+
+// Last parameter sets, the SDP is written again when they change
+static              char  sps[ RTP_PSET_MAX ], pps[ RTP_PSET_MAX ];
+static               int  sps_size, pps_size;
+static               int  sdp_stale;
+
+// Statistics
+static      unsigned int  stat_frames;
+static      unsigned int  stat_packets;
+static      unsigned int  stat_fragmented;       // NAL units sent as FU-A
+static      unsigned int  stat_errors;           // Failed sends
+
+/* == SDP ======================================================================================= */
+
+static void base64( char *dst, const char *src, int size ) {
+  static const char *digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  uint32_t v;
+  int n;
+  for( n = 0; n < size; n += 3 ) {
+    v = ( uint8_t )src[ n ] << 16;
+    if( n + 1 < size ) v |= ( uint8_t )src[ n + 1 ] << 8;
+    if( n + 2 < size ) v |= ( uint8_t )src[ n + 2 ];
+    *dst++ = digits[ ( v >> 18 ) & 63 ];
+    *dst++ = digits[ ( v >> 12 ) & 63 ];
+    *dst++ = ( n + 1 < size ? digits[ ( v >> 6 ) & 63 ] : '=' );
+    *dst++ = ( n + 2 < size ? digits[ v & 63 ] : '=' );
+  }
+  *dst = 0;
+}
+
+static void sdp_write() {
+  char sps64[ RTP_PSET_MAX * 4 / 3 + 4 ], pps64[ RTP_PSET_MAX * 4 / 3 + 4 ];
+  FILE *f;
+  sdp_stale = 0;
+  f = fopen( sdp_path, "w" );
+  if( f == NULL ) {
+    printf( "RoboCortex [warning]: Unable to write %s\n", sdp_path );
+    return;
+  }
+  base64( sps64, sps, sps_size );
+  base64( pps64, pps, pps_size );
+  fprintf( f, "v=0\n" );
+  fprintf( f, "o=- %u 0 IN IP4 %s\n", ssrc, dest_ip );
+  fprintf( f, "s=RoboCortex\n" );
+  fprintf( f, "c=IN IP4 %s\n", dest_ip );
+  fprintf( f, "t=0 0\n" );
+  fprintf( f, "m=video %u RTP/AVP %u\n", dest_port, RTP_PT );
+  fprintf( f, "a=rtpmap:%u H264/90000\n", RTP_PT );
+  // Profile, constraints and level are bytes 1 to 3 of the SPS
+  fprintf( f, "a=fmtp:%u packetization-mode=1;profile-level-id=%02X%02X%02X;sprop-parameter-sets=%s,%s\n",
+    RTP_PT, ( uint8_t )sps[ 1 ], ( uint8_t )sps[ 2 ], ( uint8_t )sps[ 3 ], sps64, pps64 );
+  fclose( f );
+  printf( "RoboCortex [info]: RTP session described in %s\n", sdp_path );
+}
+
+// Keeps a parameter set, marks the SDP stale if it changed
+static void pset_keep( char *dst, int *dst_size, const char *nal, int size ) {
+  if( size > RTP_PSET_MAX ) return;
+  if( size == *dst_size && memcmp( dst, nal, size ) == 0 ) return;
+  memcpy( dst, nal, size );
+  *dst_size = size;
+  sdp_stale = 1;
+}
+
+/* == PACKETIZATION ============================================================================= */
+
+static void packet_send( int size, int marker, uint32_t ts ) {
+  packet[ 0 ] = 0x80; // Version 2, no padding, extension or CSRC
+  packet[ 1 ] = ( marker ? 0x80 : 0 ) | RTP_PT;
+  packet[ 2 ] = seq >> 8;
+  packet[ 3 ] = seq;
+  packet[ 4 ] = ts >> 24;
+  packet[ 5 ] = ts >> 16;
+  packet[ 6 ] = ts >> 8;
+  packet[ 7 ] = ts;
+  packet[ 8 ] = ssrc >> 24;
+  packet[ 9 ] = ssrc >> 16;
+  packet[ 10 ] = ssrc >> 8;
+  packet[ 11 ] = ssrc;
+  seq++;
+  if( net_send( &sock, packet, size, &addr ) != size ) stat_errors++;
+  stat_packets++;
+}
+
+// Sends one NAL unit (without start code), marker is set on the last packet of an access unit
+static void nal_send( const char *nal, int size, int last, uint32_t ts ) {
+  const int room = RTP_MTU - RTP_HEADER - 2;
+  int n, type = nal[ 0 ] & 0x1F;
+  if( size <= RTP_MTU - RTP_HEADER ) {
+    // Single NAL unit packet
+    memcpy( packet + RTP_HEADER, nal, size );
+    packet_send( RTP_HEADER + size, last, ts );
+    return;
+  }
+  // FU-A: indicator keeps F and NRI, header carries start/end bits and the NAL unit type
+  stat_fragmented++;
+  packet[ RTP_HEADER ] = ( nal[ 0 ] & 0xE0 ) | RTP_FU_A;
+  for( nal++, size--, n = 0; size; nal += n, size -= n ) {
+    packet[ RTP_HEADER + 1 ] = ( n == 0 ? 0x80 : 0 ) | ( size <= room ? 0x40 : 0 ) | type;
+    n = MIN( size, room );
+    memcpy( packet + RTP_HEADER + 2, nal, n );
+    packet_send( RTP_HEADER + 2 + n, last && n == size, ts );
+  }
+}
+
+/* == INTERFACE ================================================================================= */
+
+int rtp_open( const char *dest, const char *sdp ) {
+  char *colon;
+  strncpy( dest_ip, dest, sizeof( dest_ip ) - 1 );
+  colon = strchr( dest_ip, ':' );
+  if( colon == NULL ) return( -1 );
+  *colon = 0;
+  dest_port = atoi( colon + 1 );
+  if( dest_port == 0 ) return( -1 );
+  if( net_sock( &sock ) < 0 ) return( -1 );
+  net_addr_init( &addr, net_dtoa( dest_ip ), dest_port );
+  // Random starting points, RFC 3550
+  if( sys_random( &ssrc, sizeof( ssrc ) ) < 0 ) ssrc = SDL_GetTicks();
+  sys_random( &seq, sizeof( seq ) );
+  sys_random( &ts_base, sizeof( ts_base ) );
+  if( sdp ) strncpy( sdp_path, sdp, sizeof( sdp_path ) - 1 );
+  printf( "RoboCortex [info]: RTP output to %s:%u, ssrc %08X\n", dest_ip, dest_port, ssrc );
+  return( 0 );
+}
+
+void rtp_close() {
+  printf( "RoboCortex [info]: RTP sent %u frames in %u packets, %u NAL units fragmented, %u send errors\n",
+    stat_frames, stat_packets, stat_fragmented, stat_errors );
+}
+
+void rtp_send( const char *data, int size, uint32_t time ) {
+  const char *end = data + size, *p = data, *nal = NULL, *next;
+  uint32_t ts = ts_base + time * RTP_CLOCK;
+  int nal_size;
+  // Split at start codes, zeros before a start code belong to it
+  for( ;; ) {
+    while( p + 3 <= end && !( p[ 0 ] == 0 && p[ 1 ] == 0 && p[ 2 ] == 1 ) ) p++;
+    next = ( p + 3 <= end ? p + 3 : end );
+    if( nal ) {
+      nal_size = p + 3 <= end ? p - nal : end - nal;
+      while( nal_size && nal[ nal_size - 1 ] == 0 ) nal_size--;
+      if( nal_size ) {
+        switch( nal[ 0 ] & 0x1F ) {
+          case 7: pset_keep( sps, &sps_size, nal, nal_size ); break;
+          case 8: pset_keep( pps, &pps_size, nal, nal_size ); break;
+        }
+        nal_send( nal, nal_size, next == end, ts );
+      }
+    }
+    if( next == end ) break;
+    nal = p = next;
+  }
+  if( sdp_stale && sdp_path[ 0 ] && sps_size >= 4 && pps_size ) sdp_write();
+  stat_frames++;
+}
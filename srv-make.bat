@@ -28,9 +28,25 @@ IF ERRORLEVEL 1 GOTO ERROR
 ECHO Compiling utils.c...
 gcc utils.c -c %CFLAGS% -I./include
 
+ECHO Compiling enc_x264.c...
+gcc enc_x264.c -c %CFLAGS% -I./include
+IF ERRORLEVEL 1 GOTO ERROR
+
+ECHO Compiling enc_jpeg.c...
+gcc enc_jpeg.c -c %CFLAGS% -I./include
+IF ERRORLEVEL 1 GOTO ERROR
+
+ECHO Compiling recorder.c...
+gcc recorder.c -c %CFLAGS% -I./include
+IF ERRORLEVEL 1 GOTO ERROR
+
+ECHO Compiling rtp.c...
+gcc rtp.c -c %CFLAGS% -I./include
+IF ERRORLEVEL 1 GOTO ERROR
+
 ECHO Linking...
-g++ oswrap.o capture.o srv.o speech.o utils.o %LFLAGS% -L ./lib-w32                               -lsdl -lkernel32 -lwsock32 -lx264 -lmsvcrt -lswscale -lavutil -lvideoinput -lddraw -ldxguid -lole32 -loleaut32 -lstrmiids -luuid -lsam -lrcplug_srv -o bin/srv.exe
-g++ oswrap.o capture.o srv.o speech.o utils.o %LFLAGS% -L ./lib-w32 -mwindows -lmingw32 -lsdlmain -lsdl -lkernel32 -lwsock32 -lx264 -lmsvcrt -lswscale -lavutil -lvideoinput -lddraw -ldxguid -lole32 -loleaut32 -lstrmiids -luuid -lsam -lrcplug_srv -o bin/srv_sdl.exe
+g++ oswrap.o capture.o srv.o speech.o utils.o enc_x264.o enc_jpeg.o recorder.o rtp.o %LFLAGS% -L ./lib-w32                               -lsdl -lkernel32 -lws2_32 -lwsock32 -ladvapi32 -lx264 -ljpeg -lmsvcrt -lswscale -lavutil -lvideoinput -lddraw -ldxguid -lole32 -loleaut32 -lstrmiids -luuid -lsam -lrcplug_srv -o bin/srv.exe
+g++ oswrap.o capture.o srv.o speech.o utils.o enc_x264.o enc_jpeg.o recorder.o rtp.o %LFLAGS% -L ./lib-w32 -mwindows -lmingw32 -lsdlmain -lsdl -lkernel32 -lws2_32 -lwsock32 -ladvapi32 -lx264 -ljpeg -lmsvcrt -lswscale -lavutil -lvideoinput -lddraw -ldxguid -lole32 -loleaut32 -lstrmiids -luuid -lsam -lrcplug_srv -o bin/srv_sdl.exe
 IF ERRORLEVEL 1 GOTO ERROR
 
 ECHO Cleaning up...
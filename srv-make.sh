@@ -18,8 +18,20 @@ gcc oswrap.c -c $CFLAGS -I./include -o oswrap.o
 echo Compiling utils.c...
 gcc utils.c -c $CFLAGS -I./include -o utils.o
 
+echo Compiling enc_x264.c...
+gcc enc_x264.c -c $CFLAGS -I./include -o enc_x264.o
+
+echo Compiling enc_jpeg.c...
+gcc enc_jpeg.c -c $CFLAGS -I./include -o enc_jpeg.o
+
+echo Compiling recorder.c...
+gcc recorder.c -c $CFLAGS -I./include -o recorder.o
+
+echo Compiling rtp.c...
+gcc rtp.c -c $CFLAGS -I./include -o rtp.o
+
 echo Linking...
-g++ capture.o srv.o oswrap.o speech.o utils.o $LFLAGS -L./lib-linux -lsam -lSDL -lcv -lhighgui -lx264 -lswscale -lavutil -lcv -lrcplug_srv -o bin/srv
+g++ capture.o srv.o oswrap.o speech.o utils.o enc_x264.o enc_jpeg.o recorder.o rtp.o $LFLAGS -L./lib-linux -lsam -lSDL -lcv -lhighgui -lx264 -ljpeg -lswscale -lavutil -lcv -lrcplug_srv -lrt -lpthread -o bin/srv
 
 echo Cleaning up...
 rm *.o
@@ -1,10 +1,16 @@
 #include <stdio.h>
 #include <signal.h>
+#include <time.h>
 #include <SDL/SDL.h>
 #include <libswscale/swscale.h>
-#include <x264.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "oswrap.h"
 #include "robocortex.h"
+#include "encoder.h"
+#include "recorder.h"
+#include "rtp.h"
 #include "speech.h"
 #include "plugins/srv.h"
 #include "sdl_console.h"
@@ -14,12 +20,24 @@
 extern pluginclient_t *kiwiray_open( pluginhost_t* );
 extern pluginclient_t *monitor_open( pluginhost_t* );
 extern pluginclient_t *ipv4udp_open( pluginhost_t* );
-
-// Save the stream
-//#define SAVE_STREAM            "server.h264"
+extern pluginclient_t *shm0_open( pluginhost_t* );
+extern pluginclient_t *udpm_open( pluginhost_t* );
+extern pluginclient_t *multipath_open( pluginhost_t* );
 
 // Protocol
 #define MAX_CLIENTS           10 // Max number of clients allowed in the quuee
+#define MAX_SPECTATORS       100 // Max number of watch-only clients, besides the queue
+
+// Spectators, share the controller's encoded frames
+#define SPECTATE               1 // Stream to queued clients and spectators
+#define SPECTATE_RATE       1000 // Max bitrate (kbps) per spectator
+#define SPEC_RING             16 // Frames queued for the fan-out thread
+#define SPEC_BURST           500 // Pacing budget (ms at spectate_rate) a spectator may send ahead
+#define SPEC_REFRESH        2000 // Min time (ms) between refreshes requested for spectators
+
+// Handshake
+#define COOKIE_BUCKET         10 // Seconds per HELO cookie time bucket (cookies are valid 1-2 buckets)
+#define LIMIT_UNKNOWN        100 // Max replies per second to unknown peers (COOK/LOST)
 
 // Capture (device may not be capable and return another size)
 #define CAP_SOURCES           16 // Max number of capture sources
@@ -31,6 +49,58 @@ extern pluginclient_t *ipv4udp_open( pluginhost_t* );
 // Default FPS
 #define FPS                   25 // FPS of streamed video (also requested capture FPS)
 
+// Default slices
+#define SLICES                 0 // Slices per frame, lets the client decode on several cores (0 = one)
+
+// Default composition
+#define STREAMS                0 // Encode each capture source as its own stream, composed by the client
+
+// Default simulcast
+#define SIMULCAST              0 // Also encode a half resolution H.264 layer for constrained clients
+#define SIMULCAST_RATE       128 // Max bitrate (kbps) of the reduced layer
+#define SIM_DOWN            1000 // Time (ms) of high loss before a client drops to the reduced layer
+#define SIM_UP             10000 // Time (ms) of low loss before a client returns to the full layer
+
+// Default recording
+#define RECORD_SIZE          256 // Segment size (MB) before rolling to the next, 0 for no limit
+#define RECORD_TIME          600 // Segment duration (s) before rolling to the next, 0 for no limit
+
+// Default encoder backend
+#define ENCODER         ENC_H264 // Backend used when the controlling client decodes it, else H.264
+#define JPEG_QUALITY          80 // JPEG quality (1-100) at CRF, for the intra-only backend
+
+// Default rate control, driven by client feedback in CTRL
+#define RATE_MAX             500 // Bitrate (kbps) on a clear link, VBV max rate
+#define RATE_MIN              64 // Bitrate (kbps) the controller will not go below
+#define CRF                   20 // Constant rate factor at RATE_MAX
+#define CRF_MAX               30 // Constant rate factor at RATE_MIN
+#define ABR_QUEUE             40 // Queuing delay (ms) above which a rising delay is overuse
+#define ABR_LOSS_LOW        0.02 // Loss fraction below which the rate may increase
+#define ABR_LOSS_HIGH       0.10 // Loss fraction above which the rate decreases
+#define ABR_DECREASE        0.85 // Rate multiplier on delay overuse
+#define ABR_INCREASE        0.08 // Rate increase per second when underused
+#define ABR_HOLD             500 // Time (ms) after a decrease before the rate changes again
+#define ABR_WINDOW          5000 // Time (ms) of minimum delay windows, base delay is the lower of two
+#define ABR_STEP_DOWN       1000 // Time (ms) below a rung's bitrate before stepping down the ladder
+#define ABR_STEP_UP         5000 // Time (ms) above the next rung's bitrate before stepping back up
+#define ABR_HISTORY          256 // Frames remembered for matching feedback to send times
+#define LADDER_MAX             8 // Max number of resolution ladder rungs
+
+// Default encoder governor, keeps compose+encode time within the frame budget
+#define PRESET                 3 // Best quality preset the governor uses, index into presets
+#define GOV_WINDOW          1000 // Time (ms) load is averaged over before deciding
+#define GOV_HIGH            0.80 // Load (fraction of frame budget) above which the encoder steps down
+#define GOV_LOW             0.45 // Load below which the encoder may step back up
+#define GOV_CALM               5 // Windows below GOV_LOW before stepping back up
+#define GOV_HOLD               2 // Windows after a step before deciding again
+#define GOV_CALIBRATE         10 // Frames timed per preset during startup calibration
+#define GOV_TARGET          0.50 // Calibrated load the initial preset must stay below
+
+// Default motion-adaptive frame rate
+#define FPS_MIN                2 // Encode rate (fps) of a static scene without input
+#define STILL_SAD              3 // Mean difference per sample (0-255) below which the scene is static
+#define STILL_STEP             4 // Change detection samples every n-th pixel of every n-th row
+
 // Default timeouts (in frames, see fps)
 #define TIMEOUT_CONNECTION   100 // Before connection is closed if no data has arrived
 #define TIMEOUT_CONTROL     7500 // Before control session is ended
@@ -49,7 +119,8 @@ enum exitcode_e {
   EXIT_AUDIO,
   EXIT_NOSOURCE,
   EXIT_CONFIG,
-  EXIT_MALLOC
+  EXIT_MALLOC,
+  EXIT_ENCODER
 };
 
 // Client data
@@ -67,10 +138,53 @@ struct client_t {
   int                got_first;
   ctrl_t             last;
   ctrl_t             diff;
+  ctrl_t             applied;
+  Uint32             ctrl_tick;        // Arrival time of last CTRL packet
   unsigned char      trust_data;
+  session_t          session;
+  int                encoders;         // Stream encodings the client decodes, encoder_e mask
+  int                spectator;        // Watches only, never queued for control
+  int                spec_wait;        // Spectator waits for a frame decoding can start at
+  double             spec_tokens;      // Spectator pacing budget (bytes)
+  Uint32             spec_time;        // Last pacing budget refill
+  int                layer;            // Simulcast layer streamed, 0 full, 1 reduced
+  Uint32             layer_time;       // Last time loss allowed staying on the layer
 };
 typedef struct client_t client_t;
 
+// Region of interest set by a plugin, in stream coordinates
+typedef struct {
+  SDL_Rect           r;
+  int                priority;
+} roi_t;
+
+// Resolution ladder rung, used while the target bitrate is at least kbps
+typedef struct {
+  int                w, h;
+  int                kbps;
+} rung_t;
+
+// Rate control state
+typedef struct {
+  client_t          *client;           // Client feedback is tracked for
+  double             rate;             // Target bitrate (kbps)
+  int                rate_set;         // Bitrate and quality the encoder is configured for
+  int                crf_set;
+  int                rung;             // Current ladder rung
+  int                started;          // Feedback baseline taken
+  uint32_t           frame;            // Newest frame feedback was processed for
+  unsigned short     recv, lost;       // Feedback counters at last update
+  int                delay;            // Last one-way delay sample (ms), offset by clock difference
+  int                base_prev, base;  // Minimum delay of previous and current window
+  int                window;           // Frames left in current minimum delay window
+  double             trend;            // Smoothed delay gradient (ms per frame)
+  double             loss;             // Smoothed loss fraction
+  int                age;              // Frames since last feedback
+  int                hold;             // Frames before the rate may change after a decrease
+  int                below, above;     // Frames the rate has been below/above ladder thresholds
+  Uint32             sent[ ABR_HISTORY ]; // Send time of recent frames
+} abr_t;
+
 // Capture setting
 typedef struct {
   int                enable;
@@ -78,17 +192,54 @@ typedef struct {
   int                dev;
   int                w, h;
   int                z;
+  int                priority;         // Encoding quality offset in QP steps, higher is better
+  int                enc_w, enc_h;     // Own stream size, fps and max bitrate (kbps), 0 for defaults
+  int                enc_fps, enc_rate;
   SDL_Rect           src, dst;
   uint8_t           *data;
   struct SwsContext *swsCtx;
 } capture_t;
 
+// Capture source encoded as its own stream, on its own thread
+typedef struct {
+  int                n;                // Capture source
+  encoder_t         *enc;
+  void              *inst;
+  enc_param_t        param;
+  int                rate_max;         // Bitrate (kbps) on a clear link, scaled by the rate control
+  int                skip;             // Encode every n-th main loop frame
+  int                refresh;          // Next frame is a full refresh
+  int                busy;             // Encoding current frame
+  struct SwsContext *sws;              // Crops and converts the capture to I420
+  uint8_t           *plane[ 3 ];
+  int                stride[ 3 ];
+  SDL_Thread        *thread;
+  SDL_sem           *go, *done;
+  enc_frame_t        out;
+  unsigned int       stat_frames;
+  unsigned int       stat_bytes;
+} stream_t;
+
+// Frame queued for spectators
+typedef struct {
+  char              *data;             // Packets, back to back
+  int                alloc;            // Bytes allocated in data
+  int                size;
+  int                count;
+  int                sizes[ ENC_PACKETS_MAX ];
+  int                key;              // Decoding can start at this frame
+  int                ident;            // Encoding, encoder_e
+  int                layer;            // Simulcast layer
+} spec_frame_t;
+
 // Locals
 static               int  quit     = 0; // Time to quit (SIGINT etc.)
 static               int  do_intra = 0; // Time to intra-refresh (New client connected)
 
 // Clients linked-list array
 static               int  max_clients = MAX_CLIENTS;
+static               int  max_spectators = MAX_SPECTATORS;
+static               int  client_slots;      // Queue followed by spectator slots
 static          client_t *clients;
 static          client_t *client_first = NULL;
 static          client_t *client_last  = NULL;
@@ -109,6 +260,20 @@ static              char  pkt_ctrl[ 4 ] = "CTRL";
 static              char  pkt_lost[ 4 ] = "LOST";
 static              char  pkt_full[ 4 ] = "FULL";
 static              char  pkt_quit[ 4 ] = "QUIT";
+static              char  pkt_cook[ 4 ] = "COOK";
+
+// Handshake cookies & unknown peer rate limiting
+static           uint8_t  cookie_key[ 16 ];
+static               int  limit_unknown = LIMIT_UNKNOWN;
+static               int  reply_tokens;
+static            Uint32  reply_time;
+static      unsigned int  stat_challenged;
+static      unsigned int  stat_rejected;
+static      unsigned int  stat_validated;
+static      unsigned int  stat_throttled;
+static      unsigned int  stat_unpadded;
+static          uint32_t  session_count;
+static      unsigned int  stat_resumed;
 
 // Configuration
 static           char  config_default[] = "srv.rc"; // Default configuration file
@@ -120,13 +285,127 @@ static         SDL_mutex *cap_mx;
 
 // Encoding and conversion
 static               int  stream_w = STREAM_WIDTH, stream_h = STREAM_HEIGHT, fps = FPS;
+static               int  slices = SLICES;
 static               int  stream_stride;
-static            x264_t *encoder;
-static    x264_picture_t  pic_in, pic_out;
+static         encoder_t *enc;                   // Active backend
+static              void *enc_inst;              // Its instance
+static         encoder_t *enc_x264, *enc_jpeg;
+static               int  enc_pref = ENCODER;    // Configured backend, encoder_e
+static       enc_param_t  eparam;
+static           uint8_t *pic_plane[ 3 ];        // I420 picture
+static               int  pic_stride[ 3 ];
+static               int  jpeg_quality = JPEG_QUALITY;
 static     unsigned char *pic_rgb24;
 static struct SwsContext *swsCtx;
-
-// Receive data mutex TODO: replace with buffering system and semaphore?
+static               int  enc_w, enc_h;          // Encoded size
+static               int  enc_rung;              // Current ladder rung
+
+// Per-source streams
+static               int  streams_enable = STREAMS;
+static          stream_t  streams[ CAP_SOURCES ];
+static      volatile int  streams_quit;
+static              char  strm_buffer[ 4 + sizeof( strm_data_t ) + ENC_PACKET_MAX ];
+
+// Spectator fan-out
+static               int  spectate = SPECTATE;
+static               int  spectate_rate = SPECTATE_RATE;
+static      spec_frame_t  spec_ring[ SPEC_RING ];
+static      spec_frame_t  spec_frame;            // Frame being fanned out
+static          uint32_t  spec_head;             // Frames queued
+static          uint32_t  spec_tail;             // Frames fanned out
+static         SDL_mutex *spec_mx;
+static           SDL_sem *spec_wake;
+static        SDL_Thread *spec_thread;
+static      volatile int  spec_quit;
+static      volatile int  spec_refresh;          // Layers (bitmask) a spectator needs a frame to decode from
+static            Uint32  spec_refresh_time;     // Time of last refresh for spectators
+static      unsigned int  stat_spec_frames;      // Frames fanned out
+static      unsigned int  stat_spec_sent;        // Frames sent to spectators
+static      unsigned int  stat_spec_paced;       // Frames dropped by spectator pacing
+static      unsigned int  stat_spec_overrun;     // Frames the fan-out thread fell behind on
+static      unsigned int  stat_spec_refresh;     // Refreshes requested for spectators
+
+// Simulcast reduced layer, downscaled and encoded on its own thread alongside the full layer
+static               int  simulcast = SIMULCAST;
+static               int  simulcast_rate = SIMULCAST_RATE;
+static              void *sim_inst;
+static       enc_param_t  sim_param;
+static           uint8_t *sim_plane[ 3 ];        // Half size I420 picture
+static               int  sim_stride[ 3 ];
+static       enc_frame_t  sim_out;
+static        SDL_Thread *sim_thread;
+static           SDL_sem *sim_go, *sim_done;
+static      volatile int  sim_quit;
+static               int  sim_refresh;           // Next reduced frame refreshes the whole picture
+static          uint64_t  stat_sim_cost;         // Downscale+encode time (us) of the reduced layer
+static      unsigned int  stat_sim_frames;
+static      unsigned int  stat_sim_down;         // Clients moved to the reduced layer
+static      unsigned int  stat_sim_up;           // Clients moved back to the full layer
+
+// Recording
+static              char  record[ CFG_VALUE_MAX_SIZE ]; // Segment path and name prefix, empty if off
+static               int  record_size = RECORD_SIZE;
+static               int  record_time = RECORD_TIME;
+
+// RTP output
+static              char  rtp_dest[ CFG_VALUE_MAX_SIZE ]; // Address:port, empty if off
+static              char  rtp_sdp[ CFG_VALUE_MAX_SIZE ];  // SDP file describing the session
+
+// Rate control
+static               int  abr_enable = 1;        // Adapt bitrate and resolution to client feedback
+static               int  rate_min = RATE_MIN, rate_max = RATE_MAX;
+static               int  crf = CRF, crf_max = CRF_MAX;
+static               int  abr_queue = ABR_QUEUE;
+static            rung_t  ladder[ LADDER_MAX ];
+static               int  ladder_count;
+static             abr_t  abr;
+static      unsigned int  stat_abr_delay;        // Decreases on delay overuse
+static      unsigned int  stat_abr_loss;         // Decreases on loss
+static      unsigned int  stat_abr_down;         // Ladder steps down
+static      unsigned int  stat_abr_up;           // Ladder steps up
+static            double  stat_abr_sum;          // Sum of target bitrate over streamed frames
+static      unsigned int  stat_abr_frames;
+
+// Encoder governor levels: effort levels, named after x264 presets, from best to fastest, then
+// half frame rate, then smaller ladder rungs
+static        const char *presets[] = { "veryslow", "slower", "slow", "medium", "fast", "faster", "veryfast", "superfast", "ultrafast" };
+#define PRESETS ( int )( sizeof( presets ) / sizeof( presets[ 0 ] ) )
+static               int  gov_enable = 1;        // Adapt encoder effort to the CPU budget
+static               int  preset = PRESET;
+static               int  gov_level;             // Current level, 0 is best quality
+static               int  gov_levels;            // Number of levels
+static               int  gov_skip = 1;          // Encode every n-th frame
+static               int  gov_rung;              // Smallest ladder rung allowed
+static          uint64_t  gov_cost;              // Compose+encode time (us) in current window
+static               int  gov_frames;            // Frames encoded in current window
+static               int  gov_window;            // Frames left in current window
+static               int  gov_late;              // Main loop fell behind in current window
+static               int  gov_calm;              // Windows with headroom in a row
+static               int  gov_hold;              // Windows before deciding again
+static      unsigned int  stat_gov_down;         // Governor steps down
+static      unsigned int  stat_gov_up;           // Governor steps up
+static            double  stat_gov_load;         // Sum of load over windows
+static      unsigned int  stat_gov_windows;
+
+// Motion-adaptive frame rate
+static               int  fps_min = FPS_MIN;     // Encode rate of a static scene, fps or higher disables
+static               int  still_sad = STILL_SAD;
+static           uint8_t *still_ref;             // Samples of last encoded frame
+static           uint8_t *still_cur;             // Samples of current frame
+static      unsigned int  still_last;            // Frame number (main loop) last encoded
+static      volatile int  still_wake;            // Trusted data arrived, encode next frame
+static               int  still;                 // Scene is static, frames come at fps_min
+static      unsigned int  stat_still;            // Frames skipped on a static scene
+
+// Region-of-interest map, per-macroblock QP offsets passed to the encoder
+static             roi_t  roi[ ROI_MAX ];        // Plugin regions, priority 0 is unused
+static             float *roi_map;
+static               int  roi_size;              // Macroblocks allocated in roi_map
+static               int  roi_active;            // Map has any non-zero offset
+static      volatile int  roi_dirty = 1;         // Layout changed, rebuild before next frame
+static      unsigned int  stat_roi_builds;
+
+// Receive data mutex, serializes control/trust data and handshakes between transport threads
 static         SDL_mutex *receive_mx;
 
 // Timeouts
@@ -176,6 +455,7 @@ static void trust_handler( client_t *p_client, char* data, int size ) {
   if( size == 0 ) return;
   data[ size ] = 0;
   p_client->trust_cli++;
+  still_wake = 1;
 
   // Pass data to plugins
   while( size > 5 ) {
@@ -207,6 +487,123 @@ static void trust_clear() {
   trust_timeout = 0;
 }
 
+/* == HANDSHAKE COOKIES ========================================================================= */
+
+// SipHash-2-4 round
+#define SIPROUND( v0, v1, v2, v3 ) do { \
+  v0 += v1; v1 = ( v1 << 13 ) | ( v1 >> 51 ); v1 ^= v0; v0 = ( v0 << 32 ) | ( v0 >> 32 ); \
+  v2 += v3; v3 = ( v3 << 16 ) | ( v3 >> 48 ); v3 ^= v2; \
+  v0 += v3; v3 = ( v3 << 21 ) | ( v3 >> 43 ); v3 ^= v0; \
+  v2 += v1; v1 = ( v1 << 17 ) | ( v1 >> 47 ); v1 ^= v2; v2 = ( v2 << 32 ) | ( v2 >> 32 ); \
+} while( 0 )
+
+// Domain of a keyed MAC, first byte of its input so a value for one use is never valid for another
+enum mac_e {
+  MAC_COOKIE = 1,
+  MAC_SESSION,
+  MAC_PLUGIN
+};
+
+// Keyed MAC (SipHash-2-4) of data using cookie_key
+static uint64_t siphash( const uint8_t *data, int size ) {
+  uint64_t k0, k1, v0, v1, v2, v3, m;
+  uint64_t b = ( ( uint64_t )size ) << 56;
+  int n;
+  memcpy( &k0, cookie_key, 8 );
+  memcpy( &k1, cookie_key + 8, 8 );
+  v0 = k0 ^ 0x736f6d6570736575ULL;
+  v1 = k1 ^ 0x646f72616e646f6dULL;
+  v2 = k0 ^ 0x6c7967656e657261ULL;
+  v3 = k1 ^ 0x7465646279746573ULL;
+  for( ; size >= 8; size -= 8, data += 8 ) {
+    m = 0;
+    for( n = 7; n >= 0; n-- ) m = ( m << 8 ) | data[ n ];
+    v3 ^= m;
+    SIPROUND( v0, v1, v2, v3 );
+    SIPROUND( v0, v1, v2, v3 );
+    v0 ^= m;
+  }
+  for( n = size - 1; n >= 0; n-- ) b |= ( ( uint64_t )data[ n ] ) << ( n * 8 );
+  v3 ^= b;
+  SIPROUND( v0, v1, v2, v3 );
+  SIPROUND( v0, v1, v2, v3 );
+  v0 ^= b;
+  v2 ^= 0xFF;
+  for( n = 0; n < 4; n++ ) SIPROUND( v0, v1, v2, v3 );
+  return( v0 ^ v1 ^ v2 ^ v3 );
+}
+
+// Generates the secret cookie key, falls back to a weak key if no secure source is available
+static void cookie_init() {
+  Uint32 seed;
+  int n;
+  if( sys_random( cookie_key, sizeof( cookie_key ) ) < 0 ) {
+    printf( "RoboCortex [warning]: No secure random source, HELO cookies are predictable\n" );
+    seed = SDL_GetTicks() ^ ( Uint32 )time( NULL );
+    srand( seed );
+    for( n = 0; n < sizeof( cookie_key ); n++ ) cookie_key[ n ] = rand();
+  }
+}
+
+// Calculates the cookie for a remote address in the specified time bucket
+static uint64_t cookie_make( remote_t *remote, uint32_t bucket ) {
+  uint8_t msg[ 1 + 4 + 64 ];
+  int size = MIN( remote->size, 64 );
+  msg[ 0 ] = MAC_COOKIE;
+  memcpy( msg + 1, &bucket, 4 );
+  memcpy( msg + 1 + 4, remote->addr, size );
+  return( siphash( msg, 1 + 4 + size ) );
+}
+
+// Validates a cookie returned by a remote, accepts current and previous time bucket
+static int cookie_check( remote_t *remote, char *cookie ) {
+  uint32_t bucket = SDL_GetTicks() / ( COOKIE_BUCKET * 1000 );
+  uint64_t value;
+  memcpy( &value, cookie, 8 );
+  if( value == cookie_make( remote, bucket ) ) return( 1 );
+  if( value == cookie_make( remote, bucket - 1 ) ) return( 1 );
+  return( 0 );
+}
+
+// Sends COOK+cookie to an unknown remote
+static void cookie_send( remote_t *remote ) {
+  char buffer[ 4 + 8 ];
+  uint64_t value = cookie_make( remote, SDL_GetTicks() / ( COOKIE_BUCKET * 1000 ) );
+  memcpy( buffer, pkt_cook, 4 );
+  memcpy( buffer + 4, &value, 8 );
+  ( ( pluginclient_t* )( remote->handler ) )->comm_send( buffer, 4 + 8, remote );
+}
+
+// Issues a new session token for a client entry
+static void session_issue( client_t *p_client, uint32_t index ) {
+  uint8_t msg[ 1 + 8 ];
+  uint32_t count = ++session_count;
+  uint64_t tag;
+  msg[ 0 ] = MAC_SESSION;
+  memcpy( msg + 1, &index, 4 );
+  memcpy( msg + 1 + 4, &count, 4 );
+  tag = siphash( msg, 1 + 8 );
+  p_client->session.index = index;
+  memcpy( p_client->session.tag, &tag, 8 );
+}
+
+// Token bucket limiting replies to unknown peers, returns 1 if a reply may be sent
+static int reply_allow() {
+  Uint32 now = SDL_GetTicks();
+  Uint32 elapsed = MIN( now - reply_time, 1000 );
+  int refill = elapsed * limit_unknown / 1000;
+  if( refill > 0 ) {
+    reply_tokens = MIN( reply_tokens + refill, limit_unknown );
+    reply_time = now;
+  }
+  if( reply_tokens > 0 ) {
+    reply_tokens--;
+    return( 1 );
+  }
+  stat_throttled++;
+  return( 0 );
+}
+
 /* == CONFIGURATION ============================================================================= */
 
 static int config_set( char *value, char *token ) {
@@ -218,8 +615,64 @@ static int config_set( char *value, char *token ) {
       stream_h = atoi( value );
     } else if( strcmp( token, "fps" ) == 0 ) {
       fps = atoi( value );
+    } else if( strcmp( token, "fps_min" ) == 0 ) {
+      fps_min = atoi( value );
+    } else if( strcmp( token, "still_sad" ) == 0 ) {
+      still_sad = atoi( value );
+    } else if( strcmp( token, "slices" ) == 0 ) {
+      slices = atoi( value );
+    } else if( strcmp( token, "streams" ) == 0 ) {
+      streams_enable = atoi( value );
+    } else if( strcmp( token, "simulcast" ) == 0 ) {
+      simulcast = atoi( value );
+    } else if( strcmp( token, "simulcast_rate" ) == 0 ) {
+      simulcast_rate = atoi( value );
+    } else if( strcmp( token, "encoder" ) == 0 ) {
+      if( strcmp( value, "x264" ) == 0 ) enc_pref = ENC_H264;
+      else if( strcmp( value, "jpeg" ) == 0 ) enc_pref = ENC_JPEG;
+      else printf( "Config [warning]: unknown encoder %s\n", value );
+    } else if( strcmp( token, "jpeg_quality" ) == 0 ) {
+      jpeg_quality = atoi( value );
+    } else if( strcmp( token, "record" ) == 0 ) {
+      strcpy( record, value );
+    } else if( strcmp( token, "record_size" ) == 0 ) {
+      record_size = atoi( value );
+    } else if( strcmp( token, "record_time" ) == 0 ) {
+      record_time = atoi( value );
+    } else if( strcmp( token, "rtp" ) == 0 ) {
+      strcpy( rtp_dest, value );
+    } else if( strcmp( token, "rtp_sdp" ) == 0 ) {
+      strcpy( rtp_sdp, value );
+    } else if( strcmp( token, "governor" ) == 0 ) {
+      gov_enable = atoi( value );
+    } else if( strcmp( token, "preset" ) == 0 ) {
+      for( n = 0; n < PRESETS; n++ ) if( strcmp( value, presets[ n ] ) == 0 ) break;
+      if( n == PRESETS ) printf( "Config [warning]: unknown preset %s\n", value );
+      else preset = n;
+    } else if( strcmp( token, "abr" ) == 0 ) {
+      abr_enable = atoi( value );
+    } else if( strcmp( token, "rate_min" ) == 0 ) {
+      rate_min = atoi( value );
+    } else if( strcmp( token, "rate_max" ) == 0 ) {
+      rate_max = atoi( value );
+    } else if( strcmp( token, "crf" ) == 0 ) {
+      crf = atoi( value );
+    } else if( strcmp( token, "crf_max" ) == 0 ) {
+      crf_max = atoi( value );
+    } else if( strcmp( token, "abr_queue" ) == 0 ) {
+      abr_queue = atoi( value );
+    } else if( strcmp( token, "ladder" ) == 0 ) {
+      if( ladder_count >= LADDER_MAX ) printf( "Config [warning]: too many ladder rungs.\n" );
+      else if( sscanf( value, "%ix%i %i", &ladder[ ladder_count ].w, &ladder[ ladder_count ].h, &ladder[ ladder_count ].kbps ) != 3 ) printf( "Config [warning]: ladder expects WxH kbps\n" );
+      else ladder_count++;
     } else if( strcmp( token, "queue" ) == 0 ) {
       max_clients = atoi( value );
+    } else if( strcmp( token, "spectators" ) == 0 ) {
+      max_spectators = atoi( value );
+    } else if( strcmp( token, "spectate" ) == 0 ) {
+      spectate = atoi( value );
+    } else if( strcmp( token, "spectate_rate" ) == 0 ) {
+      spectate_rate = atoi( value );
     } else if( strcmp( token, "timeout_connection" ) == 0 ) {
       timeout_connection = atoi( value );
     } else if( strcmp( token, "timeout_control" ) == 0 ) {
@@ -228,6 +681,8 @@ static int config_set( char *value, char *token ) {
       timeout_trust = atoi( value );
     } else if( strcmp( token, "timeout_glitch" ) == 0 ) {
       timeout_glitch = atoi( value );
+    } else if( strcmp( token, "limit_unknown" ) == 0 ) {
+      limit_unknown = atoi( value );
     } else if( strcmp( token, "device" ) == 0 ) {
       if( cap_count >= ( CAP_SOURCES - 1 ) ) printf( "Config [warning]: too many capture sources.\n" );
       else {
@@ -250,6 +705,9 @@ static int config_set( char *value, char *token ) {
         rect( &cap[ cap_count ].src, cap[ cap_count ].src.x, 0, cap[ cap_count ].src.w, cap[ cap_count ].h );
         rect( &cap[ cap_count ].dst, cap[ cap_count ].dst.x, 0, cap[ cap_count ].dst.w, stream_h );
       }
+    } else if( strcmp( token, "priority" ) == 0 ) {
+      if( cap_count < 0 ) printf( "Config [warning]: priority outside device section\n" );
+      else cap[ cap_count ].priority = atoi( value );
     } else if( strcmp( token, "src_x" ) == 0 ) {
       if( cap_count < 0 ) printf( "Config [warning]: src_x outside device section\n" );
       else cap[ cap_count ].src.x = atoi( value );
@@ -274,6 +732,18 @@ static int config_set( char *value, char *token ) {
     } else if( strcmp( token, "dst_h" ) == 0 ) {
       if( cap_count < 0 ) printf( "Config [warning]: dst_h outside device section\n" );
       else cap[ cap_count ].dst.h = atoi( value );
+    } else if( strcmp( token, "enc_w" ) == 0 ) {
+      if( cap_count < 0 ) printf( "Config [warning]: enc_w outside device section\n" );
+      else cap[ cap_count ].enc_w = atoi( value );
+    } else if( strcmp( token, "enc_h" ) == 0 ) {
+      if( cap_count < 0 ) printf( "Config [warning]: enc_h outside device section\n" );
+      else cap[ cap_count ].enc_h = atoi( value );
+    } else if( strcmp( token, "enc_fps" ) == 0 ) {
+      if( cap_count < 0 ) printf( "Config [warning]: enc_fps outside device section\n" );
+      else cap[ cap_count ].enc_fps = atoi( value );
+    } else if( strcmp( token, "enc_rate" ) == 0 ) {
+      if( cap_count < 0 ) printf( "Config [warning]: enc_rate outside device section\n" );
+      else cap[ cap_count ].enc_rate = atoi( value );
     } else if( strcmp( token, "plugin" ) == 0 ) {
       return( 1 );
     } else printf( "Config [warning]: unknown entry %s\n", token );
@@ -293,8 +763,8 @@ static int config_set( char *value, char *token ) {
 
 /* == CLIENTS MANAGEMENT ======================================================================== */
 
-// Add client, return index or -1 if queue is full
-static client_t *clients_add( remote_t *remote ) {
+// Add client, spectators are kept out of the queue, return NULL if queue or spectator slots are full
+static client_t *clients_add( remote_t *remote, int spectator ) {
   int n, pid;
   client_t *p_ret = NULL;
   // Iterate client table
@@ -312,6 +782,7 @@ static client_t *clients_add( remote_t *remote ) {
         clients->trust_srv = 0x00;
         clients->got_first = 0;
         clients->timeout = timeout_connection;
+        session_issue( clients, 0 );
         do_intra = 1;
         // plugin->connected( 1 )
         for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ )
@@ -324,6 +795,26 @@ static client_t *clients_add( remote_t *remote ) {
       host.diff = &client_first->diff;
     }
     p_ret = clients;
+  } else if( spectator ) {
+    for( n = max_clients; n < client_slots; n++ ) {
+      // Find free spectator entry
+      if( !clients[ n ].timeout ) {
+        printf( "RoboCortex [info]: Spectator %i connected\n", n );
+        if( clients[ n ].remote.addr ) free( clients[ n ].remote.addr );
+        clients[ n ].remote.addr = malloc( remote->size );
+        // TODO: check
+        memcpy( clients[ n ].remote.addr, remote->addr, remote->size );
+        clients[ n ].remote.size = remote->size;
+        clients[ n ].remote.handler = remote->handler;
+        clients[ n ].next = NULL;
+        clients[ n ].prev = NULL;
+        clients[ n ].timeout = timeout_connection;
+        clients[ n ].timer   = 0;
+        session_issue( &clients[ n ], n );
+        p_ret = &clients[ n ];
+        break;
+      }
+    }
   } else {
     for( n = 0; n < max_clients; n++ ) {
     	// Find free client entry
@@ -343,6 +834,7 @@ static client_t *clients_add( remote_t *remote ) {
         clients[ n ].got_first = 0;
         clients[ n ].timeout = timeout_connection;
         clients[ n ].timer   = timeout_control;
+        session_issue( &clients[ n ], n );
         if( client_first ) {
           client_last->next = &clients[ n ];
         } else {
@@ -361,6 +853,13 @@ static client_t *clients_add( remote_t *remote ) {
       }
     }
   }
+  if( p_ret ) {
+    // Video to a new viewer starts at a frame it can decode from
+    p_ret->spectator = spectator;
+    p_ret->spec_wait = 1;
+    p_ret->spec_tokens = 0;
+    p_ret->spec_time = SDL_GetTicks();
+  }
   SDL_mutexV( client_mx );
   return( p_ret );
 }
@@ -370,7 +869,7 @@ static client_t *clients_find( remote_t *remote ) {
   int n;
   client_t *p_ret = NULL;
   SDL_mutexP( client_mx );
-  for( n = 0; n < max_clients; n++ ) {
+  for( n = 0; n < client_slots; n++ ) {
     if( clients[ n ].timeout ) {
       if( clients[ n ].remote.size == remote->size ) {
         if( memcmp( clients[ n ].remote.addr, remote->addr, remote->size ) == 0 ) {
@@ -381,10 +880,49 @@ static client_t *clients_find( remote_t *remote ) {
     }
   }
   SDL_mutexV( client_mx );
-  if( direct ) p_ret = clients_add( remote );
+  if( direct ) p_ret = clients_add( remote, 0 );
   return( p_ret );
 }
 
+// Rebinds a known session to a new remote address, return client or NULL if session is unknown
+static client_t *clients_resume( char *p_session, remote_t *remote ) {
+  session_t session;
+  client_t *p_ret = NULL;
+  memcpy( &session, p_session, sizeof( session_t ) );
+  SDL_mutexP( client_mx );
+  if( session.index < client_slots ) {
+    if( clients[ session.index ].timeout && memcmp( clients[ session.index ].session.tag, session.tag, 8 ) == 0 ) {
+      p_ret = &clients[ session.index ];
+      printf( "RoboCortex [info]: Client %i resumed from a new address\n", session.index );
+      if( p_ret->remote.addr ) free( p_ret->remote.addr );
+      p_ret->remote.addr = malloc( remote->size );
+      // TODO: check
+      memcpy( p_ret->remote.addr, remote->addr, remote->size );
+      p_ret->remote.size = remote->size;
+      p_ret->remote.handler = remote->handler;
+      if( p_ret == client_first ) do_intra = 1; // Intra-refresh needed
+      p_ret->spec_wait = 1;
+      stat_resumed++;
+    }
+  }
+  SDL_mutexV( client_mx );
+  return( p_ret );
+}
+
+// Copies a client's address into addr, a resume may replace it while sending, return 0 if too large
+static int clients_remote( client_t *p_client, remote_t *remote, char *addr, int size ) {
+  int ret = 0;
+  SDL_mutexP( client_mx );
+  if( p_client->remote.size <= size ) {
+    memcpy( addr, p_client->remote.addr, p_client->remote.size );
+    *remote = p_client->remote;
+    remote->addr = addr;
+    ret = 1;
+  }
+  SDL_mutexV( client_mx );
+  return( ret );
+}
+
 // Calculates control differentals
 static void clients_diff( client_t *p_client ) {
   p_client->diff.mx = p_client->ctrl.ctrl.mx - p_client->last.mx;
@@ -393,6 +931,21 @@ static void clients_diff( client_t *p_client ) {
   memcpy( &p_client->last, &p_client->ctrl.ctrl, sizeof( ctrl_t ) );
 }
 
+// Passes control data to plugins as it arrives, ahead of the next frame
+static void clients_control( client_t *p_client ) {
+  pluginclient_t *plug;
+  ctrl_t diff;
+  int pid;
+  diff.mx = p_client->ctrl.ctrl.mx - p_client->applied.mx;
+  diff.my = p_client->ctrl.ctrl.my - p_client->applied.my;
+  diff.kb = p_client->ctrl.ctrl.kb ^ p_client->applied.kb;
+  memcpy( &p_client->applied, &p_client->ctrl.ctrl, sizeof( ctrl_t ) );
+  // Only the controlling client steers
+  if( p_client != client_first ) return;
+  for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ )
+    if( plug->control ) plug->control( &p_client->ctrl.ctrl, &diff );
+}
+
 // Calculates queue time for specific client
 static char * queue_time( char buf[], int offset, client_t *p_client ) {
   client_t *cli = client_first;
@@ -406,12 +959,31 @@ static char * queue_time( char buf[], int offset, client_t *p_client ) {
   return( buf );
 }
 
+// Streams with the configured backend if the client decodes it, H.264 otherwise
+static encoder_t *encoder_pick( int encoders ) {
+  return( enc_pref == ENC_JPEG && ( encoders & ENC_JPEG ) ? enc_jpeg : enc_x264 );
+}
+
+// Reduced layer runs only while the full layer is H.264, it is scaled from the same limited range picture
+static int sim_active() {
+  return( simulcast && enc->ident == ENC_H264 );
+}
+
+// Sends HELO+version+time+session+encoding
+static void helo_reply( char buf[], client_t *p_client, remote_t *remote ) {
+  buf[ 4 ] = CORTEX_VERSION;
+  queue_time( buf, 5, p_client );
+  memcpy( buf + 5 + sizeof( int ), &p_client->session, sizeof( session_t ) );
+  buf[ 5 + sizeof( int ) + sizeof( session_t ) ] = encoder_pick( p_client->encoders )->ident;
+  ( ( pluginclient_t* )( remote->handler ) )->comm_send( buf, 5 + sizeof( int ) + sizeof( session_t ) + 1, remote );
+}
+
 // Count down all client timers, kill active client if it's timer reaches zero
 static void clients_tick() {
   int n, pid;
   // Count down timeouts
   SDL_mutexP( client_mx );
-  for( n = 0; n < max_clients; n++ ) {
+  for( n = 0; n < client_slots; n++ ) {
   	if( clients[ n ].timeout ) {
   		clients[ n ].timeout--;
   		if( clients[ n ].timeout == 0 ) {
@@ -452,13 +1024,23 @@ static void clients_tick() {
 // Processes a data packet
 static void comm_recv( char *buffer, int size, remote_t *remote ) {
   client_t *p_client = clients_find( remote );
-  SDL_mutexP( receive_mx );
+  int allow = -1; // Unknown peer limiter, charged once per packet
+  if( !p_client && size >= 4 + sizeof( session_t ) ) {
+    // Unknown address, but packet may carry a known session
+    if( memcmp( buffer, pkt_ctrl, 4 ) == 0 || memcmp( buffer, pkt_time, 4 ) == 0 ) {
+      // Resume attempts are limited like any unknown peer, so tags cannot be guessed at line rate
+      SDL_mutexP( receive_mx );
+      allow = reply_allow();
+      SDL_mutexV( receive_mx );
+      if( allow ) p_client = clients_resume( buffer + 4, remote );
+    }
+  }
   if( p_client ) {
     if( size >= 4 ) {
       if( memcmp( buffer, pkt_helo, 4 ) == 0 ) {
-        // Re-send HELO+version+time
-        buffer[ 4 ] = CORTEX_VERSION;
-        ( ( pluginclient_t* )( remote->handler ) )->comm_send( queue_time( buffer, 5, p_client ), 5 + sizeof( int ), remote );
+        if( size >= 4 + 8 + 1 ) p_client->encoders = ( unsigned char )buffer[ 4 + 8 ];
+        // Re-send HELO+version+time+session
+        helo_reply( buffer, p_client, remote );
       } else if( memcmp( buffer, pkt_time, 4 ) == 0 ) {
         // Send TIME+time
         ( ( pluginclient_t* )( remote->handler ) )->comm_send( queue_time( buffer, 4, p_client ), 4 + sizeof( int ), remote );
@@ -473,16 +1055,25 @@ static void comm_recv( char *buffer, int size, remote_t *remote ) {
       } else if( memcmp( buffer, pkt_ctrl, 4 ) == 0 ) {
         // Copy control data
         if( size >= 4 + sizeof( ctrl_data_t ) ) {
+          SDL_mutexP( receive_mx );
           SDL_mutexP( client_mx );
           p_client->timeout = timeout_connection;
           p_client->glitch = timeout_glitch;
           SDL_mutexV( client_mx );
+          // Drop reordered packets, control data is absolute
+          if( p_client->got_first && ( short )( ( ( ctrl_data_t* )( buffer + 4 ) )->seq - p_client->ctrl.seq ) < 0 ) {
+            SDL_mutexV( receive_mx );
+            return;
+          }
           memcpy( &p_client->ctrl, buffer + 4, sizeof( ctrl_data_t ) );
+          p_client->ctrl_tick = SDL_GetTicks();
           // Initial control data, reset diff
           if( !p_client->got_first ) {
             p_client->got_first = 1;
             memcpy( &p_client->last, &p_client->ctrl.ctrl, sizeof( ctrl_t ) );
+            memcpy( &p_client->applied, &p_client->ctrl.ctrl, sizeof( ctrl_t ) );
           }
+          clients_control( p_client );
           // Check if outgoing trusted data recieved, free trusted buffers
           SDL_mutexP( trust_mx );
           if( trust_first ) {
@@ -499,30 +1090,192 @@ static void comm_recv( char *buffer, int size, remote_t *remote ) {
           if( ( ( p_client->trust_cli + 1 ) & 0xFF ) == p_client->ctrl.trust_cli ) {
             trust_handler( p_client, buffer + 4 + sizeof( ctrl_data_t ), size - 4 - sizeof( ctrl_data_t ) );
           }
+          SDL_mutexV( receive_mx );
         }
       }
     }
   } else {
     // Client unknown
+    SDL_mutexP( receive_mx );
     if( size >= 4 ) {
       if( memcmp( buffer, pkt_helo, 4 ) == 0 ) {
-        // Handshake, add
-        p_client = clients_add( remote );
-        if( p_client ) {
-          // Connection accepted, send HELO+version+time
-          buffer[ 4 ] = CORTEX_VERSION;
-          ( ( pluginclient_t* )( remote->handler ) )->comm_send( queue_time( buffer, 5, p_client ), 5 + sizeof( int ), remote );
+        if( size >= 4 + 8 && cookie_check( remote, buffer + 4 ) ) {
+          // Handshake with valid cookie, add
+          stat_validated++;
+          p_client = clients_add( remote, size >= 4 + 8 + 2 && ( buffer[ 4 + 8 + 1 ] & HELO_SPECTATOR ) );
+          if( p_client ) {
+            // Encodings offered follow the cookie, older clients only decode H.264
+            p_client->encoders = ( size >= 4 + 8 + 1 ? ( unsigned char )buffer[ 4 + 8 ] : ENC_H264 );
+            // Layer asked for, switched on loss from then on
+            p_client->layer = ( sim_active() && ( p_client->encoders & ENC_H264 ) && size >= 4 + 8 + 2 && ( buffer[ 4 + 8 + 1 ] & HELO_REDUCED ) );
+            p_client->layer_time = SDL_GetTicks();
+            // Connection accepted, send HELO+version+time+session
+            helo_reply( buffer, p_client, remote );
+          } else {
+            // Server is full, send FULL
+            ( ( pluginclient_t* )( remote->handler ) )->comm_send( pkt_full, 4, remote );
+          }
+        } else if( size < HELO_MIN ) {
+          // Shorter than COOK, answering would amplify traffic to a spoofed source
+          stat_unpadded++;
         } else {
-          // Server is full, send FULL
-          ( ( pluginclient_t* )( remote->handler ) )->comm_send( pkt_full, 4, remote );
+          // Handshake without (valid) cookie, challenge with COOK+cookie
+          if( memcmp( buffer + 4, "\0\0\0\0\0\0\0\0", 8 ) ) stat_rejected++; else stat_challenged++;
+          if( reply_allow() ) cookie_send( remote );
         }
       } else {
         // Unknown connection, send LOST
-        ( ( pluginclient_t* )( remote->handler ) )->comm_send( pkt_lost, 4, remote );
+        if( allow < 0 ) allow = reply_allow();
+        if( allow ) ( ( pluginclient_t* )( remote->handler ) )->comm_send( pkt_lost, 4, remote );
       }
     }
+    SDL_mutexV( receive_mx );
   }
-  SDL_mutexV( receive_mx );
+}
+
+/* == SPECTATORS =============================================================================== */
+
+// Queues an encoded frame of layer for the fan-out thread, after it went to the controller
+static void spec_push( enc_frame_t *out, int layer, int ident ) {
+  spec_frame_t *f;
+  char *data;
+  SDL_mutexP( spec_mx );
+  f = &spec_ring[ spec_head % SPEC_RING ];
+  if( f->alloc < out->size ) {
+    data = realloc( f->data, out->size );
+    if( data == NULL ) {
+      SDL_mutexV( spec_mx );
+      return;
+    }
+    f->data = data;
+    f->alloc = out->size;
+  }
+  memcpy( f->data, out->data, out->size );
+  memcpy( f->sizes, out->sizes, sizeof( int ) * out->count );
+  f->size = out->size;
+  f->count = out->count;
+  f->key = out->key;
+  f->ident = ident;
+  f->layer = layer;
+  spec_head++;
+  // Fan-out fell a ring behind, drop the oldest frame
+  if( spec_head - spec_tail > SPEC_RING ) {
+    spec_tail++;
+    stat_spec_overrun++;
+  }
+  SDL_mutexV( spec_mx );
+  SDL_SemPost( spec_wake );
+}
+
+// Sends the frame in spec_frame to every viewer of its layer but the controller, paced per viewer
+// A viewer that misses a frame waits for one decoding can start at, and asks for a refresh
+// With simulcast, a viewer too slow for the full layer drops to the reduced one and tries again later
+static void spec_send( int overrun ) {
+  spec_frame_t *f = &spec_frame;
+  client_t *p_client;
+  remote_t remote;
+  char addr[ 128 ];
+  Uint32 now = SDL_GetTicks();
+  int n, i, offset, send;
+  for( n = 0; n < client_slots; n++ ) {
+    p_client = &clients[ n ];
+    SDL_mutexP( client_mx );
+    send = 0;
+    if( p_client->timeout && p_client != client_first && p_client->layer == f->layer
+     && ( p_client->encoders & f->ident ) && p_client->remote.size <= sizeof( addr ) ) {
+      // Refilled per viewer, layers are fanned out back to back
+      p_client->spec_tokens += ( double )MIN( now - p_client->spec_time, SPEC_BURST ) * spectate_rate / 8;
+      p_client->spec_tokens = MIN( p_client->spec_tokens, ( double )spectate_rate * SPEC_BURST / 8 );
+      p_client->spec_time = now;
+      if( overrun ) p_client->spec_wait = 1;
+      if( p_client->layer && now - p_client->layer_time >= SIM_UP ) {
+        // No drops for a while, try the full layer again
+        p_client->layer = 0;
+        p_client->layer_time = now;
+        p_client->spec_wait = 1;
+        spec_refresh |= 1;
+        stat_sim_up++;
+      } else if( p_client->spec_wait && !f->key ) {
+        spec_refresh |= 1 << f->layer;
+      } else if( p_client->spec_tokens < f->size ) {
+        // Slow viewer, drop until it can afford a frame to start over from
+        p_client->spec_wait = 1;
+        p_client->layer_time = now;
+        stat_spec_paced++;
+        if( simulcast && f->ident == ENC_H264 && ( p_client->encoders & ENC_H264 ) && !p_client->layer ) {
+          p_client->layer = 1;
+          stat_sim_down++;
+        }
+      } else {
+        p_client->spec_tokens -= f->size;
+        p_client->spec_wait = 0;
+        // Address may be replaced by a resume while sending
+        memcpy( addr, p_client->remote.addr, p_client->remote.size );
+        remote = p_client->remote;
+        remote.addr = addr;
+        send = 1;
+      }
+    }
+    SDL_mutexV( client_mx );
+    if( !send ) continue;
+    for( i = 0, offset = 0; i < f->count; offset += f->sizes[ i++ ] )
+      ( ( pluginclient_t* )( remote.handler ) )->comm_send( f->data + offset, f->sizes[ i ], &remote );
+    stat_spec_sent++;
+  }
+}
+
+// Fans out queued frames, off the main thread so the controller is never kept waiting
+static int spec_fanout( void *unused ) {
+  spec_frame_t *f;
+  char *data;
+  int overrun;
+  uint32_t tail = 0;
+  for( ;; ) {
+    SDL_SemWait( spec_wake );
+    if( spec_quit ) break;
+    SDL_mutexP( spec_mx );
+    if( spec_tail == spec_head ) {
+      SDL_mutexV( spec_mx );
+      continue;
+    }
+    // Frames dropped from the ring break every viewer's reference chain
+    overrun = ( spec_tail != tail );
+    f = &spec_ring[ spec_tail % SPEC_RING ];
+    if( spec_frame.alloc < f->size ) {
+      data = realloc( spec_frame.data, f->size );
+      if( data ) {
+        spec_frame.data = data;
+        spec_frame.alloc = f->size;
+      }
+    }
+    if( spec_frame.alloc >= f->size ) {
+      memcpy( spec_frame.data, f->data, f->size );
+      memcpy( spec_frame.sizes, f->sizes, sizeof( int ) * f->count );
+      spec_frame.size = f->size;
+      spec_frame.count = f->count;
+      spec_frame.key = f->key;
+      spec_frame.ident = f->ident;
+      spec_frame.layer = f->layer;
+    } else {
+      spec_frame.count = 0;
+    }
+    tail = ++spec_tail;
+    SDL_mutexV( spec_mx );
+    if( spec_frame.count ) spec_send( overrun );
+    stat_spec_frames++;
+  }
+  return( 0 );
+}
+
+// Refreshes the layers spectators wait on, if due
+static void spec_due() {
+  Uint32 now = SDL_GetTicks();
+  if( !spec_refresh || now - spec_refresh_time < SPEC_REFRESH ) return;
+  if( spec_refresh & 1 ) do_intra = 1;
+  if( spec_refresh & 2 ) sim_refresh = 1;
+  spec_refresh = 0;
+  spec_refresh_time = now;
+  stat_spec_refresh++;
 }
 
 /* == CAPTURE SCALING & CONVERSION ============================================================== */
@@ -558,6 +1311,593 @@ static void cap_process() {
   }
 }
 
+// Allocates an I420 picture, rows padded for SIMD, frees the previous one in plane
+static int i420_alloc( uint8_t *plane[ 3 ], int stride[ 3 ], int w, int h ) {
+  free( plane[ 0 ] );
+  stride[ 0 ] = ( w + 31 ) & ~31;
+  stride[ 1 ] = stride[ 2 ] = ( ( w + 1 ) / 2 + 31 ) & ~31;
+  plane[ 0 ] = malloc( stride[ 0 ] * h + stride[ 1 ] * ( ( h + 1 ) / 2 ) * 2 );
+  if( plane[ 0 ] == NULL ) return( -1 );
+  plane[ 1 ] = plane[ 0 ] + stride[ 0 ] * h;
+  plane[ 2 ] = plane[ 1 ] + stride[ 1 ] * ( ( h + 1 ) / 2 );
+  return( 0 );
+}
+
+/* == MOTION-ADAPTIVE FRAME RATE =============================================================== */
+
+// Decides whether frame (main loop count) is encoded: the scene changed since the last encoded
+// frame, input or trusted data arrived, or the fps_min interval passed. Scene change is the SAD of
+// the green channel of the composed frame, subsampled
+static int still_check( unsigned int frame, int input ) {
+  uint8_t *p, *t;
+  unsigned int sad = 0;
+  int x, y, n = 0, pending;
+  for( y = STILL_STEP >> 1; y < stream_h; y += STILL_STEP ) {
+    p = pic_rgb24 + y * stream_stride + ( STILL_STEP >> 1 ) * 3 + 1;
+    for( x = STILL_STEP >> 1; x < stream_w; x += STILL_STEP, p += STILL_STEP * 3 ) {
+      sad += abs( *p - still_ref[ n ] );
+      still_cur[ n++ ] = *p;
+    }
+  }
+  SDL_mutexP( trust_mx );
+  pending = ( trust_first != NULL );
+  SDL_mutexV( trust_mx );
+  still = ( sad <= still_sad * n && !input && !still_wake && !pending && !do_intra );
+  if( still && frame - still_last < fps / fps_min ) {
+    stat_still++;
+    return( 0 );
+  }
+  still_wake = 0;
+  still_last = frame;
+  t = still_ref;
+  still_ref = still_cur;
+  still_cur = t;
+  return( 1 );
+}
+
+void still_free() {
+  free( still_ref );
+  free( still_cur );
+}
+
+/* == REGION OF INTEREST ======================================================================= */
+
+// Sets macroblocks of the encoded picture whose center lies within r (stream coordinates)
+static void roi_fill( int mb_w, int mb_h, SDL_Rect *r, int priority ) {
+  int x, y, cx, cy;
+  for( y = 0; y < mb_h; y++ ) {
+    cy = ( ( y << 4 ) + 8 ) * stream_h / enc_h;
+    if( cy < r->y || cy >= r->y + r->h ) continue;
+    for( x = 0; x < mb_w; x++ ) {
+      cx = ( ( x << 4 ) + 8 ) * stream_w / enc_w;
+      if( cx >= r->x && cx < r->x + r->w ) roi_map[ y * mb_w + x ] = -priority;
+    }
+  }
+}
+
+// Builds QP offsets from the layout: enabled sources by z-order, then plugin regions on top
+// Offsets are centered on their mean, priorities only move bits between regions
+static void roi_build() {
+  int mb_w = ( enc_w + 15 ) >> 4, mb_h = ( enc_h + 15 ) >> 4;
+  int n, z;
+  float mean = 0;
+  roi_dirty = 0;
+  if( mb_w * mb_h > roi_size ) {
+    free( roi_map );
+    roi_size = mb_w * mb_h;
+    roi_map = malloc( roi_size * sizeof( float ) );
+    if( roi_map == NULL ) exit( EXIT_MALLOC );
+  }
+  memset( roi_map, 0, mb_w * mb_h * sizeof( float ) );
+  roi_active = 0;
+  SDL_mutexP( cap_mx );
+  for( z = 0; z < cap_count; z++ ) {
+    for( n = 0; n < cap_count; n++ ) {
+      if( cap[ n ].z == z ) {
+        if( cap[ n ].enable ) {
+          roi_fill( mb_w, mb_h, &cap[ n ].dst, cap[ n ].priority );
+          if( cap[ n ].priority ) roi_active = 1;
+        }
+        break;
+      }
+    }
+  }
+  for( n = 0; n < ROI_MAX; n++ ) {
+    if( roi[ n ].priority ) {
+      roi_fill( mb_w, mb_h, &roi[ n ].r, roi[ n ].priority );
+      roi_active = 1;
+    }
+  }
+  SDL_mutexV( cap_mx );
+  for( n = 0; n < mb_w * mb_h; n++ ) mean += roi_map[ n ];
+  mean /= mb_w * mb_h;
+  for( n = 0; n < mb_w * mb_h; n++ ) roi_map[ n ] -= mean;
+  stat_roi_builds++;
+}
+
+/* == PER-SOURCE STREAMS ======================================================================== */
+
+// Crops, converts and encodes one capture source, on the stream's own thread
+static int stream_thread( void *p_stream ) {
+  stream_t *st = p_stream;
+  capture_t *c = &cap[ st->n ];
+  const uint8_t *src;
+  int src_stride, src_h;
+  for( ;; ) {
+    SDL_SemWait( st->go );
+    if( streams_quit ) break;
+    st->out.count = 0;
+    SDL_mutexP( cap_mx );
+    src_stride = c->w * 3;
+    src = c->data + ( src_stride * c->src.y ) + ( c->src.x * 3 );
+    src_h = c->src.h;
+    st->sws = sws_getCachedContext( st->sws, c->src.w, c->src.h, PIX_FMT_RGB24, st->param.w, st->param.h,
+      st->enc->full_range ? PIX_FMT_YUVJ420P : PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL );
+    SDL_mutexV( cap_mx );
+    if( st->sws ) {
+      sws_scale( st->sws, &src, &src_stride, 0, src_h, st->plane, st->stride );
+      if( st->refresh ) {
+        st->refresh = 0;
+        st->enc->refresh( st->inst );
+      }
+      if( st->enc->encode( st->inst, st->plane, st->stride, NULL, &st->out ) != 0 ) st->out.count = 0;
+    }
+    SDL_SemPost( st->done );
+  }
+  return( 0 );
+}
+
+// Opens an encoder and thread per capture source, sized and paced by its device section
+static void streams_open() {
+  stream_t *st;
+  capture_t *c;
+  int n;
+  for( n = 0; n < cap_count; n++ ) {
+    st = &streams[ n ];
+    c = &cap[ n ];
+    st->n = n;
+    st->enc = enc;
+    memcpy( &st->param, &eparam, sizeof( enc_param_t ) );
+    st->param.w = ( c->enc_w ? c->enc_w : c->dst.w ) & ~1;
+    st->param.h = ( c->enc_h ? c->enc_h : c->dst.h ) & ~1;
+    st->skip = MAX( fps / ( c->enc_fps ? c->enc_fps : fps ), 1 );
+    st->param.fps = fps / st->skip;
+    // Share of the bitrate by area unless set
+    st->rate_max = ( c->enc_rate ? c->enc_rate : rate_max * st->param.w * st->param.h / ( stream_w * stream_h ) );
+    st->rate_max = MAX( st->rate_max, rate_min );
+    st->param.rate = st->rate_max;
+    st->inst = st->enc->open( &st->param );
+    if( st->inst == NULL ) {
+      printf( "RoboCortex [error]: Unable to open encoder for %s\n", c->device );
+      exit( EXIT_ENCODER );
+    }
+    if( i420_alloc( st->plane, st->stride, st->param.w, st->param.h ) != 0 ) exit( EXIT_PICTURE );
+    st->go = SDL_CreateSemaphore( 0 );
+    st->done = SDL_CreateSemaphore( 0 );
+    st->thread = SDL_CreateThread( stream_thread, st );
+    printf( "RoboCortex [info]: Stream %i is %ix%ix%ifps at %i kbps\n", n, st->param.w, st->param.h, st->param.fps, st->rate_max );
+  }
+}
+
+// Moves streams to the main encoder's quality and effort, bitrate scaled by the rate control
+static void streams_reconfig() {
+  stream_t *st;
+  int n;
+  for( n = 0; n < cap_count; n++ ) {
+    st = &streams[ n ];
+    st->param.rate = MAX( st->rate_max * eparam.rate / rate_max, 1 );
+    st->param.crf = eparam.crf;
+    st->param.effort = eparam.effort;
+    st->enc->reconfig( st->inst, &st->param );
+  }
+}
+
+// Reopens streams as backend e
+static void streams_choose( encoder_t *e ) {
+  stream_t *st;
+  int n;
+  for( n = 0; n < cap_count; n++ ) {
+    st = &streams[ n ];
+    if( st->enc == e ) continue;
+    st->enc->close( st->inst );
+    st->enc = e;
+    st->inst = st->enc->open( &st->param );
+    if( st->inst == NULL ) {
+      printf( "RoboCortex [error]: Unable to reopen %s encoder for stream %i\n", e->name, n );
+      exit( EXIT_ENCODER );
+    }
+  }
+}
+
+// Encodes all enabled sources due in frame (main loop count) in parallel
+static void streams_encode( unsigned int frame ) {
+  stream_t *st;
+  int n;
+  for( n = 0; n < cap_count; n++ ) {
+    st = &streams[ n ];
+    st->busy = ( cap[ n ].enable && frame % st->skip == 0 );
+    if( st->busy ) SDL_SemPost( st->go );
+  }
+  for( n = 0; n < cap_count; n++ ) {
+    if( streams[ n ].busy ) SDL_SemWait( streams[ n ].done );
+  }
+}
+
+// Sends packets of the streams encoded this frame with their destination, return bytes sent
+static int streams_send( remote_t *remote ) {
+  stream_t *st;
+  strm_data_t hdr;
+  int n, i, offset, size = 0;
+  memcpy( strm_buffer, "STRM", 4 );
+  for( n = 0; n < cap_count; n++ ) {
+    st = &streams[ n ];
+    if( !st->busy ) continue;
+    hdr.id       = n;
+    hdr.canvas_w = stream_w;
+    hdr.canvas_h = stream_h;
+    hdr.enc_w    = st->param.w;
+    hdr.enc_h    = st->param.h;
+    SDL_mutexP( cap_mx );
+    hdr.z        = cap[ n ].z;
+    hdr.x        = cap[ n ].dst.x;
+    hdr.y        = cap[ n ].dst.y;
+    hdr.w        = cap[ n ].dst.w;
+    hdr.h        = cap[ n ].dst.h;
+    SDL_mutexV( cap_mx );
+    memcpy( strm_buffer + 4, &hdr, sizeof( strm_data_t ) );
+    for( i = 0, offset = 0; i < st->out.count; offset += st->out.sizes[ i++ ] ) {
+      // Header included, a larger datagram would be truncated by the receive buffers
+      if( 4 + sizeof( strm_data_t ) + st->out.sizes[ i ] > ENC_PACKET_MAX ) continue;
+      memcpy( strm_buffer + 4 + sizeof( strm_data_t ), st->out.data + offset, st->out.sizes[ i ] );
+      ( ( pluginclient_t* )( remote->handler ) )->comm_send( strm_buffer, 4 + sizeof( strm_data_t ) + st->out.sizes[ i ], remote );
+    }
+    st->stat_frames++;
+    st->stat_bytes += st->out.size;
+    size += st->out.size;
+  }
+  return( size );
+}
+
+/* == SIMULCAST ================================================================================ */
+
+// Halves a plane with a 2x2 box filter into dw x dh, rows averaged first, then columns
+static void plane_half( const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int dw, int dh ) {
+  const uint8_t *r0, *r1;
+  int x, y, a, b;
+#ifdef __SSE2__
+  __m128i l, r, mask = _mm_set1_epi16( 0x00FF );
+#endif
+  for( y = 0; y < dh; y++, dst += dst_stride ) {
+    r0 = src + 2 * y * src_stride;
+    r1 = r0 + src_stride;
+    x = 0;
+#ifdef __SSE2__
+    // 16 pixels per step, even and odd columns split from 16-bit lanes
+    for( ; x + 16 <= dw; x += 16 ) {
+      l = _mm_avg_epu8( _mm_loadu_si128( ( const __m128i* )( r0 + 2 * x ) ), _mm_loadu_si128( ( const __m128i* )( r1 + 2 * x ) ) );
+      r = _mm_avg_epu8( _mm_loadu_si128( ( const __m128i* )( r0 + 2 * x + 16 ) ), _mm_loadu_si128( ( const __m128i* )( r1 + 2 * x + 16 ) ) );
+      l = _mm_avg_epu16( _mm_and_si128( l, mask ), _mm_srli_epi16( l, 8 ) );
+      r = _mm_avg_epu16( _mm_and_si128( r, mask ), _mm_srli_epi16( r, 8 ) );
+      _mm_storeu_si128( ( __m128i* )( dst + x ), _mm_packus_epi16( l, r ) );
+    }
+#endif
+    // Same rounding as the SIMD path
+    for( ; x < dw; x++ ) {
+      a = ( r0[ 2 * x ] + r1[ 2 * x ] + 1 ) >> 1;
+      b = ( r0[ 2 * x + 1 ] + r1[ 2 * x + 1 ] + 1 ) >> 1;
+      dst[ x ] = ( a + b + 1 ) >> 1;
+    }
+  }
+}
+
+// Downscales the full layer's picture once and encodes the reduced layer, on its own thread
+static int sim_run( void *unused ) {
+  uint64_t start;
+  int n;
+  for( ;; ) {
+    SDL_SemWait( sim_go );
+    if( sim_quit ) break;
+    start = sys_time_us();
+    for( n = 0; n < 3; n++ ) {
+      plane_half( pic_plane[ n ], pic_stride[ n ], sim_plane[ n ], sim_stride[ n ],
+        n ? sim_param.w / 2 : sim_param.w, n ? sim_param.h / 2 : sim_param.h );
+    }
+    if( sim_refresh ) {
+      sim_refresh = 0;
+      enc_x264->refresh( sim_inst );
+    }
+    if( enc_x264->encode( sim_inst, sim_plane, sim_stride, NULL, &sim_out ) != 0 ) sim_out.count = 0;
+    stat_sim_cost += sys_time_us() - start;
+    stat_sim_frames++;
+    SDL_SemPost( sim_done );
+  }
+  return( 0 );
+}
+
+// Opens the reduced layer encoder at half the full layer's size, even
+static void sim_resize() {
+  if( sim_inst ) enc_x264->close( sim_inst );
+  sim_param.w = ( enc_w / 2 ) & ~1;
+  sim_param.h = ( enc_h / 2 ) & ~1;
+  sim_inst = enc_x264->open( &sim_param );
+  if( sim_inst == NULL ) {
+    printf( "RoboCortex [error]: Unable to open reduced layer encoder at %ix%i\n", sim_param.w, sim_param.h );
+    exit( EXIT_ENCODER );
+  }
+  if( i420_alloc( sim_plane, sim_stride, sim_param.w, sim_param.h ) != 0 ) exit( EXIT_PICTURE );
+}
+
+static void sim_open() {
+  memcpy( &sim_param, &eparam, sizeof( enc_param_t ) );
+  sim_param.rate = simulcast_rate;
+  sim_resize();
+  sim_go = SDL_CreateSemaphore( 0 );
+  sim_done = SDL_CreateSemaphore( 0 );
+  sim_thread = SDL_CreateThread( sim_run, NULL );
+  printf( "RoboCortex [info]: Simulcast layer is %ix%i at %i kbps\n", sim_param.w, sim_param.h, simulcast_rate );
+}
+
+// Reduced layer follows the full layer's quality and effort, within its own bitrate
+static void sim_reconfig() {
+  sim_param.rate = MIN( simulcast_rate, eparam.rate );
+  sim_param.crf = eparam.crf;
+  sim_param.effort = eparam.effort;
+  enc_x264->reconfig( sim_inst, &sim_param );
+}
+
+// Moves the controller between layers on the loss it reports
+static void sim_layer( client_t *p_client ) {
+  Uint32 now = SDL_GetTicks();
+  if( p_client->layer ? abr.loss >= ABR_LOSS_LOW : abr.loss <= ABR_LOSS_HIGH ) {
+    p_client->layer_time = now;
+  } else if( now - p_client->layer_time >= ( p_client->layer ? SIM_UP : SIM_DOWN ) ) {
+    p_client->layer ^= 1;
+    p_client->layer_time = now;
+    // New layer starts with a refresh
+    if( p_client->layer ) {
+      sim_refresh = 1;
+      stat_sim_down++;
+    } else {
+      do_intra = 1;
+      stat_sim_up++;
+    }
+    printf( "RoboCortex [info]: Controller moved to the %s layer\n", p_client->layer ? "reduced" : "full" );
+  }
+}
+
+/* == RATE CONTROL ============================================================================== */
+
+// Reopens encoder as backend e, I420 picture and conversion context at w x h
+// A new encoder starts with a full refresh
+static void encoder_resize( encoder_t *e, int w, int h ) {
+  int n;
+  enc->close( enc_inst );
+  enc = e;
+  sws_freeContext( swsCtx );
+  enc_w = eparam.w = w;
+  enc_h = eparam.h = h;
+  enc_inst = enc->open( &eparam );
+  if( enc_inst == NULL ) {
+    printf( "RoboCortex [error]: Unable to reopen %s encoder at %ix%i\n", enc->name, w, h );
+    exit( EXIT_ENCODER );
+  }
+  if( i420_alloc( pic_plane, pic_stride, w, h ) != 0 ) exit( EXIT_PICTURE );
+  // Backends taking full range YUV (JPEG) get it straight from the conversion
+  swsCtx = sws_getContext( stream_w, stream_h, PIX_FMT_RGB24, w, h, enc->full_range ? PIX_FMT_YUVJ420P : PIX_FMT_YUV420P, ( w == stream_w && h == stream_h ? SWS_POINT : SWS_FAST_BILINEAR ), NULL, NULL, NULL );
+  if( swsCtx == NULL ) exit( EXIT_SWSCALE );
+  do_intra = 0;
+  roi_dirty = 1;
+  if( simulcast ) sim_resize();
+  // Everyone back on the full layer while the reduced one is off
+  if( simulcast && !sim_active() ) {
+    SDL_mutexP( client_mx );
+    for( n = 0; n < client_slots; n++ ) clients[ n ].layer = 0;
+    SDL_mutexV( client_mx );
+  }
+}
+
+// Moves VBV rate and quality of the running encoder to the target bitrate
+// Quality follows the bitrate linearly, from crf at rate_max to crf_max at rate_min
+static void abr_apply() {
+  int rate = ( int )abr.rate, q = crf;
+  if( rate_max > rate_min ) q = crf + ( crf_max - crf ) * ( rate_max - rate ) / ( rate_max - rate_min );
+  if( rate == abr.rate_set && q == abr.crf_set ) return;
+  abr.rate_set = rate;
+  abr.crf_set = q;
+  eparam.rate = rate;
+  eparam.crf = q;
+  enc->reconfig( enc_inst, &eparam );
+  if( streams_enable ) streams_reconfig();
+  if( simulcast ) sim_reconfig();
+}
+
+// Estimates available bandwidth from the controlling client's feedback, once per frame
+// Delay based: a queuing delay above abr_queue that is still rising means the link is overused
+// Loss based: heavy loss cuts the rate in proportion, otherwise the rate creeps back up
+static void abr_update( uint32_t frame ) {
+  uint32_t fb_frame, fb_time;
+  unsigned short recv, lost;
+  int delay, n, rung, queue;
+
+  // New controlling client, start from the top
+  if( client_first != abr.client ) {
+    abr.client = client_first;
+    abr.rate = rate_max;
+    abr.started = 0;
+    abr.trend = 0;
+    abr.loss = 0;
+    abr.age = 0;
+    abr.hold = 0;
+    abr.below = 0;
+    abr.above = 0;
+    abr.rung = 0;
+  }
+
+  // Snapshot feedback, written by the transport threads
+  SDL_mutexP( receive_mx );
+  fb_frame = client_first->ctrl.fb_frame;
+  fb_time  = client_first->ctrl.fb_time;
+  recv     = client_first->ctrl.fb_recv;
+  lost     = client_first->ctrl.fb_lost;
+  SDL_mutexV( receive_mx );
+
+  // New feedback for a frame we remember sending
+  abr.age++;
+  if( fb_frame && frame - fb_frame < ABR_HISTORY && ( !abr.started || ( int32_t )( fb_frame - abr.frame ) > 0 ) ) {
+    delay = ( int )( fb_time - abr.sent[ fb_frame % ABR_HISTORY ] );
+    if( !abr.started ) {
+      abr.started = 1;
+      abr.base_prev = delay;
+      abr.base = delay;
+      abr.window = ABR_WINDOW * fps / 1000;
+    } else {
+      // Delay gradient per frame and loss since last feedback, both smoothed
+      abr.trend = abr.trend * 0.9 + 0.1 * ( delay - abr.delay ) / ( int32_t )( fb_frame - abr.frame );
+      n = ( unsigned short )( recv - abr.recv ) + ( unsigned short )( lost - abr.lost );
+      if( n ) abr.loss = abr.loss * 0.8 + 0.2 * ( unsigned short )( lost - abr.lost ) / n;
+    }
+    abr.frame = fb_frame;
+    abr.recv = recv;
+    abr.lost = lost;
+    abr.delay = delay;
+    abr.age = 0;
+    // Base delay is the lowest of this and the previous window, so clock drift is followed
+    abr.base = MIN( abr.base, delay );
+    if( --abr.window <= 0 ) {
+      abr.base_prev = abr.base;
+      abr.base = delay;
+      abr.window = ABR_WINDOW * fps / 1000;
+    }
+  }
+
+  // Bandwidth estimate
+  if( abr.started ) {
+    queue = abr.delay - MIN( abr.base_prev, abr.base );
+    if( abr.hold ) {
+      abr.hold--;
+    } else if( abr.loss > ABR_LOSS_HIGH ) {
+      abr.rate *= 1.0 - 0.5 * abr.loss;
+      abr.hold = ABR_HOLD * fps / 1000;
+      stat_abr_loss++;
+    } else if( queue > abr_queue && abr.trend > 0 ) {
+      abr.rate *= ABR_DECREASE;
+      abr.hold = ABR_HOLD * fps / 1000;
+      stat_abr_delay++;
+    } else if( queue < abr_queue / 2 && abr.loss < ABR_LOSS_LOW && abr.age < fps ) {
+      abr.rate *= 1.0 + ABR_INCREASE / fps;
+    }
+    abr.rate = MIN( MAX( abr.rate, rate_min ), rate_max );
+  }
+
+  // Bitrate alone can not keep up, step down the ladder, step back up with a margin
+  rung = abr.rung;
+  if( abr.rung + 1 < ladder_count && abr.rate < ladder[ abr.rung ].kbps ) {
+    if( ++abr.below >= ABR_STEP_DOWN * fps / 1000 ) rung = abr.rung + 1;
+  } else abr.below = 0;
+  if( abr.rung > 0 && abr.rate >= MIN( ladder[ abr.rung - 1 ].kbps * 5 / 4, rate_max ) ) {
+    if( ++abr.above >= ABR_STEP_UP * fps / 1000 ) rung = abr.rung - 1;
+  } else abr.above = 0;
+  if( rung != abr.rung ) {
+    printf( "RoboCortex [info]: Rate control steps %s to %ix%i at %i kbps\n", rung > abr.rung ? "down" : "up", ladder[ rung ].w, ladder[ rung ].h, ( int )abr.rate );
+    if( rung > abr.rung ) stat_abr_down++; else stat_abr_up++;
+    abr.rung = rung;
+    abr.below = 0;
+    abr.above = 0;
+  }
+
+  abr_apply();
+}
+
+// Encodes at the smaller of the bandwidth and governor rungs
+static void encoder_rung() {
+  int rung = MAX( abr.rung, gov_rung );
+  if( rung == enc_rung ) return;
+  enc_rung = rung;
+  encoder_resize( enc, ladder[ rung ].w, ladder[ rung ].h );
+}
+
+// Switches backend when the controlling client takes another encoding
+static void encoder_choose( int encoders ) {
+  encoder_t *e = encoder_pick( encoders );
+  if( e == enc ) return;
+  printf( "RoboCortex [info]: Switching to %s encoder\n", e->name );
+  encoder_resize( e, enc_w, enc_h );
+  if( streams_enable ) streams_choose( e );
+}
+
+/* == ENCODER GOVERNOR ========================================================================== */
+
+// Applies a governor level, effort is changed on the running encoder
+static void gov_set( int level ) {
+  int faster = PRESETS - 1 - preset; // Levels spent on faster presets
+  gov_level = level;
+  eparam.effort = preset + MIN( level, faster );
+  enc->reconfig( enc_inst, &eparam );
+  if( streams_enable ) streams_reconfig();
+  if( simulcast ) sim_reconfig();
+  gov_skip = ( level > faster ? 2 : 1 );
+  gov_rung = MAX( level - faster - 1, 0 );
+}
+
+// Picks the initial level for this machine by timing compose+encode at each preset
+static void gov_calibrate() {
+  enc_frame_t out;
+  int n, i, level;
+  uint64_t start, cost;
+  for( level = 0; ; level++ ) {
+    gov_set( level );
+    for( cost = 0, i = 0; i <= GOV_CALIBRATE; i++ ) {
+      for( n = 0; n < cap_count; n++ ) cap[ n ].data = ( uint8_t * )capture_fetch( n );
+      start = sys_time_us();
+      cap_process();
+      sws_scale( swsCtx, ( const uint8_t* const* )&pic_rgb24, &stream_stride, 0, stream_h, pic_plane, pic_stride );
+      enc->encode( enc_inst, pic_plane, pic_stride, NULL, &out );
+      // First frame may be a keyframe, not counted
+      if( i ) cost += sys_time_us() - start;
+    }
+    cost /= GOV_CALIBRATE;
+    printf( "RoboCortex [info]: Preset %s takes %i us per frame\n", presets[ preset + level ], ( int )cost );
+    if( cost < GOV_TARGET * 1000000 / fps || preset + level == PRESETS - 1 ) break;
+  }
+}
+
+// Averages load over a window, steps the encoder down under pressure and back up with hysteresis
+static void gov_update( uint64_t cost ) {
+  double load, load_up;
+  int faster = PRESETS - 1 - preset;
+  if( cost ) {
+    gov_cost += cost;
+    gov_frames++;
+  }
+  if( --gov_window > 0 ) return;
+  gov_window = GOV_WINDOW * fps / 1000;
+  load = ( gov_frames ? gov_cost / ( double )gov_frames / ( 1000000.0 * gov_skip / fps ) : 0.0 );
+  // Load at the level above, per frame cost against the budget it would have
+  load_up = ( gov_level == faster + 1 ? load * 2 : load );
+  stat_gov_load += load;
+  stat_gov_windows++;
+  gov_cost = 0;
+  gov_frames = 0;
+  if( gov_hold ) {
+    gov_hold--;
+  } else if( ( load > GOV_HIGH || gov_late ) && gov_level + 1 < gov_levels ) {
+    gov_set( gov_level + 1 );
+    printf( "RoboCortex [info]: Encoder load %i%%, stepping down to level %i\n", ( int )( load * 100 ), gov_level );
+    stat_gov_down++;
+    gov_hold = GOV_HOLD;
+    gov_calm = 0;
+  } else if( load_up < GOV_LOW && gov_level > 0 ) {
+    if( ++gov_calm >= GOV_CALM ) {
+      gov_set( gov_level - 1 );
+      printf( "RoboCortex [info]: Encoder load %i%%, stepping up to level %i\n", ( int )( load * 100 ), gov_level );
+      stat_gov_up++;
+      gov_hold = GOV_HOLD;
+      gov_calm = 0;
+    }
+  } else gov_calm = 0;
+  gov_late = 0;
+}
+
 /* == PLUGIN SYSTEM ============================================================================= */
 
 // Plugin helpers
@@ -592,8 +1932,9 @@ static void plug_capget( int dev, int *w, int *h, int *e, SDL_Rect *src, SDL_Rec
 }
 
 static void plug_capset( int dev, int e, SDL_Rect *src, SDL_Rect *dst ) {
-  int changed = 0;
+  int changed = 0, enable = cap[ dev ].enable;
   cap[ dev ].enable = ( e == CAP_ENABLE ? 1 : ( e == CAP_DISABLE ? 0 : dev[ cap ].enable != ( e == CAP_TOGGLE ? 1 : 0 ) ) );
+  if( cap[ dev ].enable != enable ) roi_dirty = 1;
   if( src || dst ) {
     SDL_mutexP( cap_mx );
     if( src ) if( memcmp( &cap[ dev ].src, src, sizeof( SDL_Rect ) ) != 0 ) changed = 1;
@@ -602,6 +1943,7 @@ static void plug_capset( int dev, int e, SDL_Rect *src, SDL_Rect *dst ) {
       if( src ) memcpy( &cap[ dev ].src, src, sizeof( SDL_Rect ) );
       if( dst ) memcpy( &cap[ dev ].dst, dst, sizeof( SDL_Rect ) );
       cap_context( dev );
+      roi_dirty = 1;
     }
     SDL_mutexV( cap_mx );
   }
@@ -614,9 +1956,27 @@ static void plug_capz( int dev, int z ) {
     for( n = 0; n < cap_count; n++ ) if( n != dev && cap[ n ].z > cap[ dev ].z ) cap[ n ].z--;
     for( n = 0; n < cap_count; n++ ) if( n != dev && cap[ n ].z >= z ) cap[ n ].z++;
     cap[ dev ].z = z;
+    roi_dirty = 1;
   }
 }
 
+static void plug_roi( int id, SDL_Rect *r, int priority ) {
+  if( id < 0 || id >= ROI_MAX ) return;
+  SDL_mutexP( cap_mx );
+  if( r ) memcpy( &roi[ id ].r, r, sizeof( SDL_Rect ) );
+  roi[ id ].priority = ( r ? priority : 0 );
+  SDL_mutexV( cap_mx );
+  roi_dirty = 1;
+}
+
+static uint64_t plug_mac( void *data, int size ) {
+  uint8_t msg[ 1 + 64 ];
+  size = MAX( MIN( size, 64 ), 0 );
+  msg[ 0 ] = MAC_PLUGIN;
+  memcpy( msg + 1, data, size );
+  return( siphash( msg, 1 + size ) );
+}
+
 static int plug_cfg( char* dst, char* req_token ) {
   return( config_plugin( plug->ident, dst, req_token ) );
 }
@@ -633,12 +1993,17 @@ static void load_plugins() {
   host.cap_set      = plug_capset;
   host.cap_get      = plug_capget;
   host.cap_zorder   = plug_capz;
+  host.roi_set      = plug_roi;
   host.comm_recv    = comm_recv;
+  host.mac          = plug_mac;
   printf( "RoboCortex [info]: Loading plugins...\n" );
   // Load plugins
   plugs[ plugs_count++ ] = kiwiray_open( &host );
   plugs[ plugs_count++ ] = monitor_open( &host );
   plugs[ plugs_count++ ] = ipv4udp_open( &host );
+  plugs[ plugs_count++ ] = shm0_open( &host );
+  plugs[ plugs_count++ ] = udpm_open( &host );
+  plugs[ plugs_count++ ] = multipath_open( &host );
   printf( "RoboCortex [info]: Initializing plugins...\n" );
   // plugin->init
   for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ ) {
@@ -671,11 +2036,11 @@ void close_message() {
 }
 
 void encoder_free() {
-  x264_encoder_close( encoder );
+  enc->close( enc_inst );
 }
 
 void i420_free() {
-  x264_picture_clean( &pic_in );
+  free( pic_plane[ 0 ] );
 }
 
 void rgb24_free() {
@@ -701,9 +2066,52 @@ void ctx_free() {
   sws_freeContext( swsCtx );
 }
 
+void roi_free() {
+  free( roi_map );
+}
+
+void streams_free() {
+  stream_t *st;
+  int n;
+  streams_quit = 1;
+  for( n = 0; n < cap_count; n++ ) {
+    st = &streams[ n ];
+    if( st->thread == NULL ) continue;
+    SDL_SemPost( st->go );
+    SDL_WaitThread( st->thread, NULL );
+    SDL_DestroySemaphore( st->go );
+    SDL_DestroySemaphore( st->done );
+    st->enc->close( st->inst );
+    if( st->sws ) sws_freeContext( st->sws );
+    free( st->plane[ 0 ] );
+    printf( "RoboCortex [info]: Stream %i: %u frames, %u bytes\n", n, st->stat_frames, st->stat_bytes );
+  }
+}
+
+void sim_free() {
+  sim_quit = 1;
+  SDL_SemPost( sim_go );
+  SDL_WaitThread( sim_thread, NULL );
+  SDL_DestroySemaphore( sim_go );
+  SDL_DestroySemaphore( sim_done );
+  enc_x264->close( sim_inst );
+  free( sim_plane[ 0 ] );
+}
+
+void spec_free() {
+  int n;
+  spec_quit = 1;
+  SDL_SemPost( spec_wake );
+  SDL_WaitThread( spec_thread, NULL );
+  SDL_DestroySemaphore( spec_wake );
+  SDL_DestroyMutex( spec_mx );
+  for( n = 0; n < SPEC_RING; n++ ) free( spec_ring[ n ].data );
+  free( spec_frame.data );
+}
+
 void clients_free() {
   int n;
-  for( n = 0; n < max_clients; n++ ) {
+  for( n = 0; n < client_slots; n++ ) {
     if( clients[ n ].remote.addr ) free( clients[ n ].remote.addr );
   }
   free( clients );
@@ -714,22 +2122,23 @@ void clients_free() {
 int main( int argc, char *argv[] ) {
   int            n, pid;
 	int            cap_w, cap_h;
-  x264_param_t   param;
-  x264_nal_t    *nals;
-  int            i_nals;
-  int            frame_size;
-  char           p_buffer[ 65536 ] __attribute__ ((aligned));
+  rung_t         rung;
+  enc_frame_t    out;
+  enc_frame_t   *layer;
+  char           p_buffer[ 8192 ] __attribute__ ((aligned));
   unsigned int   i_buffer;
-  int            pl, pm, pt = 0;
+  int            pt = 0;
   int            nalc = 0, nalb = 0;
   disp_data_t    disp;
+  remote_t       remote;
+  char           addr[ 128 ];
   int            temp;
   Uint32         time_target;
   Sint32         time_diff;
   FILE          *cf;
-#ifdef SAVE_STREAM
-  FILE          *sf;
-#endif
+  int            encode;
+  unsigned int   frames = 0;
+  uint64_t       start, cost;
 
   printf( "RoboCortex [info]: OHAI!\n\n" );
   atexit( close_message );
@@ -745,16 +2154,40 @@ int main( int argc, char *argv[] ) {
     exit( EXIT_NOSOURCE );
   }
   host.cap_count = cap_count;
+
+  // Resolution ladder, highest bitrate first, defaults to the stream size alone
+  if( ladder_count == 0 ) {
+    ladder[ 0 ].w = stream_w;
+    ladder[ 0 ].h = stream_h;
+    ladder[ 0 ].kbps = 0;
+    ladder_count = 1;
+  }
+  for( n = 1; n < ladder_count; n++ ) {
+    for( pid = n; pid > 0 && ladder[ pid ].kbps > ladder[ pid - 1 ].kbps; pid-- ) {
+      rung = ladder[ pid ];
+      ladder[ pid ] = ladder[ pid - 1 ];
+      ladder[ pid - 1 ] = rung;
+    }
+  }
+  enc_w = ladder[ 0 ].w;
+  enc_h = ladder[ 0 ].h;
+  abr.rate = rate_max;
+  abr.rate_set = rate_max;
+  abr.crf_set = crf;
   if( max_clients == 0 ) {
     max_clients = 1;
     direct = 1;
     timeout_control = 0;
   }
+  // Spectators watch the controller's frames, not per-source streams
+  if( direct || streams_enable ) spectate = 0;
+  if( !spectate ) max_spectators = 0;
+  client_slots = max_clients + max_spectators;
 
   // Allocate client memory
-  clients = malloc( sizeof( client_t ) * max_clients );
+  clients = malloc( sizeof( client_t ) * client_slots );
   // TODO: check
-  memset( clients, 0, sizeof( client_t ) * max_clients );
+  memset( clients, 0, sizeof( client_t ) * client_slots );
   atexit( clients_free );
 
   // Initialize audio
@@ -789,60 +2222,23 @@ int main( int argc, char *argv[] ) {
     }
   }
 
-  // Initialize encoder
-  x264_param_default_preset( &param, "medium", "zerolatency" );
-
-  param.i_width   = stream_w;
-  param.i_height  = stream_h;
-  param.i_fps_num = fps;
-
-  // Settings as explained by http://x264dev.multimedia.cx/archives/249
-
-  x264_param_parse( &param, "slice-max-size", "8192" ); /* Practically disables slicing.
-  																											   Slicing is the splitting of frame data into
-  																											   a series of NALs, each having a maximum size
-  																											   so that they can be transported over
-  																											   interfaces that has a limited packet size/MTU */
-
-  x264_param_parse( &param, "vbv-maxrate", "500" );     /* Set VBV mode and max bitrate (kbps).
-  																												 VBV is variable bitrate, which means the rate
-  																												 will vary depending on how complex the scene
-  																												 is at the moment - detail, motion, etc. */
-
-  x264_param_parse( &param, "vbv-bufsize", "30" );		  /* Enable single-frame VBV.
-  																												 This will cap all frames so that they only
-  																												 contain a maximum amount of information,
-  																												 which in turn means that each frame can
-  																												 always be sent in one packet and packetss
-  																												 will be of a much more unform size. */
-
-  x264_param_parse( &param, "crf", "20" );							/* Constant Rate Factor.
-  																												 Tells VBV to target a specific quality. */
-
-  x264_param_parse( &param, "intra-refresh", NULL );		/* Enable intra-refresh.
-  																												 Intra-refresh allows single-frame VBV to
-  																												 work well by disabling I-frames and
-  																												 replacing them with a periodic refresh
-  																												 that scans across the image, refreshing
-  																												 only a smaller portion each frame.
-  																												 I-frames can be seen as a full-frame
-  																												 refresh that needs no other data to decode
-  																												 the picture, and takes a lot more space
-  																												 than P/B (differential) frames. */
-
-  param.b_annexb = 1;																		/* Use Annex-B packaging.
-  																											   This appends a marker at the start of
-  																											   each NAL unit. */
-
-  param.i_frame_reference = 1;													/* Needed for intra-refresh. */
-
-  x264_param_apply_profile( &param, "high" );						/* Apply HIGH profile.
-  																												 Allows for better compression, but needs
-  																												 to be supported by the decoder. We use
-  																												 FFMPEG, which does support this profile. */
-
-  // Open encoder
-  encoder = x264_encoder_open( &param );
+  // Initialize encoder, the backend may change when a client that decodes another takes control
+  enc_x264 = enc_x264_open();
+  enc_jpeg = enc_jpeg_open();
+  enc = enc_x264;
+  eparam.w       = enc_w;
+  eparam.h       = enc_h;
+  eparam.fps     = fps;
+  eparam.slices  = slices;
+  eparam.rate    = rate_max;
+  eparam.crf     = crf;
+  eparam.effort  = preset;
+  eparam.quality = jpeg_quality;
+  enc_inst = enc->open( &eparam );
+  if( enc_inst == NULL ) {
+    printf( "RoboCortex [error]: Unable to open encoder\n" );
+    exit( EXIT_ENCODER );
+  }
   atexit( encoder_free );
 
   // Allocate RGB24 picture
@@ -856,24 +2252,62 @@ int main( int argc, char *argv[] ) {
   }
   
   // Allocate I420 picture
-  if( x264_picture_alloc( &pic_in, X264_CSP_I420, stream_w, stream_h ) == 0 ) {
+  if( i420_alloc( pic_plane, pic_stride, enc_w, enc_h ) == 0 ) {
     atexit( i420_free );
   } else {
     exit( EXIT_PICTURE );
   }
 
   // Allocate conversion context 
-  swsCtx = sws_getContext( stream_w, stream_h, PIX_FMT_RGB24, stream_w, stream_h, PIX_FMT_YUV420P, SWS_POINT, NULL, NULL, NULL );
+  swsCtx = sws_getContext( stream_w, stream_h, PIX_FMT_RGB24, enc_w, enc_h, PIX_FMT_YUV420P, ( enc_w == stream_w && enc_h == stream_h ? SWS_POINT : SWS_FAST_BILINEAR ), NULL, NULL, NULL );
   if( swsCtx ) {
     atexit( ctx_free );
   } else {
     exit( EXIT_SWSCALE );
   }
+  atexit( roi_free );
+
+  // Each source on its own encoder, composed by the client
+  if( streams_enable ) {
+    streams_open();
+    atexit( streams_free );
+  }
+
+  // Reduced layer, from the same picture as the full one
+  if( simulcast && !streams_enable ) {
+    sim_open();
+    atexit( sim_free );
+  } else {
+    simulcast = 0;
+  }
+
+  // Fan-out of encoded frames to everyone watching
+  if( spectate ) {
+    spec_mx = SDL_CreateMutex();
+    spec_wake = SDL_CreateSemaphore( 0 );
+    spec_thread = SDL_CreateThread( spec_fanout, NULL );
+    atexit( spec_free );
+  }
+
+  // Allocate change detection samples
+  n = ( ( stream_w + STILL_STEP - 1 ) / STILL_STEP ) * ( ( stream_h + STILL_STEP - 1 ) / STILL_STEP );
+  still_ref = calloc( n, 1 );
+  still_cur = calloc( n, 1 );
+  if( still_ref && still_cur ) {
+    atexit( still_free );
+  } else {
+    exit( EXIT_MALLOC );
+  }
+  if( fps_min < 1 ) fps_min = 1;
 
   host.stream_rgb24 = pic_rgb24;
   host.stream_w     = stream_w;
   host.stream_h     = stream_h;
 
+  // Generate handshake cookie key
+  cookie_init();
+  reply_time = SDL_GetTicks();
+
   // Create mutexes
   cap_mx     = SDL_CreateMutex();
   trust_mx   = SDL_CreateMutex();
@@ -885,6 +2319,11 @@ int main( int argc, char *argv[] ) {
   load_plugins();
   atexit( unload_plugins );
 
+  // Calibrate encoder governor
+  gov_levels = PRESETS - preset + ladder_count;
+  gov_window = GOV_WINDOW * fps / 1000;
+  if( gov_enable && !streams_enable ) gov_calibrate();
+
 #ifndef DISABLE_SPEECH
   speech_open();
   atexit( speech_free );
@@ -893,16 +2332,38 @@ int main( int argc, char *argv[] ) {
 
   printf( "\nRoboCortex [info]: Initialized and ready for connection...\n" );
 
-#ifdef SAVE_STREAM
-  sf = fopen( SAVE_STREAM, "wb" );
-#endif
+  // Record the full layer, off the main thread
+  if( record[ 0 ] ) {
+    if( recorder_open( record, record_size, record_time ) == 0 ) {
+      atexit( recorder_close );
+    } else {
+      printf( "RoboCortex [error]: Unable to start recording\n" );
+      record[ 0 ] = 0;
+    }
+  }
+
+  // Packetise the full layer as RTP for standard players
+  if( rtp_dest[ 0 ] ) {
+    if( rtp_open( rtp_dest, rtp_sdp[ 0 ] ? rtp_sdp : NULL ) == 0 ) {
+      atexit( rtp_close );
+    } else {
+      printf( "RoboCortex [error]: Unable to start RTP output to %s\n", rtp_dest );
+      rtp_dest[ 0 ] = 0;
+    }
+  }
 
   time_target = SDL_GetTicks();
+  memset( &disp, 0, sizeof( disp_data_t ) );
 
   while( !quit ) {
 
   	speech_poll();
 
+    // Last control data applied before capture, acknowledged with this frame
+    SDL_mutexP( client_mx );
+    if( client_first ) disp.ack = client_first->ctrl.seq;
+    SDL_mutexV( client_mx );
+
     // Fetch latest picture from capture devices
     for( n = 0; n < cap_count; n++ ) {
       cap[ n ].data = ( uint8_t * )capture_fetch( n );
@@ -911,8 +2372,16 @@ int main( int argc, char *argv[] ) {
         if( plug->capture ) plug->capture( n, cap[ n ].w, cap[ n ].h, cap[ n ].data );
     }
 
-		// Process and scale sources
-		cap_process( pic_in.img.i_stride, pic_in.img.plane );
+    // Governor may encode only every n-th frame
+    encode = ( ++frames % gov_skip == 0 );
+    cost = 0;
+
+		// Process and scale sources, sources are scaled by their own streams
+    if( encode && !streams_enable ) {
+      start = sys_time_us();
+      cap_process();
+      cost = sys_time_us() - start;
+    }
 
     // Have client?
     SDL_mutexP( client_mx );
@@ -920,9 +2389,13 @@ int main( int argc, char *argv[] ) {
     SDL_mutexV( client_mx );
 
     // Clear motion if control packets are not arriving
+    // plugins are steered from the receive path, so tell them too
     if( temp ) {
       if( client_first->glitch == 0 ) {
+        SDL_mutexP( receive_mx );
         client_first->ctrl.ctrl.kb = 0;
+        if( client_first->applied.kb ) clients_control( client_first );
+        SDL_mutexV( receive_mx );
       }
     }
 
@@ -933,51 +2406,99 @@ int main( int argc, char *argv[] ) {
     for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ )
       if( plug->tick ) plug->tick();
 
-		// Convert to I420, as explained by http://stackoverflow.com/questions/2940671/how-to-encode-series-of-images-into-h264-using-x264-api-c-c
-    sws_scale( swsCtx, ( const uint8_t* const* )&pic_rgb24, &stream_stride, 0, stream_h, pic_in.img.plane, pic_in.img.i_stride );
-
-    // Encode frame
-    if( do_intra ) {
-      do_intra = 0;
-      x264_encoder_intra_refresh( encoder );
+    // Static scene without input, drop to fps_min
+    if( encode && fps_min < fps && !streams_enable ) {
+      start = sys_time_us();
+      encode = still_check( frames, temp && ( client_first->diff.mx || client_first->diff.my || client_first->diff.kb || client_first->ctrl.ctrl.kb ) );
+      cost += sys_time_us() - start;
     }
-    frame_size = x264_encoder_encode( encoder, &nals, &i_nals, &pic_in, &pic_out );
 
-    // Iterate NALs
-    pl = 0;
-    pm = 0;
-    i_buffer = 0;
-    for( n = 0; n < i_nals; n++ ) {
+    // Spectators waiting for a frame to decode from, one refresh wave serves them all
+    if( spectate ) spec_due();
 
-      // Track payload sizes
-      pl += nals[ n ].i_payload;
-      if( nals[ n ].i_payload > pm ) pm = nals[ n ].i_payload;
+    // Recording segment waits on a refresh point to roll
+    if( record[ 0 ] && recorder_due() ) do_intra = 1;
 
-      // Concatenate into a linear buffer
-      memcpy( p_buffer + i_buffer, nals[ n ].p_payload, nals[ n ].i_payload );
-      i_buffer += nals[ n ].i_payload;
+    // Adapt bitrate and resolution to client feedback and CPU budget, may reopen the encoder
+    if( temp ) encoder_choose( client_first->encoders );
+    if( temp && abr_enable ) abr_update( disp.frame );
+    if( temp && abr_enable && sim_active() ) sim_layer( client_first );
+    if( !streams_enable ) encoder_rung();
 
-      // Total counters
+    if( encode && streams_enable ) {
+      start = sys_time_us();
+      if( do_intra ) {
+        do_intra = 0;
+        for( n = 0; n < cap_count; n++ ) streams[ n ].refresh = 1;
+      }
+      streams_encode( frames );
+      cost = sys_time_us() - start;
+      out.count = 0;
+      out.qp = streams[ 0 ].out.qp;
+      out.type = streams[ 0 ].out.type;
+    } else if( encode ) {
+      start = sys_time_us();
+
+      // Convert to I420, as explained by http://stackoverflow.com/questions/2940671/how-to-encode-series-of-images-into-h264-using-x264-api-c-c
+      sws_scale( swsCtx, ( const uint8_t* const* )&pic_rgb24, &stream_stride, 0, stream_h, pic_plane, pic_stride );
+
+      // Region-of-interest QP offsets, rebuilt when the layout changes
+      if( roi_dirty ) roi_build();
+
+      // Encode frame
+      if( do_intra ) {
+        do_intra = 0;
+        enc->refresh( enc_inst );
+      }
+      if( sim_active() ) SDL_SemPost( sim_go ); else sim_out.count = 0;
+      if( enc->encode( enc_inst, pic_plane, pic_stride, roi_active ? roi_map : NULL, &out ) != 0 ) out.count = 0;
+      if( sim_active() ) SDL_SemWait( sim_done );
+      cost += sys_time_us() - start;
+    } else {
+      out.count = 0;
+      sim_out.count = 0;
+    }
+
+    // Track packet sizes
+    out.size = 0;
+    for( n = 0; n < out.count; n++ ) {
+      out.size += out.sizes[ n ];
+      if( out.sizes[ n ] > pt ) pt = out.sizes[ n ];
       nalc += 1;
-      nalb += nals[ n ].i_payload;
+      nalb += out.sizes[ n ];
     }
 
-#ifdef SAVE_STREAM
-    fwrite( p_buffer, 1, i_buffer, sf );
-#endif
+    // Queue for the recorder, dropped rather than waited on if the disk falls behind
+    if( record[ 0 ] && out.count ) recorder_push( out.data, out.size, out.key, enc->ident );
 
-    // Largest packet
-    if( pl > pt ) pt = pl;
+    // RTP carries H.264 only, nothing is sent while a client has the JPEG backend
+    if( rtp_dest[ 0 ] && out.count && enc->ident == ENC_H264 ) rtp_send( out.data, out.size, SDL_GetTicks() );
 
     // Client connected?
-    if( temp ) {
+    if( temp && encode && clients_remote( client_first, &remote, addr, sizeof( addr ) ) ) {
 
-    	// Send H.264 frame
-      ( ( pluginclient_t* )( client_first->remote.handler ) )->comm_send( p_buffer, i_buffer, &client_first->remote );
+    	// Send H.264 frame or JPEG slices of the controller's layer, packet by packet
+      layer = ( client_first->layer ? &sim_out : &out );
+      for( n = 0, i_buffer = 0; n < layer->count; i_buffer += layer->sizes[ n++ ] )
+        ( ( pluginclient_t* )( remote.handler ) )->comm_send( layer->data + i_buffer, layer->sizes[ n ], &remote );
+      if( streams_enable ) out.size = streams_send( &remote );
 
       // Build DATA packet
       memcpy( p_buffer, "DATA", 4 );
       disp.timer    = client_first->timer;
+      disp.echo     = client_first->ctrl.seq;
+      disp.echo_delay = SDL_GetTicks() - client_first->ctrl_tick;
+      disp.qp       = layer->qp;
+      disp.type     = layer->type;
+      disp.size     = layer->size;
+      disp.frame++;
+      disp.still    = still;
+      disp.rate     = abr.rate_set;
+      disp.stream_w = ( streams_enable ? stream_w : client_first->layer ? sim_param.w : enc_w );
+      disp.stream_h = ( streams_enable ? stream_h : client_first->layer ? sim_param.h : enc_h );
+      abr.sent[ disp.frame % ABR_HISTORY ] = SDL_GetTicks();
+      stat_abr_sum += abr.rate_set;
+      stat_abr_frames++;
       disp.trust_cli = client_first->trust_cli;
       disp.trust_srv = client_first->trust_srv;
       memcpy( p_buffer + 4, &disp, sizeof( disp_data_t ) );
@@ -1002,20 +2523,25 @@ int main( int argc, char *argv[] ) {
         if( plug->stream ) plug->stream( p_buffer, i_buffer );
 
       // Send DATA packet
-      ( ( pluginclient_t* )( client_first->remote.handler ) )->comm_send( p_buffer, i_buffer, &client_first->remote );
+      ( ( pluginclient_t* )( remote.handler ) )->comm_send( p_buffer, i_buffer, &remote );
 
-    } else {
+    } else if( !temp ) {
       // plugin->still
       for( pid = 0; pid < MAX_PLUGINS && ( plug = plugs[ pid ] ) != NULL; pid++ )
         if( plug->still ) plug->still();
     }
 
+    // Same frame to spectators, once the controller has it
+    if( spectate && encode && out.count ) spec_push( &out, 0, enc->ident );
+    if( spectate && encode && sim_out.count ) spec_push( &sim_out, 1, enc_x264->ident );
+
     // Delay 1/fps seconds, constantly correct for processing overhead
     time_diff = SDL_GetTicks() - time_target;
     if( time_diff > 1000 / fps ) {
       time_diff = 0;
       time_target = SDL_GetTicks(); // Reset on overflow
       printf( "RoboCortex [warning]: Encoder cannot keep up with desired FPS\n" );
+      gov_late = 1;
     }
     if( time_diff < 0 ) {
       time_diff = 0;
@@ -1024,17 +2550,33 @@ int main( int argc, char *argv[] ) {
     time_target += 1000 / fps;
     SDL_Delay( ( 1000 / fps ) - time_diff );
 
+    // Step encoder effort to the CPU budget, frames skipped on a static scene do not count
+    if( gov_enable ) gov_update( encode ? cost : 0 );
+
     // Tick client timers
     clients_tick();
 
   }
 
-#ifdef SAVE_STREAM
-  fclose( sf );
-#endif
-
-  printf( "RoboCortex [info]: NAL units: %i, %i bytes\n", nalc, nalb );
-  printf( "RoboCortex [info]: Largest packet: %i\n\n", pt );
+  printf( "RoboCortex [info]: Packets: %i, %i bytes (%s)\n", nalc, nalb, enc->name );
+  printf( "RoboCortex [info]: Largest packet: %i\n", pt );
+  printf( "RoboCortex [info]: Handshakes: %u challenged, %u validated, %u rejected, %u unpadded, %u replies throttled\n",
+    stat_challenged, stat_validated, stat_rejected, stat_unpadded, stat_throttled );
+  printf( "RoboCortex [info]: Rate control: %u delay and %u loss decreases, %u steps down, %u up, %.0f kbps average\n",
+    stat_abr_delay, stat_abr_loss, stat_abr_down, stat_abr_up, stat_abr_frames ? stat_abr_sum / stat_abr_frames : 0.0 );
+  printf( "RoboCortex [info]: Encoder governor: level %i of %i (preset %s), %u steps down, %u up, %.0f%% average load\n",
+    gov_level, gov_levels - 1, presets[ preset + MIN( gov_level, PRESETS - 1 - preset ) ], stat_gov_down, stat_gov_up,
+    stat_gov_windows ? 100.0 * stat_gov_load / stat_gov_windows : 0.0 );
+  printf( "RoboCortex [info]: Region-of-interest map rebuilds: %u\n", stat_roi_builds );
+  printf( "RoboCortex [info]: Frames skipped on a static scene: %u\n", stat_still );
+  if( simulcast ) {
+    printf( "RoboCortex [info]: Simulcast: %u reduced frames, %.2f ms each (%.0f%% of frame time), %u clients moved down, %u up\n",
+      stat_sim_frames, stat_sim_frames ? stat_sim_cost / 1000.0 / stat_sim_frames : 0.0,
+      stat_sim_frames ? stat_sim_cost / 10.0 * fps / stat_sim_frames : 0.0, stat_sim_down, stat_sim_up );
+  }
+  printf( "RoboCortex [info]: Spectators: %u frames fanned out, %u sent, %u dropped by pacing, %u overrun, %u refreshes\n",
+    stat_spec_frames, stat_spec_sent, stat_spec_paced, stat_spec_overrun, stat_spec_refresh );
+  printf( "RoboCortex [info]: Sessions resumed: %u\n\n", stat_resumed );
 
   exit( EXIT_OK );
 }